@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+// FFT buffer alignment benchmark.
+// Measures the throughput of the channelizer forward FFT (csdr_fft_execute)
+// and of the per-channel inverse channelizer (fastddc_inv_cc) with buffers
+// allocated by XCALLOC_ALIGNED and with buffers offset by 16 bytes from it,
+// which is the alignment guaranteed by plain calloc (used before).
+// FFT sizes are those used by dumphfdl for the given sample rate.
+// Plans are single-threaded and created with FFTW_MEASURE.
+// Build with -DBENCHMARKS=ON and run bench/fft-alignment [seconds_per_test] [sample_rate].
+#include <stdio.h>
+#include <stdlib.h>             // atof, atoi, rand
+#include <stdint.h>
+#include <stdbool.h>
+#include <complex.h>
+#include <time.h>               // clock_gettime
+#include "fft.h"                // csdr_*fft*, FFT_PLAN_T
+#include "fastddc.h"            // fft_channelizer_create, fastddc_inv_cc
+#include "libcsdr.h"            // compute_fft_decimation_rate, compute_filter_relative_transition_bw
+#include "hfdl.h"               // HFDL_SYMBOL_RATE, SPS, HFDL_CHANNEL_TRANSITION_BW_HZ
+#include "util.h"               // XCALLOC_ALIGNED, XFREE
+
+#define BENCH_TIME_DEFAULT 1.0          // seconds per test
+#define BENCH_SAMPLE_RATE_DEFAULT 912000
+#define BENCH_CHANNEL_SHIFT 0.1f        // channel frequency relative to the sample rate
+#define BENCH_MISALIGNMENT 2            // buffer offset in samples (16 bytes)
+
+struct bench_buf {
+	float complex *mem;             // as allocated
+	float complex *data;            // possibly misaligned
+};
+
+static float complex *bench_buf_alloc(struct bench_buf *b, size_t len, bool misaligned) {
+	b->mem = XCALLOC_ALIGNED(len + BENCH_MISALIGNMENT, sizeof(float complex));
+	b->data = b->mem + (misaligned ? BENCH_MISALIGNMENT : 0);
+	for(size_t i = 0; i < len; i++) {
+		b->data[i] = CMPLXF((float)rand() / RAND_MAX - 0.5f, (float)rand() / RAND_MAX - 0.5f);
+	}
+	return b->data;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the time of a single forward FFT in seconds
+static double bench_fwd_fft(int32_t fft_size, bool misaligned, double duration) {
+	struct bench_buf in, out;
+	bench_buf_alloc(&in, fft_size, misaligned);
+	bench_buf_alloc(&out, fft_size, misaligned);
+	// Planning overwrites the arrays, which does not matter here
+	FFT_PLAN_T *plan = csdr_make_fft_c2c(fft_size, in.data, out.data, 1, 1, FFT_PLAN_CHANNELIZER);
+	uint64_t cnt = 0;
+	csdr_fft_execute(plan);         // warm up caches
+	double const start = now();
+	double elapsed;
+	do {
+		csdr_fft_execute(plan);
+		cnt++;
+		elapsed = now() - start;
+	} while(elapsed < duration);
+	csdr_destroy_fft_c2c(plan);
+	XFREE(in.mem);
+	XFREE(out.mem);
+	return elapsed / cnt;
+}
+
+// Returns the time of a single fastddc_inv_cc call (one channel, one frame) in seconds
+static double bench_inv_cc(fft_channelizer c, bool misaligned, double duration) {
+	fastddc_t *ddc = c->ddc;
+	struct bench_buf in, out, taps, inv_in, inv_out;
+	bench_buf_alloc(&in, ddc->fft_size, misaligned);
+	bench_buf_alloc(&out, ddc->post_input_size, misaligned);
+	bench_buf_alloc(&taps, ddc->fft_size, misaligned);
+	bench_buf_alloc(&inv_in, ddc->fft_inv_size, misaligned);
+	bench_buf_alloc(&inv_out, ddc->fft_inv_size, misaligned);
+	for(int32_t i = 0; i < ddc->fft_size; i++) {
+		taps.data[i] = c->filtertaps_fft[i];
+	}
+	FFT_PLAN_T *plan = csdr_make_fft_c2c(ddc->fft_inv_size, inv_in.data, inv_out.data, 0, 1, FFT_PLAN_CHANNEL);
+	decimating_shift_addition_status_t shift_status = c->shift_status;
+	uint64_t cnt = 0;
+	shift_status = fastddc_inv_cc(in.data, out.data, ddc, plan, taps.data, shift_status);
+	double const start = now();
+	double elapsed;
+	do {
+		shift_status = fastddc_inv_cc(in.data, out.data, ddc, plan, taps.data, shift_status);
+		cnt++;
+		elapsed = now() - start;
+	} while(elapsed < duration);
+	csdr_destroy_fft_c2c(plan);
+	XFREE(in.mem);
+	XFREE(out.mem);
+	XFREE(taps.mem);
+	XFREE(inv_in.mem);
+	XFREE(inv_out.mem);
+	return elapsed / cnt;
+}
+
+int main(int argc, char **argv) {
+	double const duration = argc > 1 ? atof(argv[1]) : BENCH_TIME_DEFAULT;
+	int32_t const sample_rate = argc > 2 ? atoi(argv[2]) : BENCH_SAMPLE_RATE_DEFAULT;
+	if(duration <= 0.0 || sample_rate <= 0) {
+		fprintf(stderr, "Usage: %s [seconds_per_test] [sample_rate]\n", argv[0]);
+		return 1;
+	}
+	csdr_fft_set_planner_effort(FFT_PLANNER_MEASURE);
+	csdr_fft_set_thread_cnt(FFT_PLAN_CHANNELIZER, 1);
+	csdr_fft_set_thread_cnt(FFT_PLAN_CHANNEL, 1);
+	csdr_fft_init();
+
+	int32_t const decimation = compute_fft_decimation_rate(sample_rate, HFDL_SYMBOL_RATE * SPS);
+	float const transition_bw = compute_filter_relative_transition_bw(sample_rate, HFDL_CHANNEL_TRANSITION_BW_HZ);
+	fft_channelizer c = fft_channelizer_create(decimation, transition_bw, BENCH_CHANNEL_SHIFT);
+	if(c == NULL) {
+		fprintf(stderr, "Failed to create the channelizer\n");
+		return 1;
+	}
+	printf("sample rate: %d, decimation: %d, FFT size: %d, inverse FFT size: %d\n",
+			sample_rate, decimation, c->ddc->fft_size, c->ddc->fft_inv_size);
+	printf("%-16s %16s %16s %8s\n", "test", "aligned [us]", "misaligned [us]", "speedup");
+
+	double const fwd_aligned = bench_fwd_fft(c->ddc->fft_size, false, duration);
+	double const fwd_misaligned = bench_fwd_fft(c->ddc->fft_size, true, duration);
+	printf("%-16s %16.2f %16.2f %7.2fx\n", "forward FFT",
+			fwd_aligned * 1e6, fwd_misaligned * 1e6, fwd_misaligned / fwd_aligned);
+
+	double const inv_aligned = bench_inv_cc(c, false, duration);
+	double const inv_misaligned = bench_inv_cc(c, true, duration);
+	printf("%-16s %16.2f %16.2f %7.2fx\n", "fastddc_inv_cc",
+			inv_aligned * 1e6, inv_misaligned * 1e6, inv_misaligned / inv_aligned);
+
+	fft_channelizer_destroy(c);
+	csdr_fft_destroy();
+	return 0;
+}
@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+// One-to-one block connection stress test.
+// A producer writes a sample stream, where each sample encodes its own
+// position, in random chunk sizes through a circ_buffer, while the consumer
+// reads it in fixed chunks and stalls every now and then. This is done with
+// every overflow policy, both with a consumer thread and with the consumer
+// fused with the producer. The consumer checks that every sample it reads
+// is either the next one or is preceded by gap markers covering exactly
+// the missing ones, and that the samples lost are accounted for in the
+// connection counters (and with BLOCK_OVERFLOW_DROP_OLDEST all of them
+// are signaled as gaps).
+// Build with -DBENCHMARKS=ON and run bench/ring-stress [sample_count].
+// For checking the synchronization, build with -DCMAKE_C_FLAGS=-fsanitize=thread.
+#include <stdio.h>
+#include <stdlib.h>             // strtoull, rand_r
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>           // PRIu64
+#include <complex.h>
+#include <pthread.h>            // pthread_join
+#include <unistd.h>             // usleep
+#include "block.h"              // block_*, circ_buffer_*
+#include "util.h"               // container_of
+
+#define STRESS_SAMPLE_CNT_DEFAULT 20000000ULL
+#define STRESS_PRODUCER_MTU 1000
+#define STRESS_CONSUMER_CHUNK 700
+#define STRESS_STALL_PROBABILITY 50     // consumer stalls after 1 in this many chunks
+#define STRESS_STALL_US 200
+#define STRESS_POS_RADIX 1000003        // keeps both parts exact in a float
+
+struct stress_consumer {
+	struct block block;
+	uint64_t expected;                  // position of the next sample to be read
+	uint64_t gap_cnt;
+	uint64_t gap_sum;                   // samples signaled as lost
+	bool failed;
+	bool stopped;
+};
+
+struct stress_producer {
+	struct block block;
+	uint64_t sample_cnt;                // samples to produce
+	uint64_t pos;                       // position of the next sample
+};
+
+static float complex pos_encode(uint64_t pos) {
+	return CMPLXF((float)(pos % STRESS_POS_RADIX), (float)(pos / STRESS_POS_RADIX));
+}
+
+static uint64_t pos_decode(float complex v) {
+	return (uint64_t)cimagf(v) * STRESS_POS_RADIX + (uint64_t)crealf(v);
+}
+
+// Reads a single chunk. Input data must be available.
+static void stress_consumer_read_chunk(struct stress_consumer *sc) {
+	struct block_connection *in = sc->block.consumer.in;
+	size_t gap_offsets[CIRC_BUFFER_GAP_CNT + 1];
+	uint64_t gap_lens[CIRC_BUFFER_GAP_CNT + 1];
+	size_t gap_cnt = 0, offset;
+	uint64_t len;
+	while(gap_cnt < CIRC_BUFFER_GAP_CNT + 1 &&
+			block_connection_one2one_gap_get(in, STRESS_CONSUMER_CHUNK, &offset, &len)) {
+		gap_offsets[gap_cnt] = offset;
+		gap_lens[gap_cnt] = len;
+		gap_cnt++;
+	}
+	float complex const *samples = circ_buffer_read(&in->circ_buffer, STRESS_CONSUMER_CHUNK);
+	size_t g = 0;
+	for(size_t i = 0; i < STRESS_CONSUMER_CHUNK && !sc->failed; i++) {
+		for(; g < gap_cnt && gap_offsets[g] == i; g++) {
+			sc->expected += gap_lens[g];
+			sc->gap_cnt++;
+			sc->gap_sum += gap_lens[g];
+		}
+		uint64_t const pos = pos_decode(samples[i]);
+		if(pos != sc->expected) {
+			fprintf(stderr, "sample %zu of chunk: position %" PRIu64 ", expected %" PRIu64 "\n",
+					i, pos, sc->expected);
+			sc->failed = true;
+		}
+		sc->expected++;
+	}
+	if(g != gap_cnt && !sc->failed) {
+		fprintf(stderr, "gap marker at offset %zu is out of the chunk\n", gap_offsets[g]);
+		sc->failed = true;
+	}
+	circ_buffer_release(&in->circ_buffer, STRESS_CONSUMER_CHUNK);
+}
+
+static void *stress_consumer_thread(void *ctx) {
+	struct block *block = ctx;
+	struct stress_consumer *sc = container_of(block, struct stress_consumer, block);
+	unsigned seed = 1;
+	while(block_connection_one2one_wait_data(block->consumer.in, STRESS_CONSUMER_CHUNK)) {
+		stress_consumer_read_chunk(sc);
+		if(rand_r(&seed) % STRESS_STALL_PROBABILITY == 0) {
+			usleep(STRESS_STALL_US);
+		}
+	}
+	sc->stopped = true;
+	block->running = false;
+	return NULL;
+}
+
+static void stress_consumer_fused_routine(struct block *block, bool shutdown) {
+	struct stress_consumer *sc = container_of(block, struct stress_consumer, block);
+	while(block_connection_one2one_data_available(block->consumer.in, STRESS_CONSUMER_CHUNK)) {
+		stress_consumer_read_chunk(sc);
+	}
+	if(shutdown) {
+		sc->stopped = true;
+		block->running = false;
+	}
+}
+
+static void *stress_producer_thread(void *ctx) {
+	struct block *block = ctx;
+	struct stress_producer *sp = container_of(block, struct stress_producer, block);
+	struct block_connection *out = block->producer.out;
+	unsigned seed = 7;
+	while(sp->pos < sp->sample_cnt) {
+		size_t const len = 1 + rand_r(&seed) % STRESS_PRODUCER_MTU;
+		// Samples which don't fit (BLOCK_OVERFLOW_DROP_NEWEST) are lost
+		size_t const space = block_connection_one2one_make_space(out, len);
+		float complex *buf = circ_buffer_reserve(&out->circ_buffer, space);
+		for(size_t i = 0; i < space; i++) {
+			buf[i] = pos_encode(sp->pos + i);
+		}
+		block_connection_one2one_commit(out, space);
+		sp->pos += len;
+	}
+	block_connection_one2one_shutdown(out);
+	block->running = false;
+	return NULL;
+}
+
+static bool stress_run(enum block_overflow_policy policy, bool fused, uint64_t sample_cnt) {
+	struct stress_producer sp = {
+		.block = {
+			.producer = { .type = PRODUCER_SINGLE, .max_tu = STRESS_PRODUCER_MTU },
+			.thread_routine = stress_producer_thread
+		},
+		.sample_cnt = sample_cnt
+	};
+	struct stress_consumer sc = {
+		.block = {
+			.consumer = { .type = CONSUMER_SINGLE, .min_ru = STRESS_CONSUMER_CHUNK },
+			.thread_routine = stress_consumer_thread,
+			.fused_routine = stress_consumer_fused_routine
+		}
+	};
+	if(block_connect_one2one(&sp.block, &sc.block) != 1) {
+		return false;
+	}
+	block_connection_set_overflow_policy(sp.block.producer.out, policy);
+	if(fused) {
+		block_fuse_with_producer(&sc.block);
+	}
+	if(block_start(&sc.block) != 1 || block_start(&sp.block) != 1) {
+		return false;
+	}
+	pthread_join(sp.block.thread, NULL);
+	if(!fused) {
+		pthread_join(sc.block.thread, NULL);
+	}
+	struct block_metrics m;
+	block_get_metrics(&sp.block, &m);
+	block_disconnect_one2one(&sp.block, &sc.block);
+
+	// Samples missing at the consumer were either dropped and not signaled
+	// yet (the last overrun is signaled only with the next write) or they
+	// are the incomplete last chunk
+	uint64_t const missing = sp.pos - sc.expected;
+	bool ok = !sc.failed && sc.stopped &&
+		sc.gap_sum <= m.output_samples_dropped &&
+		missing - (m.output_samples_dropped - sc.gap_sum) < STRESS_CONSUMER_CHUNK;
+	if(policy == BLOCK_OVERFLOW_BLOCK) {
+		ok = ok && m.output_samples_dropped == 0;
+	} else if(policy == BLOCK_OVERFLOW_DROP_OLDEST) {
+		ok = ok && sc.gap_sum == m.output_samples_dropped;
+	}
+	printf("%-12s %-8s %12" PRIu64 " %12" PRIu64 " %10" PRIu64 " %12" PRIu64 " %12" PRIu64 "  %s\n",
+			policy == BLOCK_OVERFLOW_BLOCK ? "block" :
+			policy == BLOCK_OVERFLOW_DROP_NEWEST ? "drop-newest" : "drop-oldest",
+			fused ? "fused" : "threaded", sp.pos, sc.expected, sc.gap_cnt, sc.gap_sum,
+			m.output_samples_dropped, ok ? "OK" : "FAILED");
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	uint64_t const sample_cnt = argc > 1 ? strtoull(argv[1], NULL, 10) : STRESS_SAMPLE_CNT_DEFAULT;
+	if(sample_cnt == 0) {
+		fprintf(stderr, "Usage: %s [sample_count]\n", argv[0]);
+		return 1;
+	}
+	printf("%-12s %-8s %12s %12s %10s %12s %12s\n", "policy", "consumer",
+			"produced", "consumed", "gaps", "gap samples", "dropped");
+	bool ok = true;
+	for(int32_t fused = 0; fused <= 1; fused++) {
+		for(int32_t policy = 0; policy < BLOCK_OVERFLOW_POLICY_CNT; policy++) {
+			ok = stress_run(policy, fused, sample_cnt) && ok;
+		}
+	}
+	return ok ? 0 : 1;
+}
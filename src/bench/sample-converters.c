@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+// Sample converter benchmark.
+// Measures the throughput of the sample converters selected at runtime
+// by get_sample_converter() and compares it with straightforward scalar
+// implementations (one division per sample, as the converters used to do).
+// Also checks that both produce the same results.
+// Build with -DBENCHMARKS=ON and run bench/sample-converters [seconds_per_test].
+#include <stdio.h>
+#include <stdlib.h>             // atof, rand
+#include <stdint.h>
+#include <string.h>             // memset
+#include <math.h>               // fabsf, ldexpf
+#include <complex.h>
+#include <time.h>               // clock_gettime
+#include "input-common.h"       // struct input, struct input_cfg
+#include "input-helpers.h"      // get_sample_*, sample_lut_init
+#include "util.h"               // XCALLOC_ALIGNED, XFREE
+
+#define BENCH_SAMPLE_CNT 65536
+#define BENCH_TIME_DEFAULT 1.0  // seconds per test
+#define BENCH_MAX_ERROR 1e-6f
+
+typedef void (*scalar_converter)(struct input *, void *, size_t, float complex *);
+
+static void scalar_cu8(struct input *input, void *inbuf, size_t len, float complex *out) {
+	uint8_t const *in = inbuf;
+	float const shift = input->full_scale / 2.0f;
+	for(size_t i = 0; i < len / 2; i++) {
+		out[i] = CMPLXF((in[2 * i] - shift) / input->full_scale, (in[2 * i + 1] - shift) / input->full_scale);
+	}
+}
+
+static void scalar_cs8(struct input *input, void *inbuf, size_t len, float complex *out) {
+	int8_t const *in = inbuf;
+	for(size_t i = 0; i < len / 2; i++) {
+		out[i] = CMPLXF(in[2 * i] / input->full_scale, in[2 * i + 1] / input->full_scale);
+	}
+}
+
+static void scalar_cs16(struct input *input, void *inbuf, size_t len, float complex *out) {
+	int16_t const *in = inbuf;
+	for(size_t i = 0; i < len / 4; i++) {
+		out[i] = CMPLXF(in[2 * i] / input->full_scale, in[2 * i + 1] / input->full_scale);
+	}
+}
+
+static void scalar_cs12(struct input *input, void *inbuf, size_t len, float complex *out) {
+	uint8_t const *in = inbuf;
+	for(size_t i = 0; i < len / 3; i++) {
+		uint8_t const *s = in + 3 * i;
+		int32_t re = s[0] | ((s[1] & 0xf) << 8);
+		int32_t im = (s[1] >> 4) | (s[2] << 4);
+		re = re >= 2048 ? re - 4096 : re;
+		im = im >= 2048 ? im - 4096 : im;
+		out[i] = CMPLXF(re / input->full_scale, im / input->full_scale);
+	}
+}
+
+static float half_to_float_ref(uint16_t h) {
+	int32_t const exp = (h >> 10) & 0x1f;
+	int32_t const mant = h & 0x3ff;
+	float v;
+	if(exp == 0) {
+		v = ldexpf((float)mant, -24);
+	} else if(exp == 31) {
+		v = mant ? NAN : INFINITY;
+	} else {
+		v = ldexpf((float)(mant | 0x400), exp - 25);
+	}
+	return (h & 0x8000) ? -v : v;
+}
+
+static void scalar_cf16(struct input *input, void *inbuf, size_t len, float complex *out) {
+	uint16_t const *in = inbuf;
+	for(size_t i = 0; i < len / 4; i++) {
+		out[i] = CMPLXF(half_to_float_ref(in[2 * i]) / input->full_scale,
+				half_to_float_ref(in[2 * i + 1]) / input->full_scale);
+	}
+}
+
+static void scalar_cf32(struct input *input, void *inbuf, size_t len, float complex *out) {
+	float const *in = inbuf;
+	for(size_t i = 0; i < len / 8; i++) {
+		out[i] = CMPLXF(in[2 * i] / input->full_scale, in[2 * i + 1] / input->full_scale);
+	}
+}
+
+static struct {
+	sample_format sfmt;
+	scalar_converter scalar;
+} const formats[] = {
+	{ SFMT_CU8, scalar_cu8 },
+	{ SFMT_CS8, scalar_cs8 },
+	{ SFMT_CS16, scalar_cs16 },
+	{ SFMT_CS12, scalar_cs12 },
+	{ SFMT_CF16, scalar_cf16 },
+	{ SFMT_CF32, scalar_cf32 },
+};
+
+// Fills the buffer with random samples in the given format
+static void fill_random(sample_format sfmt, uint8_t *buf, size_t len) {
+	switch(sfmt) {
+		case SFMT_CF32:
+			for(size_t i = 0; i < len / sizeof(float); i++) {
+				((float *)buf)[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+			}
+			break;
+		case SFMT_CF16:
+			// Finite values in the range of +/-2 (exponent 0..15)
+			for(size_t i = 0; i < len / sizeof(uint16_t); i++) {
+				((uint16_t *)buf)[i] = (uint16_t)(rand() & 0xbfff);
+			}
+			break;
+		default:
+			for(size_t i = 0; i < len; i++) {
+				buf[i] = (uint8_t)rand();
+			}
+			break;
+	}
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns conversion throughput in samples per second
+static double bench_converter(scalar_converter fun, struct input *input, void *inbuf,
+		size_t len, float complex *out, double duration) {
+	uint64_t sample_cnt = 0;
+	fun(input, inbuf, len, out);     // warm up caches
+	double const start = now();
+	double elapsed;
+	do {
+		fun(input, inbuf, len, out);
+		sample_cnt += BENCH_SAMPLE_CNT;
+		elapsed = now() - start;
+	} while(elapsed < duration);
+	return sample_cnt / elapsed;
+}
+
+int main(int argc, char **argv) {
+	double const duration = argc > 1 ? atof(argv[1]) : BENCH_TIME_DEFAULT;
+	if(duration <= 0.0) {
+		fprintf(stderr, "Usage: %s [seconds_per_test]\n", argv[0]);
+		return 1;
+	}
+	float complex *out = XCALLOC_ALIGNED(BENCH_SAMPLE_CNT, sizeof(float complex));
+	float complex *ref = XCALLOC_ALIGNED(BENCH_SAMPLE_CNT, sizeof(float complex));
+	int32_t ret = 0;
+	printf("%-6s %16s %16s %8s\n", "format", "scalar [MS/s]", "selected [MS/s]", "speedup");
+	for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		struct input_cfg cfg = { .sfmt = formats[f].sfmt };
+		struct input input = {
+			.config = &cfg,
+			.full_scale = get_sample_full_scale_value(cfg.sfmt),
+			.bytes_per_sample = get_sample_size(cfg.sfmt)
+		};
+		sample_lut_init(&input);
+		size_t const len = BENCH_SAMPLE_CNT * input.bytes_per_sample;
+		uint8_t *inbuf = XCALLOC_ALIGNED(len, 1);
+		fill_random(cfg.sfmt, inbuf, len);
+
+		convert_sample_buffer_fun convert = get_sample_converter(cfg.sfmt);
+		convert(&input, inbuf, len, out);
+		formats[f].scalar(&input, inbuf, len, ref);
+		for(size_t i = 0; i < BENCH_SAMPLE_CNT; i++) {
+			if(fabsf(crealf(out[i]) - crealf(ref[i])) > BENCH_MAX_ERROR ||
+					fabsf(cimagf(out[i]) - cimagf(ref[i])) > BENCH_MAX_ERROR) {
+				fprintf(stderr, "%s: sample %zu mismatch: %f%+fi, expected %f%+fi\n",
+						get_sample_format_name(cfg.sfmt), i, crealf(out[i]), cimagf(out[i]),
+						crealf(ref[i]), cimagf(ref[i]));
+				ret = 1;
+				break;
+			}
+		}
+		double const scalar_rate = bench_converter(formats[f].scalar, &input, inbuf, len, ref, duration);
+		double const rate = bench_converter(convert, &input, inbuf, len, out, duration);
+		printf("%-6s %16.1f %16.1f %7.2fx\n", get_sample_format_name(cfg.sfmt),
+				scalar_rate / 1e6, rate / 1e6, rate / scalar_rate);
+		XFREE(inbuf);
+	}
+	XFREE(out);
+	XFREE(ref);
+	return ret;
+}
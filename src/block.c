@@ -2,55 +2,114 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <complex.h>
-#include <stdlib.h>
+#include <stdio.h>              // fprintf
+#include <inttypes.h>           // PRIu64
+#include <string.h>             // memcpy, memset
+#include <stdatomic.h>          // atomic_*
+#include <time.h>               // clock_gettime
 #include <pthread.h>            // pthread_*
-#include <liquid/liquid.h>      // cbuffercf_*
-#include "config.h"
-#ifndef HAVE_PTHREAD_BARRIERS
-#include "pthread_barrier.h"
-#endif
+#include <sched.h>              // sched_yield
 #include "block.h"
-#include "util.h"               // XCALLOC, pthread_*_initialize, debug_print
+#include "worker-pool.h"        // worker_pool_submit
+#include "util.h"               // XCALLOC, XCALLOC_ALIGNED, pthread_*_initialize, debug_print, container_of
 
 #define BUF_SIZE_PROD_MTU_MULTIPLIER 8
 #define BUF_SIZE_CONS_MRU_MULTIPLIER 2
 
-static int32_t block_circ_buffer_init(struct circ_buffer *buffer, size_t buf_size) {
+static void block_schedule(struct block *block);
+
+static uint64_t block_clock_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int32_t block_circ_buffer_init(struct circ_buffer *buffer, size_t buf_size, size_t max_len) {
 	ASSERT(buffer);
-	buffer->buf = cbuffercf_create(buf_size);
+	ASSERT(max_len <= buf_size);
+	// Consumers read only what has been written, so no need to zero the buffer
+	buffer->buf = XMALLOC_ALIGNED(buf_size + max_len, sizeof(float complex));
+	buffer->size = buf_size;
+	buffer->max_len = max_len;
+	atomic_init(&buffer->write_cnt, 0);
+	atomic_init(&buffer->read_cnt, 0);
+	atomic_init(&buffer->write_cnt_wanted, 0);
+	atomic_init(&buffer->read_cnt_wanted, 0);
+	atomic_init(&buffer->space_wait_ns, 0);
+	atomic_init(&buffer->data_wait_ns, 0);
+	atomic_init(&buffer->gap_write_cnt, 0);
+	atomic_init(&buffer->gap_read_cnt, 0);
+	atomic_init(&buffer->producer_discarding, false);
+	atomic_init(&buffer->consumer_reading, false);
+	atomic_init(&buffer->discard_turn, 0);
+	buffer->discard_oldest = false;
 	buffer->cond = XCALLOC(1, sizeof(pthread_cond_t));
+	buffer->space_cond = XCALLOC(1, sizeof(pthread_cond_t));
 	buffer->mutex= XCALLOC(1, sizeof(pthread_mutex_t));
-	return pthread_cond_initialize(buffer->cond) || pthread_mutex_initialize(buffer->mutex);
+	return pthread_cond_initialize(buffer->cond) ||
+		pthread_cond_initialize(buffer->space_cond) ||
+		pthread_mutex_initialize(buffer->mutex);
 }
 
 static void block_circ_buffer_destroy(struct circ_buffer *buffer) {
 	if(buffer != NULL) {
-		cbuffercf_destroy(buffer->buf);
+		XFREE(buffer->buf);
 		XFREE(buffer->cond);
+		XFREE(buffer->space_cond);
 		XFREE(buffer->mutex);
 		// No XFREE(buffer) as this is a member of a struct allocated by the caller
 	}
 }
 
-static int32_t block_shared_buffer_init(struct shared_buffer *buffer, size_t buf_size, size_t thread_cnt) {
+static int32_t block_shared_buffer_init(struct shared_buffer *buffer, size_t slot_size, size_t consumer_cnt) {
 	ASSERT(buffer);
-	ASSERT(thread_cnt > 0);
-	buffer->buf = XCALLOC(buf_size, sizeof(float complex));
-	buffer->data_ready = XCALLOC(1, sizeof(pthread_barrier_t));
-	buffer->consumers_ready = XCALLOC(1, sizeof(pthread_barrier_t));
-	return pthread_barrier_create(buffer->data_ready, thread_cnt) ||
-		pthread_barrier_create(buffer->consumers_ready, thread_cnt);
+	ASSERT(consumer_cnt > 0);
+	size_t const samples_per_line = CACHE_LINE_SIZE / sizeof(float complex);
+	buffer->slot_size = slot_size;
+	// Keep all slots equally aligned, so that FFTW may write into any of them
+	buffer->slot_stride = (slot_size + samples_per_line - 1) / samples_per_line * samples_per_line;
+	buffer->buf = XMALLOC_ALIGNED(SHARED_BUFFER_SLOT_CNT * buffer->slot_stride, sizeof(float complex));
+	buffer->consumer_cnt = consumer_cnt;
+	// Synchronization structures need cache line alignment
+	buffer->cursors = XCALLOC_ALIGNED(consumer_cnt, sizeof(struct shared_buffer_cursor));
+	for(size_t i = 0; i < consumer_cnt; i++) {
+		atomic_init(&buffer->cursors[i].read_cnt, 0);
+		atomic_init(&buffer->cursors[i].wait_ns, 0);
+	}
+	buffer->consumers = XCALLOC(consumer_cnt, sizeof(struct block *));
+	atomic_init(&buffer->write_cnt, 0);
+	atomic_init(&buffer->producer_waiting, 0);
+	atomic_init(&buffer->consumers_waiting, 0);
+	atomic_init(&buffer->producer_wait_ns, 0);
+	buffer->cond = XCALLOC(1, sizeof(pthread_cond_t));
+	buffer->space_cond = XCALLOC(1, sizeof(pthread_cond_t));
+	buffer->mutex = XCALLOC(1, sizeof(pthread_mutex_t));
+	return pthread_cond_initialize(buffer->cond) ||
+		pthread_cond_initialize(buffer->space_cond) ||
+		pthread_mutex_initialize(buffer->mutex);
 }
 
 static void block_shared_buffer_destroy(struct shared_buffer *buffer) {
 	if(buffer != NULL) {
 		XFREE(buffer->buf);
-		XFREE(buffer->data_ready);
-		XFREE(buffer->consumers_ready);
+		XFREE(buffer->cursors);
+		XFREE(buffer->consumers);
+		XFREE(buffer->cond);
+		XFREE(buffer->space_cond);
+		XFREE(buffer->mutex);
 		// No XFREE(buffer) as this is a member of a struct allocated by the caller
 	}
 }
 
+static struct block_connection *block_connection_create(void) {
+	struct block_connection *connection = XCALLOC_ALIGNED(1, sizeof(struct block_connection));
+	atomic_init(&connection->flags, 0);
+	atomic_init(&connection->drop_cnt, 0);
+	atomic_init(&connection->samples_dropped, 0);
+	connection->overflow_policy = BLOCK_OVERFLOW_BLOCK;
+	return connection;
+}
+
 // Returns the number of successful connections made
 int32_t block_connect_one2one(struct block *source, struct block *sink) {
 	ASSERT(source);
@@ -64,12 +123,14 @@ int32_t block_connect_one2one(struct block *source, struct block *sink) {
 	size_t buf_size = max(buf_size_by_producer_mtu, buf_size_by_consumer_mru);
 	debug_print(D_MISC, "producer MTU: %zu consumer MRU: %zu buf_size: %zu\n",
 			source->producer.max_tu, sink->consumer.min_ru, buf_size);
-	NEW(struct block_connection, connection);
+	struct block_connection *connection = block_connection_create();
 	int32_t ret = 0;
-	if(block_circ_buffer_init(&connection->circ_buffer, buf_size) != 0) {
+	size_t max_len = max(source->producer.max_tu, sink->consumer.min_ru);
+	if(block_circ_buffer_init(&connection->circ_buffer, buf_size, max_len) != 0) {
 		goto end;
 	}
 	source->producer.out = sink->consumer.in = connection;
+	sink->clock = source->clock;
 	ret = 1;
 end:
 	return ret;
@@ -93,26 +154,25 @@ int32_t block_connect_one2many(struct block *source, size_t sink_count, struct b
 	ASSERT(source->producer.type == PRODUCER_MULTI);
 	ASSERT(source->producer.max_tu != 0);
 
-	size_t max_consumer_mru = 0;
 	for(size_t i = 0; i < sink_count; i++) {
 		ASSERT(sinks[i]->consumer.type == CONSUMER_MULTI);
-		max_consumer_mru = max(max_consumer_mru, sinks[i]->consumer.min_ru);
+		// Consumers read whole frames
+		ASSERT(sinks[i]->consumer.min_ru <= source->producer.max_tu);
 	}
-	size_t buf_size_by_producer_mtu = BUF_SIZE_PROD_MTU_MULTIPLIER * source->producer.max_tu;
-	size_t buf_size_by_consumer_mru = BUF_SIZE_CONS_MRU_MULTIPLIER * max_consumer_mru;
-	size_t buf_size = max(buf_size_by_producer_mtu, buf_size_by_consumer_mru);
-	debug_print(D_MISC, "producer MTU: %zu max consumer MRU: %zu buf_size: %zu\n",
-			source->producer.max_tu, max_consumer_mru, buf_size);
+	debug_print(D_MISC, "producer MTU: %zu consumers: %zu slots: %d\n",
+			source->producer.max_tu, sink_count, SHARED_BUFFER_SLOT_CNT);
 
-	NEW(struct block_connection, connection);
+	struct block_connection *connection = block_connection_create();
 	int32_t ret = 0;
-	// sink_count + 1 to account for the producer when initializing phread_barrier
-	if(block_shared_buffer_init(&connection->shared_buffer, buf_size, sink_count + 1) != 0) {
+	if(block_shared_buffer_init(&connection->shared_buffer, source->producer.max_tu, sink_count) != 0) {
 		goto end;
 	}
 	source->producer.out = connection;
 	for(size_t i = 0; i < sink_count; i++) {
+		connection->shared_buffer.consumers[i] = sinks[i];
 		sinks[i]->consumer.in = connection;
+		sinks[i]->consumer.id = i;
+		sinks[i]->clock = source->clock;
 		ret++;
 	}
 end:
@@ -134,18 +194,430 @@ void block_disconnect_one2many(struct block *source, size_t sink_count, struct b
 	XFREE(connection);
 }
 
+// Returns the CPU time spent by the block in its fused consumer (if any)
+static double block_fused_consumer_cpu_time(struct block *block) {
+	struct block_connection *out = block->producer.out;
+	if(block->producer.type == PRODUCER_SINGLE && out != NULL && out->fused_consumer != NULL) {
+		return out->fused_cpu_time;
+	}
+	return 0.0;
+}
+
+// Runs the fused consumer of the connection on the calling (producer's) thread
+static void block_run_fused(struct block_connection *connection, bool shutdown) {
+	struct block *consumer = connection->fused_consumer;
+	double const nested_cpu_time = block_fused_consumer_cpu_time(consumer);
+	struct timespec start, end;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	consumer->fused_routine(consumer, shutdown);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	double const cpu_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	connection->fused_cpu_time += cpu_time;
+	// Time spent in consumers fused with this one is accounted to them
+	consumer->stats.cpu_time += cpu_time - (block_fused_consumer_cpu_time(consumer) - nested_cpu_time);
+}
+
 void block_connection_one2one_shutdown(struct block_connection *connection) {
 	ASSERT(connection);
-	pthread_mutex_lock(connection->circ_buffer.mutex);
-	connection->flags |= BLOCK_CONNECTION_SHUTDOWN;
-	pthread_mutex_unlock(connection->circ_buffer.mutex);
-	pthread_cond_signal(connection->circ_buffer.cond);
+	struct circ_buffer *cb = &connection->circ_buffer;
+	atomic_fetch_or(&connection->flags, BLOCK_CONNECTION_SHUTDOWN);
+	if(connection->fused_consumer != NULL) {
+		block_run_fused(connection, true);
+		return;
+	}
+	pthread_mutex_lock(cb->mutex);
+	pthread_mutex_unlock(cb->mutex);
+	pthread_cond_signal(cb->cond);
+}
+
+// Commits len samples written by the producer. If the consumer is fused
+// with the producer, it processes them right away.
+void block_connection_one2one_commit(struct block_connection *connection, size_t len) {
+	ASSERT(connection);
+	circ_buffer_commit(&connection->circ_buffer, len);
+	if(connection->fused_consumer != NULL) {
+		block_run_fused(connection, false);
+	}
+}
+
+void block_connection_set_overflow_policy(struct block_connection *connection, enum block_overflow_policy policy) {
+	ASSERT(connection);
+	ASSERT(policy < BLOCK_OVERFLOW_POLICY_CNT);
+	connection->overflow_policy = policy;
+	connection->circ_buffer.discard_oldest = policy == BLOCK_OVERFLOW_DROP_OLDEST;
+}
+
+// Records the loss of len samples. Only the first overflow is reported
+// right away, the rest is available from connection counters.
+static void block_connection_count_drop(struct block_connection *connection, uint64_t len) {
+	if(atomic_fetch_add_explicit(&connection->drop_cnt, 1, memory_order_relaxed) == 0) {
+		fprintf(stderr, "Sample buffer overrun, samples are being dropped "
+				"(the number of lost samples is shown on exit)\n");
+	}
+	atomic_fetch_add_explicit(&connection->samples_dropped, len, memory_order_relaxed);
+	debug_print(D_MISC, "buffer overrun, %" PRIu64 " samples lost\n", len);
+}
+
+enum { DISCARD_TURN_PRODUCER, DISCARD_TURN_CONSUMER };
+
+// Acquires the discard lock of the circ_buffer for the producer or the consumer.
+// Critical sections on both sides are short and never wait for anything,
+// so the other side just yields until the lock is released.
+static void circ_buffer_discard_lock(struct circ_buffer *cb, bool producer) {
+	_Atomic bool *own = producer ? &cb->producer_discarding : &cb->consumer_reading;
+	_Atomic bool *other = producer ? &cb->consumer_reading : &cb->producer_discarding;
+	uint32_t const other_turn = producer ? DISCARD_TURN_CONSUMER : DISCARD_TURN_PRODUCER;
+	atomic_store(own, true);
+	atomic_store(&cb->discard_turn, other_turn);
+	while(atomic_load(other) && atomic_load(&cb->discard_turn) == other_turn) {
+		sched_yield();
+	}
+}
+
+static void circ_buffer_discard_unlock(struct circ_buffer *cb, bool producer) {
+	atomic_store(producer ? &cb->producer_discarding : &cb->consumer_reading, false);
+}
+
+// Returns true if at least len samples are available for reading.
+// With BLOCK_OVERFLOW_DROP_OLDEST the consumer then holds the discard lock
+// until it calls circ_buffer_release. Must be called by the consumer.
+static bool circ_buffer_read_begin(struct circ_buffer *cb, size_t len) {
+	if(!cb->discard_oldest) {
+		return circ_buffer_size(cb) >= len;
+	}
+	circ_buffer_discard_lock(cb, false);
+	if(circ_buffer_size(cb) >= len) {
+		return true;
+	}
+	circ_buffer_discard_unlock(cb, false);
+	return false;
+}
+
+// Discards the oldest unread samples, so that len samples can be written
+// (BLOCK_OVERFLOW_DROP_OLDEST). The consumer learns about it from gap_discarded.
+// Returns the number of discarded samples. Must be called by the producer.
+static uint64_t circ_buffer_discard_oldest(struct circ_buffer *cb, size_t len) {
+	uint64_t discarded = 0;
+	circ_buffer_discard_lock(cb, true);
+	// The consumer might have released some samples in the meantime
+	uint64_t const read_cnt = atomic_load(&cb->read_cnt);
+	uint64_t const discard_cnt = atomic_load_explicit(&cb->write_cnt, memory_order_relaxed) + len - cb->size;
+	if(discard_cnt > read_cnt) {
+		discarded = discard_cnt - read_cnt;
+		atomic_store(&cb->read_cnt, discard_cnt);
+		cb->gap_discarded.pos = discard_cnt;
+		cb->gap_discarded.len += discarded;
+	}
+	circ_buffer_discard_unlock(cb, true);
+	return discarded;
+}
+
+// Publishes the pending gap marker, if there is room for it in the ring
+static void circ_buffer_gap_flush(struct circ_buffer *cb) {
+	if(cb->gap_pending.len == 0) {
+		return;
+	}
+	uint64_t const write_cnt = atomic_load_explicit(&cb->gap_write_cnt, memory_order_relaxed);
+	if(write_cnt - atomic_load(&cb->gap_read_cnt) == CIRC_BUFFER_GAP_CNT) {
+		return;
+	}
+	cb->gaps[write_cnt % CIRC_BUFFER_GAP_CNT] = cb->gap_pending;
+	atomic_store(&cb->gap_write_cnt, write_cnt + 1);
+	cb->gap_pending.len = 0;
+}
+
+// Marks the loss of len samples before the sample located at the given
+// offset from the current write position. Must be called by the producer
+// before that sample is committed, with non-decreasing positions.
+void block_connection_one2one_gap_add(struct block_connection *connection, size_t offset, uint64_t len) {
+	ASSERT(connection);
+	struct circ_buffer *cb = &connection->circ_buffer;
+	if(len == 0) {
+		return;
+	}
+	circ_buffer_gap_flush(cb);
+	if(cb->gap_pending.len > 0) {
+		// The ring is still full - merge with the marker waiting for publication.
+		// The position of the merged gap is exact only if no samples have been
+		// committed in between.
+		cb->gap_pending.len += len;
+	} else {
+		cb->gap_pending.pos = atomic_load_explicit(&cb->write_cnt, memory_order_relaxed) + offset;
+		cb->gap_pending.len = len;
+	}
+	circ_buffer_gap_flush(cb);
+}
+
+// Takes the next gap marker located within len samples from the read
+// position and returns its offset from the read position. Markers of samples
+// which have already been read or discarded are returned with the offset of 0.
+// Must be called by the consumer.
+bool block_connection_one2one_gap_get(struct block_connection *connection, size_t len,
+		size_t *offset, uint64_t *gap_len) {
+	ASSERT(connection);
+	ASSERT(offset);
+	ASSERT(gap_len);
+	struct circ_buffer *cb = &connection->circ_buffer;
+	uint64_t const read_cnt = atomic_load_explicit(&cb->read_cnt, memory_order_relaxed);
+	struct sample_gap gap;
+	if(cb->gap_discarded.len > 0) {
+		gap = cb->gap_discarded;
+		cb->gap_discarded.len = 0;
+	} else {
+		uint64_t const gap_read_cnt = atomic_load_explicit(&cb->gap_read_cnt, memory_order_relaxed);
+		if(atomic_load(&cb->gap_write_cnt) == gap_read_cnt) {
+			return false;
+		}
+		gap = cb->gaps[gap_read_cnt % CIRC_BUFFER_GAP_CNT];
+		if(gap.pos >= read_cnt + len) {
+			return false;
+		}
+		atomic_store(&cb->gap_read_cnt, gap_read_cnt + 1);
+	}
+	*offset = gap.pos > read_cnt ? gap.pos - read_cnt : 0;
+	*gap_len = gap.len;
+	return true;
+}
+
+// Makes room for len samples according to the overflow policy of the
+// connection. Returns the number of samples which may be written, which is
+// less than len only with BLOCK_OVERFLOW_DROP_NEWEST. Must be called by the producer.
+size_t block_connection_one2one_make_space(struct block_connection *connection, size_t len) {
+	ASSERT(connection);
+	struct circ_buffer *cb = &connection->circ_buffer;
+	circ_buffer_gap_flush(cb);
+	size_t const available = circ_buffer_space_available(cb);
+	size_t dropped = 0;
+	if(available < len) {
+		switch(connection->overflow_policy) {
+			case BLOCK_OVERFLOW_DROP_NEWEST:
+				dropped = len - available;
+				block_connection_count_drop(connection, dropped);
+				len = available;
+				break;
+			case BLOCK_OVERFLOW_DROP_OLDEST: {
+				// Waits at most until the consumer copies out the chunk
+				// it is reading right now, not until it catches up
+				uint64_t const discarded = circ_buffer_discard_oldest(cb, len);
+				if(discarded > 0) {
+					block_connection_count_drop(connection, discarded);
+				}
+				break;
+			}
+			case BLOCK_OVERFLOW_BLOCK:
+			default:
+				block_connection_one2one_wait_space(connection, len);
+				break;
+		}
+	}
+	// Samples dropped by previous calls precede the ones which are about to be
+	// written. The marker is placed only then, so that consecutive overruns
+	// with nothing written in between form a single gap.
+	if(cb->drop_pending > 0 && len > 0) {
+		block_connection_one2one_gap_add(connection, 0, cb->drop_pending);
+		cb->drop_pending = 0;
+	}
+	cb->drop_pending += dropped;
+	return len;
+}
+
+// Non-blocking variant of block_connection_one2one_wait_data for fused
+// consumers. Returns true if at least len samples are available for reading.
+bool block_connection_one2one_data_available(struct block_connection *connection, size_t len) {
+	ASSERT(connection);
+	return circ_buffer_read_begin(&connection->circ_buffer, len);
+}
+
+// Waits until at least len samples are available for reading.
+// Returns false if the producer has shut down and there is not enough data
+// left in the buffer. Must be called by the consumer.
+bool block_connection_one2one_wait_data(struct block_connection *connection, size_t len) {
+	ASSERT(connection);
+	struct circ_buffer *cb = &connection->circ_buffer;
+	if(circ_buffer_read_begin(cb, len)) {
+		return true;
+	}
+	bool ret = true;
+	uint64_t const wait_start = block_clock_ns();
+	// The producer may discard some of the data before it is read
+	// (BLOCK_OVERFLOW_DROP_OLDEST), hence the loop
+	do {
+		pthread_mutex_lock(cb->mutex);
+		// Announce the wait before checking the buffer once again. The producer
+		// stores write_cnt before loading write_cnt_wanted, so either it sees
+		// the announcement or we see its data (both are sequentially consistent).
+		atomic_store(&cb->write_cnt_wanted, atomic_load(&cb->read_cnt) + len);
+		// Check for shutdown signal only when there is not enough data in the buffer,
+		// so that all the data gets processed before shutdown.
+		while(circ_buffer_size(cb) < len) {
+			if(block_connection_is_shutdown_signaled(connection)) {
+				ret = false;
+				break;
+			}
+			pthread_cond_wait(cb->cond, cb->mutex);
+		}
+		atomic_store(&cb->write_cnt_wanted, 0);
+		pthread_mutex_unlock(cb->mutex);
+	} while(ret && !circ_buffer_read_begin(cb, len));
+	atomic_fetch_add_explicit(&cb->data_wait_ns, block_clock_ns() - wait_start, memory_order_relaxed);
+	return ret;
+}
+
+// Waits until there is space for at least len samples in the buffer.
+// Must be called by the producer.
+void block_connection_one2one_wait_space(struct block_connection *connection, size_t len) {
+	ASSERT(connection);
+	struct circ_buffer *cb = &connection->circ_buffer;
+	ASSERT(len <= cb->size);
+	if(circ_buffer_space_available(cb) >= len) {
+		return;
+	}
+	uint64_t const wait_start = block_clock_ns();
+	pthread_mutex_lock(cb->mutex);
+	atomic_store(&cb->read_cnt_wanted, atomic_load(&cb->write_cnt) + len - cb->size);
+	while(circ_buffer_space_available(cb) < len) {
+		pthread_cond_wait(cb->space_cond, cb->mutex);
+	}
+	atomic_store(&cb->read_cnt_wanted, 0);
+	pthread_mutex_unlock(cb->mutex);
+	atomic_fetch_add_explicit(&cb->space_wait_ns, block_clock_ns() - wait_start, memory_order_relaxed);
 }
 
 void block_connection_one2many_shutdown(struct block_connection *connection) {
 	ASSERT(connection);
-	connection->flags |= BLOCK_CONNECTION_SHUTDOWN;
-	pthread_barrier_wait(connection->shared_buffer.data_ready);
+	struct shared_buffer *sb = &connection->shared_buffer;
+	atomic_fetch_or(&connection->flags, BLOCK_CONNECTION_SHUTDOWN);
+	pthread_mutex_lock(sb->mutex);
+	pthread_mutex_unlock(sb->mutex);
+	pthread_cond_broadcast(sb->cond);
+	for(size_t i = 0; i < sb->consumer_cnt; i++) {
+		block_schedule(sb->consumers[i]);
+	}
+}
+
+// Returns true if the slot for the next frame is not in use by any consumer
+static bool shared_buffer_slot_free(struct shared_buffer *sb) {
+	uint64_t const write_cnt = atomic_load_explicit(&sb->write_cnt, memory_order_relaxed);
+	for(size_t i = 0; i < sb->consumer_cnt; i++) {
+		if(write_cnt - atomic_load(&sb->cursors[i].read_cnt) >= SHARED_BUFFER_SLOT_CNT) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Returns the slot where the producer shall write the next frame.
+// Waits until the slowest consumer releases it.
+float complex *block_connection_one2many_slot_get(struct block_connection *connection) {
+	ASSERT(connection);
+	struct shared_buffer *sb = &connection->shared_buffer;
+	if(!shared_buffer_slot_free(sb)) {
+		sb->producer_waits++;
+		uint64_t const wait_start = block_clock_ns();
+		pthread_mutex_lock(sb->mutex);
+		atomic_store(&sb->producer_waiting, 1);
+		while(!shared_buffer_slot_free(sb)) {
+			pthread_cond_wait(sb->space_cond, sb->mutex);
+		}
+		atomic_store(&sb->producer_waiting, 0);
+		pthread_mutex_unlock(sb->mutex);
+		atomic_fetch_add_explicit(&sb->producer_wait_ns, block_clock_ns() - wait_start, memory_order_relaxed);
+	}
+	uint64_t const write_cnt = atomic_load_explicit(&sb->write_cnt, memory_order_relaxed);
+	sb->slot_gaps[write_cnt % SHARED_BUFFER_SLOT_CNT] = 0;
+	return sb->buf + (write_cnt % SHARED_BUFFER_SLOT_CNT) * sb->slot_stride;
+}
+
+// Marks the loss of len input samples just before the frame
+// which is about to be published
+void block_connection_one2many_slot_set_gap(struct block_connection *connection, uint64_t len) {
+	ASSERT(connection);
+	struct shared_buffer *sb = &connection->shared_buffer;
+	uint64_t const write_cnt = atomic_load_explicit(&sb->write_cnt, memory_order_relaxed);
+	sb->slot_gaps[write_cnt % SHARED_BUFFER_SLOT_CNT] = len;
+}
+
+// Makes the frame written into the slot returned by
+// block_connection_one2many_slot_get() available to consumers
+void block_connection_one2many_slot_publish(struct block_connection *connection) {
+	ASSERT(connection);
+	struct shared_buffer *sb = &connection->shared_buffer;
+	atomic_store(&sb->write_cnt, atomic_load_explicit(&sb->write_cnt, memory_order_relaxed) + 1);
+	if(atomic_load(&sb->consumers_waiting) > 0) {
+		pthread_mutex_lock(sb->mutex);
+		pthread_mutex_unlock(sb->mutex);
+		pthread_cond_broadcast(sb->cond);
+	}
+	for(size_t i = 0; i < sb->consumer_cnt; i++) {
+		block_schedule(sb->consumers[i]);
+	}
+}
+
+// Returns the next frame for the given consumer without waiting.
+// Returns NULL if the producer has not published it yet.
+float complex *block_connection_one2many_frame_try_get(struct block_connection *connection, size_t consumer_id) {
+	ASSERT(connection);
+	struct shared_buffer *sb = &connection->shared_buffer;
+	ASSERT(consumer_id < sb->consumer_cnt);
+	struct shared_buffer_cursor *cursor = &sb->cursors[consumer_id];
+	uint64_t const read_cnt = atomic_load_explicit(&cursor->read_cnt, memory_order_relaxed);
+	if(atomic_load(&sb->write_cnt) == read_cnt) {
+		return NULL;
+	}
+	return sb->buf + (read_cnt % SHARED_BUFFER_SLOT_CNT) * sb->slot_stride;
+}
+
+// Returns the next frame for the given consumer, waiting for the producer
+// if necessary. Returns NULL if the producer has shut down and all frames
+// have been consumed.
+float complex *block_connection_one2many_frame_get(struct block_connection *connection, size_t consumer_id) {
+	ASSERT(connection);
+	struct shared_buffer *sb = &connection->shared_buffer;
+	ASSERT(consumer_id < sb->consumer_cnt);
+	struct shared_buffer_cursor *cursor = &sb->cursors[consumer_id];
+	uint64_t const read_cnt = atomic_load_explicit(&cursor->read_cnt, memory_order_relaxed);
+	if(atomic_load(&sb->write_cnt) == read_cnt) {
+		cursor->waits++;
+		uint64_t const wait_start = block_clock_ns();
+		pthread_mutex_lock(sb->mutex);
+		atomic_fetch_add(&sb->consumers_waiting, 1);
+		while(atomic_load(&sb->write_cnt) == read_cnt) {
+			if(block_connection_is_shutdown_signaled(connection)) {
+				break;
+			}
+			pthread_cond_wait(sb->cond, sb->mutex);
+		}
+		atomic_fetch_sub(&sb->consumers_waiting, 1);
+		pthread_mutex_unlock(sb->mutex);
+		atomic_fetch_add_explicit(&cursor->wait_ns, block_clock_ns() - wait_start, memory_order_relaxed);
+		if(atomic_load(&sb->write_cnt) == read_cnt) {
+			return NULL;
+		}
+	}
+	return sb->buf + (read_cnt % SHARED_BUFFER_SLOT_CNT) * sb->slot_stride;
+}
+
+// Returns the number of input samples lost just before the current frame
+// of the given consumer (0 = none). Valid until the frame is released.
+uint64_t block_connection_one2many_frame_gap(struct block_connection *connection, size_t consumer_id) {
+	ASSERT(connection);
+	struct shared_buffer *sb = &connection->shared_buffer;
+	ASSERT(consumer_id < sb->consumer_cnt);
+	uint64_t const read_cnt = atomic_load_explicit(&sb->cursors[consumer_id].read_cnt, memory_order_relaxed);
+	return sb->slot_gaps[read_cnt % SHARED_BUFFER_SLOT_CNT];
+}
+
+void block_connection_one2many_frame_release(struct block_connection *connection, size_t consumer_id) {
+	ASSERT(connection);
+	struct shared_buffer *sb = &connection->shared_buffer;
+	ASSERT(consumer_id < sb->consumer_cnt);
+	struct shared_buffer_cursor *cursor = &sb->cursors[consumer_id];
+	atomic_store(&cursor->read_cnt, atomic_load_explicit(&cursor->read_cnt, memory_order_relaxed) + 1);
+	if(atomic_load(&sb->producer_waiting) != 0) {
+		pthread_mutex_lock(sb->mutex);
+		pthread_mutex_unlock(sb->mutex);
+		pthread_cond_signal(sb->space_cond);
+	}
 }
 
 bool block_connection_is_shutdown_signaled(struct block_connection *connection) {
@@ -153,11 +625,91 @@ bool block_connection_is_shutdown_signaled(struct block_connection *connection)
 	return connection->flags & BLOCK_CONNECTION_SHUTDOWN;
 }
 
+// Returns true if the consumer of a one-to-many connection has any work to do
+static bool block_input_pending(struct block *block) {
+	struct block_connection *connection = block->consumer.in;
+	struct shared_buffer *sb = &connection->shared_buffer;
+	return atomic_load(&sb->write_cnt) != atomic_load(&sb->cursors[block->consumer.id].read_cnt) ||
+		block_connection_is_shutdown_signaled(connection);
+}
+
+static void block_task_run(struct worker_task *task) {
+	struct block *block = container_of(task, struct block, task);
+	struct timespec start, end;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	bool more = block->task_routine(block);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	block->stats.cpu_time += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	if(!more) {
+		// Leave the scheduled flag set, so that the task never runs again
+		block->running = false;
+		return;
+	}
+	// The producer publishes a frame before trying to schedule us, so either
+	// it sees the flag cleared or we see the new frame.
+	atomic_store(&block->scheduled, false);
+	if(block_input_pending(block)) {
+		block_schedule(block);
+	}
+}
+
+// Queues the task of a pool-driven block, unless it's already queued or running
+static void block_schedule(struct block *block) {
+	if(block->pool == NULL) {
+		return;
+	}
+	if(!atomic_exchange(&block->scheduled, true)) {
+		worker_pool_submit(block->pool, &block->task, block->task_queue);
+	}
+}
+
+// Makes the block run as a task on the given worker pool instead of
+// a dedicated thread. Must be called before block_start().
+void block_set_worker_pool(struct block *block, struct worker_pool *pool) {
+	static size_t next_queue = 0;
+	ASSERT(block);
+	ASSERT(block->task_routine);
+	ASSERT(block->consumer.type == CONSUMER_MULTI);
+	ASSERT(!block->running);
+	block->pool = pool;
+	block->task.run = block_task_run;
+	// Spread blocks evenly across worker queues
+	block->task_queue = next_queue++;
+	// Keep the task off the pool until the block is started
+	atomic_init(&block->scheduled, true);
+}
+
+// Makes the block run on the thread of its producer instead of a dedicated
+// one. This saves the cost of handing samples over to another thread (and
+// another CPU core) when there is little work to do. Must be called after
+// the blocks are connected and before they are started.
+void block_fuse_with_producer(struct block *block) {
+	ASSERT(block);
+	ASSERT(block->fused_routine);
+	ASSERT(block->consumer.type == CONSUMER_SINGLE);
+	ASSERT(block->consumer.in);
+	ASSERT(!block->running);
+	block->fused = true;
+	block->consumer.in->fused_consumer = block;
+}
+
 // Returns number of blocks successfully started
 int32_t block_start(struct block *block) {
 	ASSERT(block);
+	if(block->fused) {
+		// Runs whenever the producer writes something
+		block->running = true;
+		return 1;
+	}
+	if(block->pool != NULL) {
+		block->running = true;
+		// Pick up any frames published before the start
+		atomic_store(&block->scheduled, false);
+		block_schedule(block);
+		return 1;
+	}
 	ASSERT(block->thread_routine);
-	int32_t ret = start_thread(&block->thread, block->thread_routine, block);
+	int32_t ret = start_thread(&block->thread, block->thread_class, block->thread_routine, block);
 	if(ret == 0) {
 		block->running = true;
 		return 1;
@@ -170,7 +722,6 @@ int32_t block_set_start(size_t block_cnt, struct block *block[block_cnt]) {
 	ASSERT(block);
 	int32_t ret = 0;
 	for(size_t i = 0; i < block_cnt; i++) {
-		ASSERT(block[i]->thread_routine);
 		ret += block_start(block[i]);
 	}
 	return ret;
@@ -191,3 +742,164 @@ bool block_set_is_any_running(size_t block_cnt, struct block *blocks[block_cnt])
 	return false;
 }
 
+// Stores CPU time consumed by the calling thread in block stats.
+// Must be called from the block's thread.
+void block_stats_update_cpu_time(struct block *block) {
+	ASSERT(block);
+	if(block->fused) {
+		// Measured by the producer on every call
+		return;
+	}
+	struct timespec ts;
+	if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+		block->stats.cpu_time = ts.tv_sec + ts.tv_nsec / 1e9 - block_fused_consumer_cpu_time(block);
+	}
+}
+
+// Returns the number of frames the consumer lags behind the producer.
+// May be called by any thread.
+static uint64_t shared_buffer_lag(struct shared_buffer *sb, size_t consumer_id) {
+	// Load read_cnt first, so that it's never ahead of write_cnt
+	uint64_t const read_cnt = atomic_load(&sb->cursors[consumer_id].read_cnt);
+	return atomic_load(&sb->write_cnt) - read_cnt;
+}
+
+static float circ_buffer_fill(struct circ_buffer *cb) {
+	uint64_t const read_cnt = atomic_load(&cb->read_cnt);
+	return (float)(atomic_load(&cb->write_cnt) - read_cnt) / (float)cb->size;
+}
+
+// Takes a snapshot of block performance counters.
+// May be called by any thread.
+void block_get_metrics(struct block *block, struct block_metrics *m) {
+	ASSERT(block);
+	ASSERT(m);
+	memset(m, 0, sizeof(*m));
+	m->samples_in = atomic_load_explicit(&block->stats.samples_processed, memory_order_relaxed);
+	m->samples_skipped = atomic_load_explicit(&block->stats.samples_skipped, memory_order_relaxed);
+	m->input_fill = m->output_fill = -1.0f;
+	struct block_connection *in = block->consumer.in;
+	if(in != NULL && block->consumer.type == CONSUMER_SINGLE) {
+		struct circ_buffer *cb = &in->circ_buffer;
+		m->input_wait_ns = atomic_load_explicit(&cb->data_wait_ns, memory_order_relaxed);
+		m->input_fill = circ_buffer_fill(cb);
+	} else if(in != NULL && block->consumer.type == CONSUMER_MULTI) {
+		struct shared_buffer *sb = &in->shared_buffer;
+		m->input_wait_ns = atomic_load_explicit(&sb->cursors[block->consumer.id].wait_ns, memory_order_relaxed);
+		m->input_fill = (float)shared_buffer_lag(sb, block->consumer.id) / SHARED_BUFFER_SLOT_CNT;
+	}
+	struct block_connection *out = block->producer.out;
+	if(out != NULL && block->producer.type == PRODUCER_SINGLE) {
+		struct circ_buffer *cb = &out->circ_buffer;
+		m->samples_out = atomic_load_explicit(&cb->write_cnt, memory_order_relaxed);
+		m->output_wait_ns = atomic_load_explicit(&cb->space_wait_ns, memory_order_relaxed);
+		m->output_fill = circ_buffer_fill(cb);
+		m->output_drops = atomic_load_explicit(&out->drop_cnt, memory_order_relaxed);
+		m->output_samples_dropped = atomic_load_explicit(&out->samples_dropped, memory_order_relaxed);
+	} else if(out != NULL && block->producer.type == PRODUCER_MULTI) {
+		struct shared_buffer *sb = &out->shared_buffer;
+		m->samples_out = atomic_load_explicit(&sb->write_cnt, memory_order_relaxed) * sb->slot_size;
+		m->output_wait_ns = atomic_load_explicit(&sb->producer_wait_ns, memory_order_relaxed);
+		// The slowest consumer determines how full the buffer is
+		uint64_t max_lag = 0;
+		for(size_t i = 0; i < sb->consumer_cnt; i++) {
+			max_lag = max(max_lag, shared_buffer_lag(sb, i));
+		}
+		m->output_fill = (float)max_lag / SHARED_BUFFER_SLOT_CNT;
+	}
+}
+
+// Computes the timestamp of the sample which the block is about to process,
+// ie. how far it has got in the input stream. Samples lost upstream are
+// counted as processed, since the block will never see them.
+// If the time base of the input is not valid, the result is relative
+// to the start of the stream. Returns false if the sample rate of the
+// block is unknown.
+bool block_get_stream_time(struct block *block, struct timeval *result) {
+	ASSERT(block);
+	ASSERT(result);
+	if(block->sample_rate <= 0.0) {
+		return false;
+	}
+	uint64_t const pos = atomic_load_explicit(&block->stats.samples_processed, memory_order_relaxed) +
+		atomic_load_explicit(&block->stats.samples_skipped, memory_order_relaxed);
+	if(sample_clock_is_valid(&block->clock)) {
+		sample_clock_get_time(&block->clock, pos, block->sample_rate, result);
+	} else {
+		double const t = (double)pos / block->sample_rate;
+		result->tv_sec = (time_t)t;
+		result->tv_usec = (suseconds_t)((t - (double)result->tv_sec) * 1e6);
+	}
+	return true;
+}
+
+// Circular buffer operations.
+// None of them require locking. Reads and releases must be done by the
+// consumer thread only, reserves and commits - by the producer thread only.
+// circ_buffer_size and circ_buffer_space_available return a lower bound,
+// as the other side may be making progress at the same time.
+
+size_t circ_buffer_size(struct circ_buffer *cb) {
+	return atomic_load(&cb->write_cnt) - atomic_load(&cb->read_cnt);
+}
+
+size_t circ_buffer_space_available(struct circ_buffer *cb) {
+	return cb->size - (atomic_load(&cb->write_cnt) - atomic_load(&cb->read_cnt));
+}
+
+// Returns a pointer to len contiguous samples at the read position.
+// The data remains valid until circ_buffer_release is called.
+float complex *circ_buffer_read(struct circ_buffer *cb, size_t len) {
+	ASSERT(len <= circ_buffer_size(cb));
+	ASSERT(len <= cb->max_len);
+	size_t const read_pos = atomic_load_explicit(&cb->read_cnt, memory_order_relaxed) % cb->size;
+	size_t const end = read_pos + len;
+	if(end > cb->size) {
+		// Region wraps around - append its head to the tail in the overflow area
+		memcpy(cb->buf + cb->size, cb->buf, (end - cb->size) * sizeof(float complex));
+	}
+	return cb->buf + read_pos;
+}
+
+void circ_buffer_release(struct circ_buffer *cb, size_t len) {
+	ASSERT(len <= circ_buffer_size(cb));
+	uint64_t const read_cnt = atomic_load_explicit(&cb->read_cnt, memory_order_relaxed) + len;
+	atomic_store(&cb->read_cnt, read_cnt);
+	if(cb->discard_oldest) {
+		circ_buffer_discard_unlock(cb, false);
+	}
+	uint64_t const wanted = atomic_load(&cb->read_cnt_wanted);
+	if(wanted != 0 && read_cnt >= wanted) {
+		// Producer is waiting for space - wake it up
+		pthread_mutex_lock(cb->mutex);
+		pthread_mutex_unlock(cb->mutex);
+		pthread_cond_signal(cb->space_cond);
+	}
+}
+
+// Returns a pointer to a contiguous region where up to len samples may be
+// written by the producer. The samples become visible to the consumer after
+// circ_buffer_commit is called. The caller must make sure there is enough
+// space available in the buffer.
+float complex *circ_buffer_reserve(struct circ_buffer *cb, size_t len) {
+	ASSERT(len <= cb->max_len);
+	return cb->buf + atomic_load_explicit(&cb->write_cnt, memory_order_relaxed) % cb->size;
+}
+
+void circ_buffer_commit(struct circ_buffer *cb, size_t len) {
+	ASSERT(len <= circ_buffer_space_available(cb));
+	uint64_t const write_cnt = atomic_load_explicit(&cb->write_cnt, memory_order_relaxed);
+	size_t const end = write_cnt % cb->size + len;
+	if(end > cb->size) {
+		// Samples written to the overflow area belong at the start of the ring
+		memcpy(cb->buf, cb->buf + cb->size, (end - cb->size) * sizeof(float complex));
+	}
+	atomic_store(&cb->write_cnt, write_cnt + len);
+	uint64_t const wanted = atomic_load(&cb->write_cnt_wanted);
+	if(wanted != 0 && write_cnt + len >= wanted) {
+		// Consumer is waiting for data - wake it up
+		pthread_mutex_lock(cb->mutex);
+		pthread_mutex_unlock(cb->mutex);
+		pthread_cond_signal(cb->cond);
+	}
+}
@@ -4,11 +4,11 @@
 #include <stdbool.h>
 #include <complex.h>
 #include <pthread.h>
-#include <liquid/liquid.h>
-#include "config.h"
-#ifndef HAVE_PTHREAD_BARRIERS
-#include "pthread_barrier.h"
-#endif
+#include <stdalign.h>           // alignas
+#include <stdatomic.h>          // _Atomic
+#include "sample-clock.h"       // struct sample_clock
+#include "worker-pool.h"        // struct worker_task, struct worker_pool
+#include "thread-sched.h"       // enum thread_class
 
 enum producer_type {
 	PRODUCER_NONE = 0,
@@ -24,16 +24,105 @@ enum consumer_type {
 	CONSUMER_MAX
 };
 
+#define CACHE_LINE_SIZE 64
+
+// What the producer of a one-to-one connection does when the buffer is full
+enum block_overflow_policy {
+	BLOCK_OVERFLOW_BLOCK = 0,           // wait until the consumer makes room (no loss)
+	BLOCK_OVERFLOW_DROP_NEWEST,         // drop the samples which do not fit
+	BLOCK_OVERFLOW_DROP_OLDEST,         // discard the oldest unread samples to make room
+	BLOCK_OVERFLOW_POLICY_CNT
+};
+
+// Discontinuity in a sample stream: len samples have been lost
+// before the sample at position pos
+struct sample_gap {
+	uint64_t pos;
+	uint64_t len;
+};
+
+// Number of gap markers which may be pending in a single circ_buffer.
+// Every overrun which happens while the previous ones are still in the
+// buffer needs a marker. When they don't fit, subsequent gaps are merged
+// and their positions are no longer exact.
+#define CIRC_BUFFER_GAP_CNT 64
+
+// Lock-free single producer, single consumer sample buffer.
+// Both reads and writes are done in place on contiguous regions of up to
+// max_len samples, which may cross the end of the ring. Such regions are
+// stored in the overflow area past the end and moved to their proper place
+// when necessary.
+// The producer and the consumer exchange data through two monotonic sample
+// counters, each one kept in its own cache line. The mutex and condition
+// variables are only used to put a thread to sleep when the buffer is
+// empty (or full) and to wake it up when the other side has made enough
+// progress. The other side knows it has to do so from the *_wanted
+// counters, which are nonzero only when someone is waiting.
+// Sample loss is signaled to the consumer with gap markers, which are passed
+// through a small ring of their own, synchronized in the same way.
+// With BLOCK_OVERFLOW_DROP_OLDEST the producer may also advance read_cnt
+// itself. This must not happen while the consumer is reading the oldest
+// samples, so the two are mutually excluded with Peterson's algorithm
+// (the discard lock). The consumer holds it from a successful data check
+// until circ_buffer_release, which is only long enough to copy the data out.
 struct circ_buffer {
-	cbuffercf buf;
-	pthread_cond_t *cond;
+	float complex *buf;                 // size + max_len samples
+	size_t size;                        // ring capacity (samples)
+	size_t max_len;                     // maximum length of a single read or write
+	pthread_cond_t *cond;               // signaled by the producer when data is written
+	pthread_cond_t *space_cond;         // signaled by the consumer when data is released
 	pthread_mutex_t *mutex;
+	// Producer side
+	alignas(CACHE_LINE_SIZE) _Atomic uint64_t write_cnt;    // total samples committed
+	_Atomic uint64_t read_cnt_wanted;   // producer sleeps until read_cnt reaches this value
+	_Atomic uint64_t space_wait_ns;     // time the producer spent waiting for space
+	_Atomic uint64_t gap_write_cnt;     // total gap markers published
+	_Atomic bool producer_discarding;   // discard lock flag of the producer
+	struct sample_gap gap_pending;      // gap not published yet because the ring was full
+	uint64_t drop_pending;              // samples dropped after the last commit
+	// Consumer side
+	alignas(CACHE_LINE_SIZE) _Atomic uint64_t read_cnt;     // total samples released
+	_Atomic uint64_t write_cnt_wanted;  // consumer sleeps until write_cnt reaches this value
+	_Atomic uint64_t data_wait_ns;      // time the consumer spent waiting for data
+	_Atomic uint64_t gap_read_cnt;      // total gap markers taken
+	_Atomic bool consumer_reading;      // discard lock flag of the consumer
+	_Atomic uint32_t discard_turn;      // side which waits on discard lock contention
+	struct sample_gap gap_discarded;    // samples discarded by the producer (under the discard lock)
+	bool discard_oldest;                // BLOCK_OVERFLOW_DROP_OLDEST is in effect
+	// Gap marker ring
+	alignas(CACHE_LINE_SIZE) struct sample_gap gaps[CIRC_BUFFER_GAP_CNT];
+};
+
+// Number of frames the slowest consumer of a shared buffer may lag behind the producer
+#define SHARED_BUFFER_SLOT_CNT 16
+
+struct shared_buffer_cursor {
+	alignas(CACHE_LINE_SIZE) _Atomic uint64_t read_cnt;     // frames released by the consumer
+	uint64_t waits;                     // frames the consumer had to wait for
+	_Atomic uint64_t wait_ns;           // time the consumer spent waiting for frames
 };
 
+// Single producer, multiple consumer frame buffer.
+// The producer writes frames into a ring of slots. Every consumer reads
+// all frames at its own pace, so that a temporarily slow consumer does not
+// stall the others until it lags SHARED_BUFFER_SLOT_CNT frames behind.
+// Synchronization is done in the same way as in struct circ_buffer.
 struct shared_buffer {
-	float complex *buf;
-	pthread_barrier_t *data_ready;
-	pthread_barrier_t *consumers_ready;
+	float complex *buf;                 // SHARED_BUFFER_SLOT_CNT slots
+	uint64_t slot_gaps[SHARED_BUFFER_SLOT_CNT];     // input samples lost before each frame
+	size_t slot_size;                   // frame length (samples)
+	size_t slot_stride;                 // distance between slots (samples)
+	struct shared_buffer_cursor *cursors;
+	struct block **consumers;
+	size_t consumer_cnt;
+	pthread_cond_t *cond;               // signaled by the producer when a frame is written
+	pthread_cond_t *space_cond;         // signaled by consumers when a frame is released
+	pthread_mutex_t *mutex;
+	uint64_t producer_waits;            // frames the producer had to wait for a free slot
+	_Atomic uint64_t producer_wait_ns;  // time the producer spent waiting for a free slot
+	alignas(CACHE_LINE_SIZE) _Atomic uint64_t write_cnt;    // frames published
+	_Atomic uint32_t producer_waiting;
+	_Atomic uint32_t consumers_waiting;
 };
 
 struct block_connection {
@@ -41,7 +130,12 @@ struct block_connection {
 		struct circ_buffer circ_buffer;
 		struct shared_buffer shared_buffer;
 	};
-	uint32_t flags;
+	_Atomic uint32_t flags;
+	enum block_overflow_policy overflow_policy; // one-to-one connections only
+	struct block *fused_consumer;       // consumer running on the producer's thread (one-to-one only)
+	double fused_cpu_time;              // CPU time spent in the fused consumer (inclusive)
+	_Atomic uint64_t drop_cnt;          // number of overflows which caused sample loss
+	_Atomic uint64_t samples_dropped;   // number of samples lost due to overflows
 };
 
 // Block connection flags
@@ -56,15 +150,59 @@ struct producer {
 struct consumer {
 	struct block_connection *in;
 	size_t min_ru;                      // minimum receive unit (samples)
+	size_t id;                          // index of the consumer of a one-to-many connection
 	enum consumer_type type;
 };
 
+struct block_stats {
+	_Atomic uint64_t samples_processed; // input samples processed by the block
+	_Atomic uint64_t samples_skipped;   // input samples lost upstream (gaps in the input stream)
+	double cpu_time;                    // thread CPU time in seconds (set on thread exit)
+};
+
+// Snapshot of block performance counters, which may be taken
+// by any thread while the block is running
+struct block_metrics {
+	uint64_t samples_in;                // input samples processed
+	uint64_t samples_skipped;           // input samples lost upstream
+	uint64_t samples_out;               // samples written to the output connection
+	uint64_t input_wait_ns;             // time spent waiting for input data
+	uint64_t output_wait_ns;            // time spent waiting for space in the output buffer
+	uint64_t output_drops;              // output buffer overflows which caused sample loss
+	uint64_t output_samples_dropped;    // samples lost due to output buffer overflows
+	float input_fill;                   // input buffer fill level (0..1, -1 = no input)
+	float output_fill;                  // output buffer fill level (0..1, -1 = no output)
+};
+
 struct block {
 	struct consumer consumer;
 	struct producer producer;
+	struct block_stats stats;
+	struct block_metrics metrics_reported;  // last values sent to StatsD
+	struct sample_clock clock;          // time base of the input sample stream
+	double sample_rate;                 // rate of the input stream of the block (0 = unknown)
+	double lag_max;                     // highest lag seen by the lag monitor (seconds)
+	bool lag_warned;                    // lag is above the warning threshold
 	pthread_t thread;
+	enum thread_class thread_class;     // CPU affinity and scheduling policy
 	void *(*thread_routine)(void *);
-	bool running;
+	// Blocks which consume one-to-many connections may run on a worker pool
+	// instead of a dedicated thread. task_routine is then called whenever
+	// new input is available. It shall process all of it and return false
+	// once the input connection has been shut down and drained.
+	bool (*task_routine)(struct block *);
+	struct worker_pool *pool;           // NULL = run on a dedicated thread
+	struct worker_task task;
+	size_t task_queue;                  // preferred worker pool queue
+	atomic_bool scheduled;              // task is queued or running
+	// Blocks which consume one-to-one connections may instead be fused with
+	// their producer, ie. run on its thread. fused_routine is then called
+	// by the producer after every write. It shall process all complete input
+	// units available without waiting for more. When called with shutdown set,
+	// it shall also process the remaining input and shut down its output.
+	void (*fused_routine)(struct block *, bool shutdown);
+	bool fused;
+	atomic_bool running;                // read by other threads while the block is working
 };
 
 // block.c
@@ -72,10 +210,37 @@ int32_t block_connect_one2one(struct block *source, struct block *sink);
 int32_t block_connect_one2many(struct block *source, size_t sink_count, struct block *sinks[sink_count]);
 void block_disconnect_one2one(struct block *source, struct block *sink);
 void block_disconnect_one2many(struct block *source, size_t sink_count, struct block *sinks[sink_count]);
+void block_set_worker_pool(struct block *block, struct worker_pool *pool);
+void block_fuse_with_producer(struct block *block);
 int32_t block_start(struct block *block);
 int32_t block_set_start(size_t block_cnt, struct block *block[block_cnt]);
 void block_connection_one2one_shutdown(struct block_connection *connection);
+bool block_connection_one2one_wait_data(struct block_connection *connection, size_t len);
+bool block_connection_one2one_data_available(struct block_connection *connection, size_t len);
+void block_connection_one2one_commit(struct block_connection *connection, size_t len);
+void block_connection_one2one_wait_space(struct block_connection *connection, size_t len);
+void block_connection_set_overflow_policy(struct block_connection *connection, enum block_overflow_policy policy);
+size_t block_connection_one2one_make_space(struct block_connection *connection, size_t len);
+void block_connection_one2one_gap_add(struct block_connection *connection, size_t offset, uint64_t len);
+bool block_connection_one2one_gap_get(struct block_connection *connection, size_t len,
+		size_t *offset, uint64_t *gap_len);
 void block_connection_one2many_shutdown(struct block_connection *connection);
 bool block_connection_is_shutdown_signaled(struct block_connection *connection);
+float complex *block_connection_one2many_slot_get(struct block_connection *connection);
+void block_connection_one2many_slot_set_gap(struct block_connection *connection, uint64_t len);
+void block_connection_one2many_slot_publish(struct block_connection *connection);
+uint64_t block_connection_one2many_frame_gap(struct block_connection *connection, size_t consumer_id);
+float complex *block_connection_one2many_frame_get(struct block_connection *connection, size_t consumer_id);
+float complex *block_connection_one2many_frame_try_get(struct block_connection *connection, size_t consumer_id);
+void block_connection_one2many_frame_release(struct block_connection *connection, size_t consumer_id);
 bool block_is_running(struct block *block);
 bool block_set_is_any_running(size_t block_cnt, struct block *blocks[block_cnt]);
+void block_stats_update_cpu_time(struct block *block);
+void block_get_metrics(struct block *block, struct block_metrics *m);
+bool block_get_stream_time(struct block *block, struct timeval *result);
+size_t circ_buffer_size(struct circ_buffer *cb);
+size_t circ_buffer_space_available(struct circ_buffer *cb);
+float complex *circ_buffer_read(struct circ_buffer *cb, size_t len);
+void circ_buffer_release(struct circ_buffer *cb, size_t len);
+float complex *circ_buffer_reserve(struct circ_buffer *cb, size_t len);
+void circ_buffer_commit(struct circ_buffer *cb, size_t len);
@@ -0,0 +1,236 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <string.h>             // memcpy, memmove
+#include <math.h>               // M_PI, ceilf, fmod
+#include <complex.h>
+#include <liquid/liquid.h>      // liquid_firdes_kaiser, estimate_req_filter_len
+#include "block.h"              // block_*
+#include "input-helpers.h"      // complex_samples_*
+#include "decimator.h"
+#include "util.h"               // NEW, XCALLOC, XFREE, debug_print
+
+// Pre-decimation stage.
+// Reduces the sample rate by a power of 2 before the signal reaches the FFT
+// channelizer, so that the forward FFT runs on a much smaller bandwidth when
+// channels occupy only a small part of the receiver band. The signal is
+// first shifted in frequency, so that the channel span is centered at 0 Hz,
+// then it passes through a cascade of half-band decimators.
+
+#define DECIMATOR_INPUT_CHUNK_LEN 16384         // must be divisible by 2^DECIMATOR_MAX_STAGES
+#define DECIMATOR_STOPBAND_ATTENUATION 60.0f    // dB
+#define DECIMATOR_TRANSITION_BW_MIN 0.05f       // relative to the input rate of the last stage
+
+// Half-band filter with 4m+3 taps. Every other tap is zero, except the
+// center one, which equals 0.5. The filter is evaluated in polyphase form:
+// input samples are split into even and odd streams, so that each nonzero
+// tap pair results in a multiply-add on contiguous arrays, which the compiler
+// vectorizes easily.
+struct halfband_stage {
+	float *taps;                // nonzero taps from one half of the filter (m+1)
+	float complex *even;        // even-numbered input samples (2m+1 history + len)
+	float complex *odd;         // odd-numbered input samples (2m+1 history + len)
+	int32_t m;
+	int32_t len;                // number of output samples per call
+};
+
+struct decimator {
+	struct block block;
+	struct halfband_stage stages[DECIMATOR_MAX_STAGES];
+	int32_t stage_cnt;
+	float complex *shift_table;     // frequency shift phasors for a single chunk
+	double shift_phase_incr;        // phase increment per chunk (radians)
+	double shift_phase;
+	float complex *buf[2];          // work buffers for the cascade
+};
+
+static void halfband_stage_init(struct halfband_stage *s, int32_t len, float transition_bw) {
+	int32_t taps_cnt = estimate_req_filter_len(transition_bw, DECIMATOR_STOPBAND_ATTENUATION);
+	s->m = max((int32_t)ceilf((taps_cnt - 3) / 4.0f), 1);
+	s->len = len;
+	int32_t const full_len = 4 * s->m + 3;
+	float h[full_len];
+	liquid_firdes_kaiser(full_len, 0.25f, DECIMATOR_STOPBAND_ATTENUATION, 0.0f, h);
+	s->taps = XCALLOC(s->m + 1, sizeof(float));
+	// Normalize for unity gain at DC, keeping the center tap at 0.5
+	float sum = 0.0f;
+	for(int32_t i = 0; i <= s->m; i++) {
+		sum += h[2 * i];
+	}
+	for(int32_t i = 0; i <= s->m; i++) {
+		s->taps[i] = h[2 * i] * 0.25f / sum;
+	}
+	s->even = XCALLOC(2 * s->m + 1 + len, sizeof(float complex));
+	s->odd = XCALLOC(2 * s->m + 1 + len, sizeof(float complex));
+	debug_print(D_DSP, "halfband stage: len=%d transition_bw=%f taps=%d\n", len, transition_bw, full_len);
+}
+
+static void halfband_stage_destroy(struct halfband_stage *s) {
+	XFREE(s->taps);
+	XFREE(s->even);
+	XFREE(s->odd);
+}
+
+// Decimates 2*len input samples into len output samples
+static void halfband_decimate(struct halfband_stage *s, float complex const *restrict in,
+		float complex *restrict out) {
+	int32_t const m = s->m, len = s->len, hist = 2 * m + 1;
+	float complex *restrict even = s->even;
+	float complex *restrict odd = s->odd;
+	for(int32_t i = 0; i < len; i++) {
+		even[hist + i] = in[2 * i];
+		odd[hist + i] = in[2 * i + 1];
+	}
+	for(int32_t n = 0; n < len; n++) {
+		out[n] = 0.5f * odd[n + m];
+	}
+	for(int32_t i = 0; i <= m; i++) {
+		float const tap = s->taps[i];
+		float complex const *restrict e1 = even + i;
+		float complex const *restrict e2 = even + 2 * m + 1 - i;
+		for(int32_t n = 0; n < len; n++) {
+			out[n] += tap * (e1[n] + e2[n]);
+		}
+	}
+	memmove(even, even + len, hist * sizeof(float complex));
+	memmove(odd, odd + len, hist * sizeof(float complex));
+}
+
+// Processes a single input chunk. Input data must be available.
+static void decimator_process_chunk(struct decimator *d) {
+	struct block *block = &d->block;
+	struct circ_buffer *in = &block->consumer.in->circ_buffer;
+	size_t const out_len = DECIMATOR_INPUT_CHUNK_LEN >> d->stage_cnt;
+
+	// Pass input gaps downstream at their position in the output stream
+	size_t gap_offset;
+	uint64_t gap_len;
+	while(block_connection_one2one_gap_get(block->consumer.in, DECIMATOR_INPUT_CHUNK_LEN, &gap_offset, &gap_len)) {
+		block_connection_one2one_gap_add(block->producer.out, gap_offset >> d->stage_cnt,
+				(gap_len + (1 << d->stage_cnt) - 1) >> d->stage_cnt);
+		block->stats.samples_skipped += gap_len;
+	}
+	float complex const *cbuf_read_ptr = circ_buffer_read(in, DECIMATOR_INPUT_CHUNK_LEN);
+	// Frequency shift while copying the samples out of the buffer
+	float complex const phasor = cexpf(I * (float)d->shift_phase);
+	float complex *restrict buf = d->buf[0];
+	for(int32_t i = 0; i < DECIMATOR_INPUT_CHUNK_LEN; i++) {
+		buf[i] = cbuf_read_ptr[i] * d->shift_table[i] * phasor;
+	}
+	circ_buffer_release(in, DECIMATOR_INPUT_CHUNK_LEN);
+	d->shift_phase = fmod(d->shift_phase + d->shift_phase_incr, 2.0 * M_PI);
+
+	// The output connection has the default overflow policy, so this waits
+	// for the consumer instead of dropping samples. If the consumer is too
+	// slow, samples get dropped on the input side anyway.
+	// The last stage writes directly into the output buffer
+	size_t out_samples = out_len;
+	float complex *outbuf = complex_samples_reserve(block->producer.out, &out_samples);
+	for(int32_t i = 0; i < d->stage_cnt; i++) {
+		halfband_decimate(&d->stages[i], d->buf[i % 2],
+				i == d->stage_cnt - 1 ? outbuf : d->buf[(i + 1) % 2]);
+	}
+	// If the FFT is fused with this block, it runs here
+	complex_samples_commit(block->producer.out, out_samples);
+	block->stats.samples_processed += DECIMATOR_INPUT_CHUNK_LEN;
+}
+
+static void decimator_stop(struct decimator *d) {
+	block_connection_one2one_shutdown(d->block.producer.out);
+	block_stats_update_cpu_time(&d->block);
+	d->block.running = false;
+}
+
+static void *decimator_thread(void *ctx) {
+	struct block *block = ctx;
+	struct decimator *d = container_of(block, struct decimator, block);
+
+	// Shutdown is done only when there is not enough data in the buffer,
+	// so that all the data gets processed before shutdown.
+	while(block_connection_one2one_wait_data(block->consumer.in, DECIMATOR_INPUT_CHUNK_LEN)) {
+		decimator_process_chunk(d);
+	}
+	debug_print(D_MISC, "Exiting (ordered shutdown)\n");
+	decimator_stop(d);
+	return NULL;
+}
+
+// Runs on the producer's thread when the block is fused with it
+static void decimator_fused_routine(struct block *block, bool shutdown) {
+	struct decimator *d = container_of(block, struct decimator, block);
+	while(block_connection_one2one_data_available(block->consumer.in, DECIMATOR_INPUT_CHUNK_LEN)) {
+		decimator_process_chunk(d);
+	}
+	if(shutdown) {
+		decimator_stop(d);
+	}
+}
+
+// Returns the highest decimation rate which keeps the band of
+// +/- passband_hz (around the center) free of aliases, while keeping
+// the output sample rate integer and not lower than min_output_rate.
+int32_t decimator_max_rate(int32_t sample_rate, int32_t passband_hz, int32_t min_output_rate) {
+	int32_t rate = 1;
+	for(int32_t i = 0; i < DECIMATOR_MAX_STAGES; i++) {
+		int32_t out_rate = sample_rate / (2 * rate);
+		// Transition band of the last stage must not be too narrow
+		if(sample_rate % (2 * rate) != 0 || out_rate < min_output_rate ||
+				0.5f - 2.0f * passband_hz / (2.0f * out_rate) < DECIMATOR_TRANSITION_BW_MIN) {
+			break;
+		}
+		rate *= 2;
+	}
+	return rate;
+}
+
+struct block *decimator_create(int32_t sample_rate, int32_t decimation,
+		int32_t passband_hz, int32_t freq_shift_hz) {
+	ASSERT(decimation > 1);
+	NEW(struct decimator, d);
+	while((1 << d->stage_cnt) < decimation) {
+		d->stage_cnt++;
+	}
+	ASSERT((1 << d->stage_cnt) == decimation);
+	ASSERT(d->stage_cnt <= DECIMATOR_MAX_STAGES);
+	int32_t len = DECIMATOR_INPUT_CHUNK_LEN;
+	int32_t rate = sample_rate;
+	for(int32_t i = 0; i < d->stage_cnt; i++) {
+		// Frequencies above rate/2 - passband_hz fold into the passband
+		// after decimation. Everything below that may pass unattenuated.
+		float transition_bw = 0.5f - 2.0f * passband_hz / rate;
+		len /= 2;
+		halfband_stage_init(&d->stages[i], len, transition_bw);
+		rate /= 2;
+	}
+	d->shift_table = XCALLOC(DECIMATOR_INPUT_CHUNK_LEN, sizeof(float complex));
+	double const shift = 2.0 * M_PI * (double)freq_shift_hz / sample_rate;
+	for(int32_t i = 0; i < DECIMATOR_INPUT_CHUNK_LEN; i++) {
+		d->shift_table[i] = cexp(I * shift * i);
+	}
+	d->shift_phase_incr = fmod(shift * DECIMATOR_INPUT_CHUNK_LEN, 2.0 * M_PI);
+	d->buf[0] = XCALLOC(DECIMATOR_INPUT_CHUNK_LEN, sizeof(float complex));
+	d->buf[1] = XCALLOC(DECIMATOR_INPUT_CHUNK_LEN / 2, sizeof(float complex));
+	debug_print(D_DSP, "decimation: %d stages: %d passband: %d Hz shift: %d Hz\n",
+			decimation, d->stage_cnt, passband_hz, freq_shift_hz);
+
+	struct producer producer = { .type = PRODUCER_SINGLE, .max_tu = DECIMATOR_INPUT_CHUNK_LEN / decimation };
+	struct consumer consumer = { .type = CONSUMER_SINGLE, .min_ru = DECIMATOR_INPUT_CHUNK_LEN };
+	d->block.producer = producer;
+	d->block.consumer = consumer;
+	d->block.thread_routine = decimator_thread;
+	d->block.fused_routine = decimator_fused_routine;
+	d->block.thread_class = THREAD_CLASS_FFT;
+	return &d->block;
+}
+
+void decimator_destroy(struct block *block) {
+	if(block != NULL) {
+		struct decimator *d = container_of(block, struct decimator, block);
+		for(int32_t i = 0; i < d->stage_cnt; i++) {
+			halfband_stage_destroy(&d->stages[i]);
+		}
+		XFREE(d->shift_table);
+		XFREE(d->buf[0]);
+		XFREE(d->buf[1]);
+		XFREE(d);
+	}
+}
@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+
+#define DECIMATOR_MAX_STAGES 8
+
+int32_t decimator_max_rate(int32_t sample_rate, int32_t passband_hz, int32_t min_output_rate);
+struct block *decimator_create(int32_t sample_rate, int32_t decimation,
+		int32_t passband_hz, int32_t freq_shift_hz);
+void decimator_destroy(struct block *block);
@@ -36,7 +36,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "fft.h"
 #include "libcsdr.h"
 #include "libcsdr_gpl.h"
-#include "util.h"               // debug_print, XCALLOC, NEW, XFREE
+#include "util.h"               // debug_print, XCALLOC_ALIGNED, NEW, XFREE
 
 //DDC implementation based on:
 //http://www.3db-labs.com/01598092_MultibandFilterbank.pdf
@@ -213,9 +213,9 @@ fft_channelizer fft_channelizer_create(int32_t decimation, float transition_bw,
 	fastddc_print(c->ddc,"fastddc_inv_cc");
 
 	//prepare making the filter and doing FFT on it
-	float complex *taps = XCALLOC(c->ddc->fft_size, sizeof(float complex));
-	c->filtertaps_fft = XCALLOC(c->ddc->fft_size, sizeof(float complex));
-	FFT_PLAN_T *filter_taps_plan = csdr_make_fft_c2c(c->ddc->fft_size, taps, c->filtertaps_fft, 1, 0);
+	float complex *taps = XCALLOC_ALIGNED(c->ddc->fft_size, sizeof(float complex));
+	c->filtertaps_fft = XCALLOC_ALIGNED(c->ddc->fft_size, sizeof(float complex));
+	FFT_PLAN_T *filter_taps_plan = csdr_make_fft_c2c(c->ddc->fft_size, taps, c->filtertaps_fft, 1, 0, FFT_PLAN_CHANNEL);
 
 	//make the filter
 	float filter_half_bw = 0.5f / decimation;
@@ -228,9 +228,9 @@ fft_channelizer fft_channelizer_create(int32_t decimation, float transition_bw,
 	XFREE(taps);
 
 	//make FFT plan
-	c->inv_input = XCALLOC(c->ddc->fft_size, sizeof(float complex));
-	c->inv_output = XCALLOC(c->ddc->fft_size, sizeof(float complex));
-	c->inv_plan = csdr_make_fft_c2c(c->ddc->fft_inv_size, c->inv_input, c->inv_output, 0, 0);
+	c->inv_input = XCALLOC_ALIGNED(c->ddc->fft_size, sizeof(float complex));
+	c->inv_output = XCALLOC_ALIGNED(c->ddc->fft_size, sizeof(float complex));
+	c->inv_plan = csdr_make_fft_c2c(c->ddc->fft_inv_size, c->inv_input, c->inv_output, 0, 1, FFT_PLAN_CHANNEL);
 
 	return c;
 fail:
@@ -2,71 +2,132 @@
 
 #include <stdint.h>
 #include <string.h>         // memcpy, memmove
-#include <pthread.h>        // pthread_*
-#include <liquid/liquid.h>  // cbuffercf_*
-#include "config.h"
-#ifndef HAVE_PTHREAD_BARRIERS
-#include "pthread_barrier.h"
-#endif
+#include <inttypes.h>       // PRIu64
+#include "config.h"         // WITH_STATSD
 #include "block.h"          // block_*
 #include "fastddc.h"        // fastddc_t
 #include "fft.h"
-#include "util.h"           // XCALLOC, NEW
+#include "statsd.h"         // statsd_*
+#include "util.h"           // XCALLOC_ALIGNED, NEW, ASSERT, container_of
+
+// Frame counters are sent to statsd every FFT_STATS_INTERVAL frames
+#define FFT_STATS_INTERVAL 256
+
+#ifdef WITH_STATSD
+static char *fft_counters[] = {
+	"channelizer.frames",
+	"channelizer.fft_waits",
+	NULL
+};
+#endif
 
 struct fft {
 	struct block block;
 	fastddc_t *ddc;
 	float complex *input;
+	FFT_PLAN_T *fwd_plan;
+	uint64_t frames_reported;
+	uint64_t waits_reported;
 };
 
-static void *fft_thread(void *ctx) {
-	struct block *block = ctx;
-	struct fft *fft = container_of(block, struct fft, block);
+// Creates the forward FFT plan. Must be called after block_connect_one2many()
+// and before the block is started. Planning may take a while (depending on
+// the planner effort and thread count settings), so it must be done before
+// the input starts producing samples, not on the thread which runs the block.
+void fft_prepare(struct block *fft_block) {
+	ASSERT(fft_block != NULL);
+	struct fft *fft = container_of(fft_block, struct fft, block);
+	struct shared_buffer *output = &fft->block.producer.out->shared_buffer;
+	// The plan can't be created in fft_create because the output buffer
+	// is created by block_connect_one2many() which is called after fft_create().
+	// The plan is then executed with each of the output slots in turn.
+	// Planning may overwrite the arrays, which is fine, as they hold no data yet.
+	fft->fwd_plan = csdr_make_fft_c2c(fft->ddc->fft_size, fft->input, output->buf, 1, 1, FFT_PLAN_CHANNELIZER);
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(fft_counters);
+#endif
+}
+
+// Processes a single frame. Input data must be available.
+static void fft_process_frame(struct fft *fft) {
+	struct block *block = &fft->block;
 	struct circ_buffer *circ_buffer = &block->consumer.in->circ_buffer;
 	struct shared_buffer *output = &block->producer.out->shared_buffer;
 	fastddc_t *ddc = fft->ddc;
-	float complex *cbuf_read_ptr;
-	uint32_t samples_read;
 	float complex *fft_input = fft->input;
 
-	// The plan can't be created in fft_create because the output buffer
-	// is created by block_connect_one2many() which is called after fft_create().
-	FFT_PLAN_T *fwd_plan = csdr_make_fft_c2c(ddc->fft_size, fft_input, output->buf, 1, 0);
+	// Gaps are passed on with frame resolution
+	uint64_t gap_total = 0, gap_len;
+	size_t gap_offset;
+	while(block_connection_one2one_gap_get(block->consumer.in, ddc->input_size, &gap_offset, &gap_len)) {
+		gap_total += gap_len;
+	}
+	memmove(fft_input, fft_input + ddc->input_size, ddc->overlap_length * sizeof(float complex));
+	memcpy(fft_input + ddc->overlap_length, circ_buffer_read(circ_buffer, ddc->input_size),
+			ddc->input_size * sizeof(float complex));
+	circ_buffer_release(circ_buffer, ddc->input_size);
+	block->stats.samples_processed += ddc->input_size;
 
-	pthread_barrier_wait(output->consumers_ready);         // Wait for all consumers to initialize
-	while(true) {
-		pthread_mutex_lock(circ_buffer->mutex);
-		// Check for shutdown signal only when there is no data (or not enough data) in the buffer.
-		// This causes all the data to be processed and flushed to consumers before shutdown is done.
-		while(cbuffercf_size(circ_buffer->buf) < (uint32_t)ddc->input_size) {
-			if(block_connection_is_shutdown_signaled(block->consumer.in)) {
-				debug_print(D_MISC, "Exiting (ordered shutdown)\n");
-				pthread_mutex_unlock(circ_buffer->mutex);
-				goto shutdown;
-			}
-			pthread_cond_wait(circ_buffer->cond, circ_buffer->mutex);
+	// Wait until the slowest consumer releases the oldest frame
+	float complex *slot = block_connection_one2many_slot_get(block->producer.out);
+	csdr_fft_execute_arrays(fft->fwd_plan, fft_input, slot);
+	// FIXME: rework fastddc_inv_cc, so that this step is not needed
+	fft_swap_sides(slot, ddc->fft_size);
+	if(gap_total > 0) {
+		block_connection_one2many_slot_set_gap(block->producer.out, gap_total);
+		block->stats.samples_skipped += gap_total;
+	}
+	block_connection_one2many_slot_publish(block->producer.out);
+	if(++fft->frames_reported == FFT_STATS_INTERVAL) {
+		statsd_increment_by("channelizer.frames", fft->frames_reported);
+		if(output->producer_waits != fft->waits_reported) {
+			statsd_increment_by("channelizer.fft_waits", output->producer_waits - fft->waits_reported);
+			fft->waits_reported = output->producer_waits;
 		}
-		memmove(fft_input, fft_input + ddc->input_size, ddc->overlap_length * sizeof(float complex));
-		cbuffercf_read(circ_buffer->buf, ddc->input_size, &cbuf_read_ptr, &samples_read);
-		ASSERT(samples_read == (uint32_t)ddc->input_size);
-		memcpy(fft_input + ddc->overlap_length, cbuf_read_ptr,
-				ddc->input_size * sizeof(float complex));
-		cbuffercf_release(circ_buffer->buf, ddc->input_size);
-		pthread_mutex_unlock(circ_buffer->mutex);
-
-		csdr_fft_execute(fwd_plan);
-		// FIXME: rework fastddc_inv_cc, so that this step is not needed
-		fft_swap_sides(output->buf, ddc->fft_size);
-		pthread_barrier_wait(output->data_ready);
-		pthread_barrier_wait(output->consumers_ready);
+		fft->frames_reported = 0;
 	}
-shutdown:
+}
+
+static void fft_stop(struct fft *fft) {
+	struct block *block = &fft->block;
+	debug_print(D_MISC, "FFT waited for consumers on %" PRIu64 " frames\n",
+			block->producer.out->shared_buffer.producer_waits);
 	block_connection_one2many_shutdown(block->producer.out);
-	csdr_destroy_fft_c2c(fwd_plan);
+	if(fft->fwd_plan != NULL) {
+		csdr_destroy_fft_c2c(fft->fwd_plan);
+		fft->fwd_plan = NULL;
+	}
+	block_stats_update_cpu_time(block);
 	block->running = false;
+}
+
+static void *fft_thread(void *ctx) {
+	struct block *block = ctx;
+	struct fft *fft = container_of(block, struct fft, block);
+	ASSERT(fft->fwd_plan != NULL);
+
+	// Shutdown is done only when there is no data (or not enough data) in the buffer.
+	// This causes all the data to be processed and flushed to consumers before shutdown is done.
+	while(block_connection_one2one_wait_data(block->consumer.in, fft->ddc->input_size)) {
+		fft_process_frame(fft);
+	}
+	debug_print(D_MISC, "Exiting (ordered shutdown)\n");
+	fft_stop(fft);
 	return NULL;
 }
 
+// Runs on the producer's thread when the block is fused with it
+static void fft_fused_routine(struct block *block, bool shutdown) {
+	struct fft *fft = container_of(block, struct fft, block);
+	ASSERT(fft->fwd_plan != NULL);
+	while(block_connection_one2one_data_available(block->consumer.in, fft->ddc->input_size)) {
+		fft_process_frame(fft);
+	}
+	if(shutdown) {
+		fft_stop(fft);
+	}
+}
+
 struct block *fft_create(int32_t decimation, float transition_bw) {
 	NEW(struct fft, fft);
 	NEW(fastddc_t, ddc);
@@ -76,12 +137,14 @@ struct block *fft_create(int32_t decimation, float transition_bw) {
 	}
 	fastddc_print(ddc,"fastddc_fwd_cc");
 	fft->ddc = ddc;
-	fft->input = XCALLOC(ddc->fft_size, sizeof(float complex));
+	fft->input = XCALLOC_ALIGNED(ddc->fft_size, sizeof(float complex));
 	struct producer producer = { .type = PRODUCER_MULTI, .max_tu = ddc->fft_size };
 	struct consumer consumer = { .type = CONSUMER_SINGLE, .min_ru = ddc->fft_size };
 	fft->block.producer = producer;
 	fft->block.consumer = consumer;
 	fft->block.thread_routine = fft_thread;
+	fft->block.fused_routine = fft_fused_routine;
+	fft->block.thread_class = THREAD_CLASS_FFT;
 	return &fft->block;
 }
 
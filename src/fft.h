@@ -17,14 +17,37 @@ struct fft_plan_s {
 
 typedef struct fft_thread_ctx_s *fft_thread_ctx_t;
 
+// How hard FFTW tries to find the fastest plan
+enum fft_planner_effort {
+	FFT_PLANNER_ESTIMATE = 0,
+	FFT_PLANNER_MEASURE,
+	FFT_PLANNER_PATIENT,
+	FFT_PLANNER_EFFORT_CNT
+};
+
+// Plan classes with separate thread count settings
+enum fft_plan_class {
+	FFT_PLAN_CHANNELIZER = 0,   // forward FFT of the whole input band
+	FFT_PLAN_CHANNEL,           // per-channel FFTs
+	FFT_PLAN_CLASS_CNT
+};
+
+// Thread count value which causes the fastest one to be found by benchmarking
+#define FFT_THREADS_AUTO 0
+
 // fft_fftw.c
+void csdr_fft_set_planner_effort(enum fft_planner_effort effort);
+void csdr_fft_set_wisdom_file(char const *path);
+void csdr_fft_set_thread_cnt(enum fft_plan_class cls, int32_t thread_cnt);
 void csdr_fft_init();
 void csdr_fft_destroy();
 FFT_PLAN_T* csdr_make_fft_c2c(int32_t size, float complex *input,
-		float complex *output, int32_t forward, int32_t benchmark);
+		float complex *output, int32_t forward, int32_t benchmark, enum fft_plan_class cls);
 void csdr_destroy_fft_c2c(FFT_PLAN_T *plan);
 void csdr_fft_execute(FFT_PLAN_T* plan);
+void csdr_fft_execute_arrays(FFT_PLAN_T *plan, float complex *input, float complex *output);
 
 // fft.c
 struct block *fft_create(int32_t decimation, float transition_bw);
+void fft_prepare(struct block *fft_block);
 void fft_destroy(struct block *fft_block);
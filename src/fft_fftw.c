@@ -1,29 +1,183 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdio.h>          // fprintf
+#include <stdbool.h>
 #include <complex.h>
+#include <time.h>           // clock_gettime
+#include <unistd.h>         // sysconf
+#include <pthread.h>        // pthread_mutex_*
 #include <fftw3.h>
 #include "fft.h"
-#include "util.h"           // NEW
+#include "util.h"           // NEW, XCALLOC_ALIGNED, ASSERT, debug_print
 #include "config.h"         // WITH_FFTW3F_THREADS
 
+// Default thread counts. Channel FFTs are small, so threading them
+// costs more in synchronization than it saves.
 #define FFT_THREAD_CNT 4
+#define FFT_CHANNEL_THREAD_CNT 1
+
+// Thread count auto-tuning: candidates are powers of 2 up to this value
+// (and up to the number of CPUs). Each candidate is timed for this long.
+#define FFT_TUNE_MAX_THREADS 16
+#define FFT_TUNE_TIME 0.1           // seconds
+#define FFT_TUNE_CACHE_SIZE 16
+
+// FFTW planner is not thread safe. Plans are created from several threads
+// (eg. when multiple pipelines are started simultaneously), so serialize
+// all calls to it.
+static pthread_mutex_t fft_planner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned fft_planner_flags[FFT_PLANNER_EFFORT_CNT] = {
+	[FFT_PLANNER_ESTIMATE] = FFTW_ESTIMATE,
+	[FFT_PLANNER_MEASURE] = FFTW_MEASURE,
+	[FFT_PLANNER_PATIENT] = FFTW_PATIENT
+};
+
+// Planner flags used for plans which are executed repeatedly
+static unsigned fft_benchmark_flags = FFTW_ESTIMATE;
+
+// Wisdom (ie. results of plan benchmarks) is loaded from this file on startup
+// and saved back on exit, so that only the first run pays the planning cost
+static char const *fft_wisdom_file = NULL;
+
+static int32_t fft_thread_cnt[FFT_PLAN_CLASS_CNT] = {
+	[FFT_PLAN_CHANNELIZER] = FFT_THREAD_CNT,
+	[FFT_PLAN_CHANNEL] = FFT_CHANNEL_THREAD_CNT
+};
+
+// Results of thread count auto-tuning (protected by fft_planner_lock)
+static struct {
+	int32_t size;
+	int32_t thread_cnt;
+} fft_tuned[FFT_TUNE_CACHE_SIZE];
+static int32_t fft_tuned_cnt = 0;
+
+// Must be called before csdr_fft_init
+void csdr_fft_set_planner_effort(enum fft_planner_effort effort) {
+	ASSERT(effort < FFT_PLANNER_EFFORT_CNT);
+	fft_benchmark_flags = fft_planner_flags[effort];
+}
+
+// Must be called before csdr_fft_init
+void csdr_fft_set_wisdom_file(char const *path) {
+	fft_wisdom_file = path;
+}
+
+// Sets the number of threads used by plans of the given class.
+// FFT_THREADS_AUTO picks the fastest thread count for each FFT size.
+// Must be called before csdr_fft_init
+void csdr_fft_set_thread_cnt(enum fft_plan_class cls, int32_t thread_cnt) {
+	ASSERT(cls < FFT_PLAN_CLASS_CNT);
+	ASSERT(thread_cnt >= 0);
+#ifndef WITH_FFTW3F_THREADS
+	fprintf(stderr, "Warning: FFTW library has been built without thread support, "
+			"FFT thread count setting ignored\n");
+#endif
+	fft_thread_cnt[cls] = thread_cnt;
+}
+
+#ifdef WITH_FFTW3F_THREADS
+// Returns the average time of a single execution of the plan (in seconds)
+static double fft_time_plan(fftwf_plan plan) {
+	struct timespec start, now;
+	double elapsed = 0.0;
+	int32_t cnt = 0;
+	fftwf_execute(plan);        // warm up caches and threads
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		fftwf_execute(plan);
+		cnt++;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+	} while(elapsed < FFT_TUNE_TIME || cnt < 3);
+	return elapsed / cnt;
+}
+
+// Finds the fastest thread count for a forward FFT of the given size.
+// Must be called with fft_planner_lock held. All plans are created while
+// pipelines are set up (fft_prepare, hfdl_channel_create), so the timing
+// is done before any input starts and nothing else competes for the CPUs.
+static int32_t fft_tune_thread_cnt(int32_t size) {
+	for(int32_t i = 0; i < fft_tuned_cnt; i++) {
+		if(fft_tuned[i].size == size) {
+			return fft_tuned[i].thread_cnt;
+		}
+	}
+	long const cpu_cnt = sysconf(_SC_NPROCESSORS_ONLN);
+	float complex *in = XCALLOC_ALIGNED(size, sizeof(float complex));
+	float complex *out = XCALLOC_ALIGNED(size, sizeof(float complex));
+	int32_t best_cnt = 1;
+	double best_time = 0.0;
+	for(int32_t n = 1; n <= FFT_TUNE_MAX_THREADS && (n == 1 || n <= cpu_cnt); n *= 2) {
+		fftwf_plan_with_nthreads(n);
+		fftwf_plan plan = fftwf_plan_dft_1d(size, (fftwf_complex *)in, (fftwf_complex *)out,
+				FFTW_FORWARD, fft_benchmark_flags);
+		double const t = fft_time_plan(plan);
+		fftwf_destroy_plan(plan);
+		debug_print(D_DSP, "FFT size %d, %d threads: %.1f us\n", size, n, t * 1e6);
+		if(n == 1 || t < best_time) {
+			best_cnt = n;
+			best_time = t;
+		}
+	}
+	XFREE(in);
+	XFREE(out);
+	fprintf(stderr, "FFT size %d: using %d thread%s (%.1f us per transform)\n",
+			size, best_cnt, best_cnt > 1 ? "s" : "", best_time * 1e6);
+	if(fft_tuned_cnt < FFT_TUNE_CACHE_SIZE) {
+		fft_tuned[fft_tuned_cnt].size = size;
+		fft_tuned[fft_tuned_cnt].thread_cnt = best_cnt;
+		fft_tuned_cnt++;
+	}
+	return best_cnt;
+}
+#endif
 
 void csdr_fft_init() {
 #ifdef WITH_FFTW3F_THREADS
 	fftwf_init_threads();
-	fftwf_plan_with_nthreads(FFT_THREAD_CNT);
 #endif
+	if(fft_wisdom_file != NULL) {
+		if(fftwf_import_wisdom_from_filename(fft_wisdom_file)) {
+			debug_print(D_DSP, "FFTW wisdom loaded from %s\n", fft_wisdom_file);
+		} else if(fft_benchmark_flags != FFTW_ESTIMATE) {
+			fprintf(stderr, "FFTW wisdom file %s not found or not usable, "
+					"FFT planning may take a while\n", fft_wisdom_file);
+		}
+	}
 }
 
 void csdr_fft_destroy() {
+	if(fft_wisdom_file != NULL) {
+		pthread_mutex_lock(&fft_planner_lock);
+		if(!fftwf_export_wisdom_to_filename(fft_wisdom_file)) {
+			fprintf(stderr, "Could not save FFTW wisdom to %s\n", fft_wisdom_file);
+		}
+		pthread_mutex_unlock(&fft_planner_lock);
+	}
 #ifdef WITH_FFTW3F_THREADS
 	fftwf_cleanup_threads();
 #endif
 }
 
-FFT_PLAN_T* csdr_make_fft_c2c(int32_t size, float complex* input, float complex* output, int32_t forward, int32_t benchmark) {
+// Plans which are executed only once (or just a few times) should be created
+// with benchmark = 0. Otherwise the plan is created with the configured
+// planner effort. Note that planning with effort other than FFT_PLANNER_ESTIMATE
+// overwrites input and output arrays (unless wisdom for this size is known).
+FFT_PLAN_T* csdr_make_fft_c2c(int32_t size, float complex* input, float complex* output, int32_t forward, int32_t benchmark,
+		enum fft_plan_class cls) {
+	ASSERT(cls < FFT_PLAN_CLASS_CNT);
 	NEW(FFT_PLAN_T, plan);
 	// fftwf_complex is binary compatible with float complex
-	plan->plan = fftwf_plan_dft_1d(size, (fftwf_complex *)input, (fftwf_complex *)output, forward ? FFTW_FORWARD : FFTW_BACKWARD, benchmark ? FFTW_MEASURE : FFTW_ESTIMATE);
+	pthread_mutex_lock(&fft_planner_lock);
+#ifdef WITH_FFTW3F_THREADS
+	int32_t thread_cnt = fft_thread_cnt[cls];
+	if(thread_cnt == FFT_THREADS_AUTO) {
+		thread_cnt = fft_tune_thread_cnt(size);
+	}
+	fftwf_plan_with_nthreads(thread_cnt);
+#endif
+	plan->plan = fftwf_plan_dft_1d(size, (fftwf_complex *)input, (fftwf_complex *)output, forward ? FFTW_FORWARD : FFTW_BACKWARD, benchmark ? fft_benchmark_flags : FFTW_ESTIMATE);
+	pthread_mutex_unlock(&fft_planner_lock);
 	plan->size = size;
 	plan->input = input;
 	plan->output = output;
@@ -32,7 +186,9 @@ FFT_PLAN_T* csdr_make_fft_c2c(int32_t size, float complex* input, float complex*
 
 void csdr_destroy_fft_c2c(FFT_PLAN_T *plan) {
 	if(plan) {
+		pthread_mutex_lock(&fft_planner_lock);
 		fftwf_destroy_plan(plan->plan);
+		pthread_mutex_unlock(&fft_planner_lock);
 		XFREE(plan);
 	}
 }
@@ -40,3 +196,9 @@ void csdr_destroy_fft_c2c(FFT_PLAN_T *plan) {
 void csdr_fft_execute(FFT_PLAN_T* plan) {
 	fftwf_execute(plan->plan);
 }
+
+// Executes the plan on arrays other than the ones it has been created with.
+// They must have the same alignment as the original ones.
+void csdr_fft_execute_arrays(FFT_PLAN_T *plan, float complex *input, float complex *output) {
+	fftwf_execute_dft(plan->plan, (fftwf_complex *)input, (fftwf_complex *)output);
+}
@@ -13,12 +13,10 @@
 #include <sys/time.h>               // struct timeval
 #include <liquid/liquid.h>
 #include "config.h"                 // *_DEBUG
-#ifndef HAVE_PTHREAD_BARRIERS
-#include "pthread_barrier.h"
-#endif
-#include "block.h"                  // struct block, block_connection_is_shutdown_signaled
+#include "block.h"                  // struct block, block_connection_one2many_frame_*
+#include "sample-clock.h"           // sample_clock_get_time
 #include "dumpfile.h"               // dumpfile_*
-#include "util.h"                   // NEW, XCALLOC, octet_string_new
+#include "util.h"                   // NEW, XCALLOC, XCALLOC_ALIGNED, octet_string_new
 #include "fastddc.h"                // fft_channelizer_create, fastddc_inv_cc
 #include "libfec/fec.h"             // viterbi27
 #include "hfdl.h"                   // HFDL_SYMBOL_RATE, SPS
@@ -44,6 +42,7 @@
 #define CORR_THRESHOLD_M1 0.3f
 #define MAX_SEARCH_RETRIES 3
 #define HFDL_SSB_CARRIER_OFFSET_HZ 1440
+#define HFDL_STATS_INTERVAL 256     // FFT frames between channelizer statistics updates
 
 typedef enum {
 	SAMPLER_EMIT_BITS = 1,
@@ -187,6 +186,9 @@ typedef struct descrambler *descrambler;
 struct hfdl_channel;
 
 static void *hfdl_decoder_thread(void *ctx);
+static bool hfdl_decoder_task(struct block *block);
+static void hfdl_channel_dumps_open(struct hfdl_channel *c);
+static void hfdl_channel_dumps_close(struct hfdl_channel *c);
 static int32_t match_sequence(bsequence *templates, size_t template_cnt, bsequence bits, float *result_corr);
 static void compute_train_bit_error_cnt(struct hfdl_channel *c);
 static void decode_user_data(struct hfdl_channel *c);
@@ -219,6 +221,7 @@ struct hfdl_channel {
 	mod_arity data_mod_arity;
 	mod_arity current_mod_arity;
 	int32_t chan_freq;
+	int32_t segment;
 	int32_t resampler_delay;
 	int32_t symbols_wanted;
 	int32_t search_retries;
@@ -235,6 +238,47 @@ struct hfdl_channel {
 	float freq_err_hz;
 	float signal_level;
 	float noise_floor;
+	// Demodulator buffers and state carried over between input frames
+	float complex *channelizer_output;
+	float complex *resampled;
+	uint32_t noise_floor_sampling_clk;
+	float frame_symbol_cnt;             // float because it's used only in float calculations
+	uint64_t frames_reported, waits_reported;
+#ifdef COSTAS_DEBUG
+	dumpfile_rf32 f_costas_dphi;
+	dumpfile_rf32 f_costas_err;
+	dumpfile_cf32 f_costas_out;
+#endif
+#ifdef SYMSYNC_DEBUG
+	dumpfile_cf32 f_symsync_out;
+#endif
+#ifdef CHAN_DEBUG
+	dumpfile_cf32 f_chan_out;
+#endif
+#ifdef MF_DEBUG
+	dumpfile_cf32 f_mf_out;
+#endif
+#ifdef AGC_DEBUG
+	dumpfile_cf32 f_agc_out;
+	dumpfile_rf32 f_agc_gain;
+	dumpfile_rf32 f_agc_rssi;
+	dumpfile_rf32 f_noise_floor;
+	dumpfile_rf32 f_sig_level;
+#endif
+#ifdef EQ_DEBUG
+	dumpfile_cf32 f_eq_out;
+#endif
+#ifdef CORR_DEBUG
+	dumpfile_rf32 f_corr_A1;
+	dumpfile_rf32 f_corr_A2;
+#endif
+#ifdef DUMP_CONST
+	uint64_t frame_id;
+	FILE *consts;
+#endif
+#ifdef DUMP_FFT
+	dumpfile_cf32 f_fft_out;
+#endif
 };
 
 /**********************************
@@ -499,13 +543,21 @@ struct block *hfdl_channel_create(int32_t sample_rate, int32_t pre_decimation_ra
 
 	c->user_data = bsequence_create(DATA_SYMBOLS_CNT_MAX * MOD_ARITY_MAX);
 
+	// FIXME: post_input_size / post_decimation_rate ?
+	c->channelizer_output = XCALLOC_ALIGNED(c->channelizer->ddc->post_input_size, sizeof(float complex));
+	size_t resampled_size = (c->channelizer->ddc->post_input_size + c->resampler_delay + 10) * c->resamp_rate;
+	c->resampled = XCALLOC_ALIGNED(resampled_size, sizeof(float complex));
+
 	framer_reset(c);
+	hfdl_channel_dumps_open(c);
 
 	struct producer producer = { .type = PRODUCER_NONE };
 	struct consumer consumer = { .type = CONSUMER_MULTI, .min_ru = 0 };
 	c->block.producer = producer;
 	c->block.consumer = consumer;
 	c->block.thread_routine = hfdl_decoder_thread;
+	c->block.thread_class = THREAD_CLASS_CHANNEL;
+	c->block.task_routine = hfdl_decoder_task;
 
 	return &c->block;
 fail:
@@ -514,6 +566,23 @@ fail:
 
 }
 
+// Sets the index of the input segment this channel is decoding
+// (when decoding a recording in parallel segments)
+void hfdl_channel_set_segment(struct block *channel_block, int32_t segment) {
+	ASSERT(channel_block != NULL);
+	struct hfdl_channel *c = container_of(channel_block, struct hfdl_channel, block);
+	c->segment = segment;
+}
+
+// Returns the number of samples by which adjacent segments of a recording
+// must overlap when decoded in parallel. The overlap must be longer than
+// the longest (double slot) frame, otherwise frames crossing a segment
+// boundary would be lost. One second is added to let the demodulator
+// settle after startup.
+int64_t hfdl_segment_overlap(int32_t sample_rate) {
+	return (int64_t)(2 * SINGLE_SLOT_FRAME_LEN + HFDL_SYMBOL_RATE) * sample_rate / HFDL_SYMBOL_RATE;
+}
+
 void hfdl_channel_destroy(struct block *channel_block) {
 	if(channel_block == NULL) {
 		return;
@@ -538,6 +607,9 @@ void hfdl_channel_destroy(struct block *channel_block) {
 		delete_viterbi27(c->viterbi_ctx[i]);
 	}
 	bsequence_destroy(c->user_data);
+	XFREE(c->channelizer_output);
+	XFREE(c->resampled);
+	hfdl_channel_dumps_close(c);
 	XFREE(c);
 }
 
@@ -562,350 +634,404 @@ void hfdl_print_summary(void) {
 }
 #define LEVEL_TO_DB(level) (20.0f * log10f(level))
 
-static void *hfdl_decoder_thread(void *ctx) {
-	ASSERT(ctx != NULL);
-	struct block *block = ctx;
-	struct hfdl_channel *c = container_of(block, struct hfdl_channel, block);
+static void hfdl_channel_dumps_open(struct hfdl_channel *c) {
+	UNUSED(c);
+#ifdef COSTAS_DEBUG
+	c->f_costas_dphi = dumpfile_rf32_open("f_costas_dphi.rf32", NAN);
+	c->f_costas_err = dumpfile_rf32_open("f_costas_err.rf32", NAN);
+	c->f_costas_out = dumpfile_cf32_open("f_costas_out.cf32", NAN);
+#endif
+#ifdef SYMSYNC_DEBUG
+	c->f_symsync_out = dumpfile_cf32_open("f_symsync_out.cf32", NAN);
+#endif
+#ifdef CHAN_DEBUG
+	c->f_chan_out = dumpfile_cf32_open("f_chan_out.cf32", NAN);
+#endif
+#ifdef MF_DEBUG
+	c->f_mf_out = dumpfile_cf32_open("f_mf_out.cf32", NAN);
+#endif
+#ifdef AGC_DEBUG
+	c->f_agc_out = dumpfile_cf32_open("f_agc_out.cf32", NAN);
+	c->f_agc_gain = dumpfile_rf32_open("f_agc_gain.rf32", NAN);
+	c->f_agc_rssi = dumpfile_rf32_open("f_agc_rssi.rf32", NAN);
+	c->f_noise_floor = dumpfile_rf32_open("f_noise_floor.rf32", NAN);
+	c->f_sig_level = dumpfile_rf32_open("f_sig_level.rf32", NAN);
+#endif
+#ifdef EQ_DEBUG
+	c->f_eq_out = dumpfile_cf32_open("f_eq_out.cf32", NAN);
+#endif
+#ifdef CORR_DEBUG
+	c->f_corr_A1 = dumpfile_rf32_open("f_corr_A1.rf32", 0.f);
+	c->f_corr_A2 = dumpfile_rf32_open("f_corr_A2.rf32", 0.f);
+#endif
+#ifdef DUMP_CONST
+	if(Config.datadumps == true) {
+		c->consts = fopen("const.m", "w");
+		ASSERT(c->consts);
+	}
+#endif
+#ifdef DUMP_FFT
+	c->f_fft_out = dumpfile_cf32_open("f_fft_out.cf32");
+#endif
+}
 
-	// FIXME: post_input_size / post_decimation_rate ?
-	float complex *channelizer_output = XCALLOC(c->channelizer->ddc->post_input_size, sizeof(float complex));
-	size_t resampled_size = (c->channelizer->ddc->post_input_size + c->resampler_delay + 10) * c->resamp_rate;
-	float complex *resampled = XCALLOC(resampled_size, sizeof(float complex));
-	uint32_t resampled_cnt = 0;
-	uint32_t noise_floor_sampling_clk = 0;
-	float complex r, s;
-	float frame_symbol_cnt = 0.0f;      // float because it's used only in float calculations
-	float complex symbols[3];
-	uint32_t symbols_produced = 0;
-	uint32_t bits = 0;
-	int32_t M1_match = -1;
-	float corr_A1 = 0.f;
-	float corr_A2 = 0.f;
-	float corr_M1 = 0.f;
-	static size_t const max_symbols_without_frame = 13 * SINGLE_SLOT_FRAME_LEN;
-	c->s_state = SAMPLER_EMIT_BITS;
-	c->fr_state = FRAMER_A1_SEARCH;
+static void hfdl_channel_dumps_close(struct hfdl_channel *c) {
+	UNUSED(c);
 #ifdef COSTAS_DEBUG
-	dumpfile_rf32 f_costas_dphi = dumpfile_rf32_open("f_costas_dphi.rf32", NAN);
-	dumpfile_rf32 f_costas_err = dumpfile_rf32_open("f_costas_err.rf32", NAN);
-	dumpfile_cf32 f_costas_out = dumpfile_cf32_open("f_costas_out.cf32", NAN);
+	dumpfile_rf32_destroy(c->f_costas_dphi);
+	dumpfile_rf32_destroy(c->f_costas_err);
+	dumpfile_cf32_destroy(c->f_costas_out);
 #endif
 #ifdef SYMSYNC_DEBUG
-	dumpfile_cf32 f_symsync_out = dumpfile_cf32_open("f_symsync_out.cf32", NAN);
+	dumpfile_cf32_destroy(c->f_symsync_out);
 #endif
 #ifdef CHAN_DEBUG
-	dumpfile_cf32 f_chan_out = dumpfile_cf32_open("f_chan_out.cf32", NAN);
+	dumpfile_cf32_destroy(c->f_chan_out);
 #endif
 #ifdef MF_DEBUG
-	dumpfile_cf32 f_mf_out = dumpfile_cf32_open("f_mf_out.cf32", NAN);
+	dumpfile_cf32_destroy(c->f_mf_out);
 #endif
 #ifdef AGC_DEBUG
-	dumpfile_cf32 f_agc_out = dumpfile_cf32_open("f_agc_out.cf32", NAN);
-	dumpfile_rf32 f_agc_gain = dumpfile_rf32_open("f_agc_gain.rf32", NAN);
-	dumpfile_rf32 f_agc_rssi = dumpfile_rf32_open("f_agc_rssi.rf32", NAN);
-	dumpfile_rf32 f_noise_floor = dumpfile_rf32_open("f_noise_floor.rf32", NAN);
-	dumpfile_rf32 f_sig_level = dumpfile_rf32_open("f_sig_level.rf32", NAN);
-	float gain, rssi;
+	dumpfile_cf32_destroy(c->f_agc_out);
+	dumpfile_rf32_destroy(c->f_agc_gain);
+	dumpfile_rf32_destroy(c->f_agc_rssi);
+	dumpfile_rf32_destroy(c->f_sig_level);
+	dumpfile_rf32_destroy(c->f_noise_floor);
 #endif
 #ifdef EQ_DEBUG
-	dumpfile_cf32 f_eq_out = dumpfile_cf32_open("f_eq_out.cf32", NAN);
+	dumpfile_cf32_destroy(c->f_eq_out);
 #endif
 #ifdef CORR_DEBUG
-	dumpfile_rf32 f_corr_A1 = dumpfile_rf32_open("f_corr_A1.rf32", 0.f);
-	dumpfile_rf32 f_corr_A2 = dumpfile_rf32_open("f_corr_A2.rf32", 0.f);
+	dumpfile_rf32_destroy(c->f_corr_A1);
+	dumpfile_rf32_destroy(c->f_corr_A2);
 #endif
 #ifdef DUMP_CONST
-	uint64_t frame_id;
-	FILE *consts;
 	if(Config.datadumps == true) {
-		consts = fopen("const.m", "w");
-		ASSERT(consts);
+		fclose(c->consts);
 	}
 #endif
 #ifdef DUMP_FFT
-	dumpfile_cf32 f_fft_out = dumpfile_cf32_open("f_fft_out.cf32");
+	dumpfile_cf32_destroy(c->f_fft_out);
+#endif
+}
+
+// Handles the loss of len input samples just before the current frame.
+// Any HFDL frame being received can't be decoded anymore,
+// so the demodulator starts looking for a new one.
+static void hfdl_channel_input_gap(struct hfdl_channel *c, uint64_t len) {
+	chan_debug("%" PRIu64 " input samples lost, resetting demodulator\n", len);
+	// Keep the sample counter in line with the time base of the input
+	c->sample_cnt += llround((double)len * c->resamp_rate / c->channelizer->ddc->pre_decimation);
+	costas_cccf_reset(c->loop);
+	framer_reset(c);
+	statsd_increment_per_channel(c->chan_freq, "demod.gaps");
+}
+
+// Demodulates and decodes a single channelizer output frame.
+// Releases the frame as soon as it's no longer needed.
+static void hfdl_channel_process_frame(struct hfdl_channel *c, float complex *frame) {
+	struct block *block = &c->block;
+	uint64_t const *input_waits = &block->consumer.in->shared_buffer.cursors[block->consumer.id].waits;
+	uint32_t resampled_cnt = 0;
+	float complex r, s;
+	float complex symbols[3];
+	uint32_t symbols_produced = 0;
+	uint32_t bits = 0;
+	int32_t M1_match = -1;
+	float corr_A1 = 0.f;
+	float corr_A2 = 0.f;
+	float corr_M1 = 0.f;
+#ifdef AGC_DEBUG
+	float gain, rssi;
 #endif
-	struct shared_buffer *input = &block->consumer.in->shared_buffer;
+	static size_t const max_symbols_without_frame = 13 * SINGLE_SLOT_FRAME_LEN;
 	static struct timeval ts_correction = {
 		.tv_sec = 0,
 		.tv_usec = (PREKEY_LEN + 2 * A_LEN) * 1000000UL / HFDL_SYMBOL_RATE
 	};
 
-	while(true) {
-		pthread_barrier_wait(input->consumers_ready);
-		pthread_barrier_wait(input->data_ready);
-		if(block_connection_is_shutdown_signaled(block->consumer.in)) {
-			debug_print(D_MISC, "channel %d: Exiting (ordered shutdown)\n", c->chan_freq);
-			break;
+	block->stats.samples_processed += c->channelizer->ddc->input_size;
+	uint64_t const gap = block_connection_one2many_frame_gap(block->consumer.in, block->consumer.id);
+	if(UNLIKELY(gap > 0)) {
+		hfdl_channel_input_gap(c, gap);
+		block->stats.samples_skipped += gap;
+	}
+	if(++c->frames_reported == HFDL_STATS_INTERVAL) {
+		if(*input_waits != c->waits_reported) {
+			statsd_increment_per_channel_by(c->chan_freq, "channelizer.waits", *input_waits - c->waits_reported);
+			c->waits_reported = *input_waits;
 		}
+		c->frames_reported = 0;
+	}
 #ifdef DUMP_FFT
-		// XXX: Does not work now due to missing sample clock
-		//dumpfile_cf32_write_block(f_fft_out, input->buf, c->channelizer->ddc->fft_size);
+	// XXX: Does not work now due to missing sample clock
+	//dumpfile_cf32_write_block(c->f_fft_out, input->buf, c->channelizer->ddc->fft_size);
 #endif
-		// FIXME: pass c->channelizer pointer to this function
-		c->channelizer->shift_status = fastddc_inv_cc(input->buf, channelizer_output, c->channelizer->ddc,
-				c->channelizer->inv_plan, c->channelizer->filtertaps_fft, c->channelizer->shift_status);
-		msresamp_crcf_execute(c->resampler, channelizer_output, c->channelizer->shift_status.output_size,
-				resampled, &resampled_cnt);
-		if(resampled_cnt < 1) {
-			debug_print(D_DSP, "ERROR: resampled_cnt is 0\n");
-			continue;
-		}
+	// FIXME: pass c->channelizer pointer to this function
+	c->channelizer->shift_status = fastddc_inv_cc(frame, c->channelizer_output, c->channelizer->ddc,
+			c->channelizer->inv_plan, c->channelizer->filtertaps_fft, c->channelizer->shift_status);
+	block_connection_one2many_frame_release(block->consumer.in, block->consumer.id);
+	msresamp_crcf_execute(c->resampler, c->channelizer_output, c->channelizer->shift_status.output_size,
+			c->resampled, &resampled_cnt);
+	if(resampled_cnt < 1) {
+		debug_print(D_DSP, "ERROR: resampled_cnt is 0\n");
+		return;
+	}
 #ifdef CHAN_DEBUG
-		dumpfile_cf32_write_block(f_chan_out, c->sample_cnt, resampled, resampled_cnt);
+	dumpfile_cf32_write_block(c->f_chan_out, c->sample_cnt, c->resampled, resampled_cnt);
 #endif
-		for(size_t k = 0; k < resampled_cnt; k++, c->sample_cnt++) {
-			agc_crcf_execute(c->agc, resampled[k], &r);
+	for(size_t k = 0; k < resampled_cnt; k++, c->sample_cnt++) {
+		agc_crcf_execute(c->agc, c->resampled[k], &r);
 #ifdef AGC_DEBUG
-			gain = agc_crcf_get_gain(c->agc);
-			rssi = agc_crcf_get_rssi(c->agc);
-			dumpfile_rf32_write_value(f_agc_gain, c->sample_cnt, gain);
-			dumpfile_rf32_write_value(f_agc_rssi, c->sample_cnt, rssi);
-			dumpfile_cf32_write_value(f_agc_out, c->sample_cnt, r);
+		gain = agc_crcf_get_gain(c->agc);
+		rssi = agc_crcf_get_rssi(c->agc);
+		dumpfile_rf32_write_value(c->f_agc_gain, c->sample_cnt, gain);
+		dumpfile_rf32_write_value(c->f_agc_rssi, c->sample_cnt, rssi);
+		dumpfile_cf32_write_value(c->f_agc_out, c->sample_cnt, r);
 #endif
-			firfilt_crcf_push(c->mf, r);
-			firfilt_crcf_execute(c->mf, &s);
+		firfilt_crcf_push(c->mf, r);
+		firfilt_crcf_execute(c->mf, &s);
 #ifdef MF_DEBUG
-			dumpfile_cf32_write_value(f_mf_out, c->sample_cnt, s);
+		dumpfile_cf32_write_value(c->f_mf_out, c->sample_cnt, s);
 #endif
-			// update noise floor estimate - every 255 samples, only when we aren't inside a frame
-			if(c->fr_state == FRAMER_A1_SEARCH && (++noise_floor_sampling_clk & 0xFFu) == 0xFFu) {
-				c->noise_floor = 0.65f * c->noise_floor +
-					0.35f * fminf(c->noise_floor, agc_crcf_get_signal_level(c->agc)) + 1e-6f;
+		// update noise floor estimate - every 255 samples, only when we aren't inside a frame
+		if(c->fr_state == FRAMER_A1_SEARCH && (++c->noise_floor_sampling_clk & 0xFFu) == 0xFFu) {
+			c->noise_floor = 0.65f * c->noise_floor +
+				0.35f * fminf(c->noise_floor, agc_crcf_get_signal_level(c->agc)) + 1e-6f;
 #ifdef AGC_DEBUG
-				dumpfile_rf32_write_value(f_noise_floor, c->sample_cnt, c->noise_floor);
+			dumpfile_rf32_write_value(c->f_noise_floor, c->sample_cnt, c->noise_floor);
 #endif
+		}
+		symsync_crcf_execute(c->ss, &s, 1, symbols, &symbols_produced);
+		for(size_t i = 0; i < symbols_produced; i++, c->symsync_out_idx++) {
+			costas_cccf_step(c->loop);
+			costas_cccf_execute(c->loop, symbols[i], &r);
+			if(UNLIKELY(fabsf(c->loop->dphi) > 0.25f && c->fr_state == FRAMER_A1_SEARCH)) {
+				chan_debug("costas_dphi: %f, resetting control loops\n", c->loop->dphi);
+				costas_cccf_reset(c->loop);
+				symsync_crcf_reset(c->ss);
 			}
-			symsync_crcf_execute(c->ss, &s, 1, symbols, &symbols_produced);
-			for(size_t i = 0; i < symbols_produced; i++, c->symsync_out_idx++) {
-				costas_cccf_step(c->loop);
-				costas_cccf_execute(c->loop, symbols[i], &r);
-				if(UNLIKELY(fabsf(c->loop->dphi) > 0.25f && c->fr_state == FRAMER_A1_SEARCH)) {
-					chan_debug("costas_dphi: %f, resetting control loops\n", c->loop->dphi);
-					costas_cccf_reset(c->loop);
-					symsync_crcf_reset(c->ss);
-				}
 
-				eqlms_cccf_push(c->eq, r);
-				if(!(c->symsync_out_idx & 1)) {
-					continue;
-				}
+			eqlms_cccf_push(c->eq, r);
+			if(!(c->symsync_out_idx & 1)) {
+				continue;
+			}
 #ifdef SYMSYNC_DEBUG
-				dumpfile_cf32_write_value(f_symsync_out, c->sample_cnt, symbols[i]);
+			dumpfile_cf32_write_value(c->f_symsync_out, c->sample_cnt, symbols[i]);
 #endif
 #ifdef COSTAS_DEBUG
-				dumpfile_rf32_write_value(f_costas_dphi, c->sample_cnt, c->loop->dphi);
-				dumpfile_rf32_write_value(f_costas_err, c->sample_cnt, c->loop->err);
-				dumpfile_cf32_write_value(f_costas_out, c->sample_cnt, r);
+			dumpfile_rf32_write_value(c->f_costas_dphi, c->sample_cnt, c->loop->dphi);
+			dumpfile_rf32_write_value(c->f_costas_err, c->sample_cnt, c->loop->err);
+			dumpfile_cf32_write_value(c->f_costas_out, c->sample_cnt, r);
 #endif
-				eqlms_cccf_execute(c->eq, &s);
-				if(c->fr_state == FRAMER_EQ_TRAIN) {
-					eqlms_cccf_step(c->eq, T_seq[c->bitmask & 1][c->T_idx], s);
-					c->T_idx++;
-				}
+			eqlms_cccf_execute(c->eq, &s);
+			if(c->fr_state == FRAMER_EQ_TRAIN) {
+				eqlms_cccf_step(c->eq, T_seq[c->bitmask & 1][c->T_idx], s);
+				c->T_idx++;
+			}
 #ifdef EQ_DEBUG
-				dumpfile_cf32_write_value(f_eq_out, c->sample_cnt, s);
+			dumpfile_cf32_write_value(c->f_eq_out, c->sample_cnt, s);
 #endif
-				modem_demodulate(c->m[c->current_mod_arity], s, &bits);
-				costas_cccf_adjust(c->loop, modem_get_demodulator_phase_error(c->m[c->current_mod_arity]));
+			modem_demodulate(c->m[c->current_mod_arity], s, &bits);
+			costas_cccf_adjust(c->loop, modem_get_demodulator_phase_error(c->m[c->current_mod_arity]));
 #ifdef DUMP_CONST
-				if(c->fr_state >= FRAMER_EQ_TRAIN && Config.datadumps == true) {
-					fprintf(consts, "frame%lu(end+1,1)=%f+%f*i;\n", frame_id,
-							crealf(s), cimagf(s));
-				}
+			if(c->fr_state >= FRAMER_EQ_TRAIN && Config.datadumps == true) {
+				fprintf(c->consts, "frame%lu(end+1,1)=%f+%f*i;\n", c->frame_id,
+						crealf(s), cimagf(s));
+			}
 #endif
-				c->symbol_cnt++;
-				if(UNLIKELY(c->symbol_cnt >= max_symbols_without_frame && c->fr_state == FRAMER_A1_SEARCH)) {
-					chan_debug("Too long without a good frame (%" PRIu64 " symbols), resetting control loops\n",
-							c->symbol_cnt);
-					c->symbol_cnt = 0;
-					costas_cccf_reset(c->loop);
-					symsync_crcf_reset(c->ss);
-				}
+			c->symbol_cnt++;
+			if(UNLIKELY(c->symbol_cnt >= max_symbols_without_frame && c->fr_state == FRAMER_A1_SEARCH)) {
+				chan_debug("Too long without a good frame (%" PRIu64 " symbols), resetting control loops\n",
+						c->symbol_cnt);
+				c->symbol_cnt = 0;
+				costas_cccf_reset(c->loop);
+				symsync_crcf_reset(c->ss);
+			}
 
-				if(c->s_state == SAMPLER_EMIT_BITS) {
-					bits ^= c->bitmask;
-					for(uint32_t b = 0; b < c->current_mod_arity; b++, bits >>= 1) {
-						bsequence_push(c->bits, bits);
-					}
-				} else if(c->s_state == SAMPLER_EMIT_SYMBOLS) {
-					ASSERT(cbuffercf_space_available(c->current_buffer) != 0);
-					cbuffercf_push(c->current_buffer, s);
-				} else {    // SKIP
-							// NOOP
+			if(c->s_state == SAMPLER_EMIT_BITS) {
+				bits ^= c->bitmask;
+				for(uint32_t b = 0; b < c->current_mod_arity; b++, bits >>= 1) {
+					bsequence_push(c->bits, bits);
 				}
-				// Update signal level estimate - only when inside a frame
-				if(c->fr_state > FRAMER_A1_SEARCH) {
-					// Approximate averaging
-					c->signal_level = (c->signal_level * frame_symbol_cnt + agc_crcf_get_signal_level(c->agc)) / (frame_symbol_cnt + 1.0f);
-					frame_symbol_cnt += 1.0f;
+			} else if(c->s_state == SAMPLER_EMIT_SYMBOLS) {
+				ASSERT(cbuffercf_space_available(c->current_buffer) != 0);
+				cbuffercf_push(c->current_buffer, s);
+			} else {    // SKIP
+						// NOOP
+			}
+			// Update signal level estimate - only when inside a frame
+			if(c->fr_state > FRAMER_A1_SEARCH) {
+				// Approximate averaging
+				c->signal_level = (c->signal_level * c->frame_symbol_cnt + agc_crcf_get_signal_level(c->agc)) / (c->frame_symbol_cnt + 1.0f);
+				c->frame_symbol_cnt += 1.0f;
 #ifdef AGC_DEBUG
-					dumpfile_rf32_write_value(f_sig_level, c->sample_cnt, c->signal_level);
+				dumpfile_rf32_write_value(c->f_sig_level, c->sample_cnt, c->signal_level);
 #endif
-				}
-				if(c->symbols_wanted > 1) {
-					c->symbols_wanted--;
-					continue;
-				}
+			}
+			if(c->symbols_wanted > 1) {
+				c->symbols_wanted--;
+				continue;
+			}
 
-				switch(c->fr_state) {
-				case FRAMER_A1_SEARCH:
-					corr_A1 = 2.0f * (float)bsequence_correlate(A_bs, c->bits) / (float)A_LEN - 1.0f;
+			switch(c->fr_state) {
+			case FRAMER_A1_SEARCH:
+				corr_A1 = 2.0f * (float)bsequence_correlate(A_bs, c->bits) / (float)A_LEN - 1.0f;
 #ifdef CORR_DEBUG
-					dumpfile_rf32_write_value(f_corr_A1, c->sample_cnt, corr_A1);
+				dumpfile_rf32_write_value(c->f_corr_A1, c->sample_cnt, corr_A1);
 #endif
-					if(fabsf(corr_A1) > CORR_THRESHOLD_A1) {
-						STATS_UPDATE(S.A1_found++);
-						STATS_UPDATE(S.A1_corr_total += fabsf(corr_A1));
-						c->bitmask = corr_A1 > 0.f ? 0 : ~0;
-						c->signal_level = agc_crcf_get_signal_level(c->agc);
-						frame_symbol_cnt = 1.0f;
-						c->symbols_wanted = A_LEN;
-						c->search_retries = 0;
-						c->fr_state++;
+				if(fabsf(corr_A1) > CORR_THRESHOLD_A1) {
+					STATS_UPDATE(S.A1_found++);
+					STATS_UPDATE(S.A1_corr_total += fabsf(corr_A1));
+					c->bitmask = corr_A1 > 0.f ? 0 : ~0;
+					c->signal_level = agc_crcf_get_signal_level(c->agc);
+					c->frame_symbol_cnt = 1.0f;
+					c->symbols_wanted = A_LEN;
+					c->search_retries = 0;
+					c->fr_state++;
 #ifdef DUMP_CONST
-						frame_id = c->sample_cnt;
+					c->frame_id = c->sample_cnt;
 #endif
-					}
-					break;
-				case FRAMER_A2_SEARCH:
-					corr_A2 = 2.0f * (float)bsequence_correlate(A_bs, c->bits) / (float)A_LEN - 1.0f;
+				}
+				break;
+			case FRAMER_A2_SEARCH:
+				corr_A2 = 2.0f * (float)bsequence_correlate(A_bs, c->bits) / (float)A_LEN - 1.0f;
 #ifdef CORR_DEBUG
-					dumpfile_rf32_write_value(f_corr_A2, c->sample_cnt, corr_A2);
+				dumpfile_rf32_write_value(c->f_corr_A2, c->sample_cnt, corr_A2);
 #endif
-					if(fabsf(corr_A2) > CORR_THRESHOLD_A2) {
-						// Save the current timestamp and go back by the length
-						// of the prekey and two A sequences, so that the timestamp
-						// points at the start of the frame.
-						gettimeofday(&c->pdu_timestamp, NULL);
-						timersub(&c->pdu_timestamp, &ts_correction, &c->pdu_timestamp);
-						chan_debug("A2 sequence found at sample %" PRIu64 " (corr=%f retry=%d costas_dphi=%f)\n",
-								c->sample_cnt, corr_A2, c->search_retries, c->loop->dphi);
-						c->freq_err_hz = c->loop->dphi * HFDL_SYMBOL_RATE / (2.0 * M_PI);
-						STATS_UPDATE(S.A2_found++);
-						STATS_UPDATE(S.A2_corr_total += fabsf(corr_A2));
-						c->symbols_wanted = M1_LEN;
-						c->search_retries = 0;
-						c->fr_state = FRAMER_M1_SEARCH;
-						statsd_increment_per_channel(c->chan_freq, "demod.preamble.A2_found");
-					} else if(++c->search_retries >= MAX_SEARCH_RETRIES) {
-						framer_reset(c);
-					}
-					break;
-				case FRAMER_M1_SEARCH:
-					M1_match = match_sequence(M1, M_SHIFT_CNT, c->bits, &corr_M1);
-					if(fabsf(corr_M1) > CORR_THRESHOLD_M1) {
-						chan_debug("M1 match at sample %" PRIu64 ": %d (corr=%f, costas_dphi=%f)\n",
-								c->sample_cnt, M1_match, corr_M1, c->loop->dphi);
-						statsd_increment_per_channel(c->chan_freq, "demod.preamble.M1_found");
-						STATS_UPDATE(S.M1_found++);
-						STATS_UPDATE(S.M1_corr_total += fabsf(corr_M1));
-						c->data_segment_cnt = hfdl_frame_params[M1_match].data_segment_cnt;
-						c->data_mod_arity = hfdl_frame_params[M1_match].scheme;
-						c->M1 = M1_match;
-						c->symbols_wanted = M2_LEN;
-						c->search_retries = 0;
-						c->fr_state = FRAMER_M2_SKIP;
-						c->s_state = SAMPLER_SKIP;
-					} else {
-						chan_debug("M1 sequence unreliable (val=%d corr=%f)\n", M1_match, corr_M1);
-						statsd_increment_per_channel(c->chan_freq, "demod.preamble.errors.M1_not_found");
-						framer_reset(c);
-					}
-					break;
-				case FRAMER_M2_SKIP:
-					cbuffercf_reset(c->training_symbols);
-					c->symbols_wanted = T_LEN;
-					c->eq_train_seq_cnt = 9;
-					c->fr_state = FRAMER_EQ_TRAIN;
-					c->s_state = SAMPLER_EMIT_SYMBOLS;
+				if(fabsf(corr_A2) > CORR_THRESHOLD_A2) {
+					// Save the current timestamp and go back by the length
+					// of the prekey and two A sequences, so that the timestamp
+					// points at the start of the frame. If the time base of the
+					// input is known, compute the timestamp from the sample count,
+					// otherwise use current time.
+					sample_clock_get_time(&block->clock, c->sample_cnt,
+							HFDL_SYMBOL_RATE * SPS, &c->pdu_timestamp);
+					timersub(&c->pdu_timestamp, &ts_correction, &c->pdu_timestamp);
+					chan_debug("A2 sequence found at sample %" PRIu64 " (corr=%f retry=%d costas_dphi=%f)\n",
+							c->sample_cnt, corr_A2, c->search_retries, c->loop->dphi);
+					c->freq_err_hz = c->loop->dphi * HFDL_SYMBOL_RATE / (2.0 * M_PI);
+					STATS_UPDATE(S.A2_found++);
+					STATS_UPDATE(S.A2_corr_total += fabsf(corr_A2));
+					c->symbols_wanted = M1_LEN;
+					c->search_retries = 0;
+					c->fr_state = FRAMER_M1_SEARCH;
+					statsd_increment_per_channel(c->chan_freq, "demod.preamble.A2_found");
+				} else if(++c->search_retries >= MAX_SEARCH_RETRIES) {
+					framer_reset(c);
+				}
+				break;
+			case FRAMER_M1_SEARCH:
+				M1_match = match_sequence(M1, M_SHIFT_CNT, c->bits, &corr_M1);
+				if(fabsf(corr_M1) > CORR_THRESHOLD_M1) {
+					chan_debug("M1 match at sample %" PRIu64 ": %d (corr=%f, costas_dphi=%f)\n",
+							c->sample_cnt, M1_match, corr_M1, c->loop->dphi);
+					statsd_increment_per_channel(c->chan_freq, "demod.preamble.M1_found");
+					STATS_UPDATE(S.M1_found++);
+					STATS_UPDATE(S.M1_corr_total += fabsf(corr_M1));
+					c->data_segment_cnt = hfdl_frame_params[M1_match].data_segment_cnt;
+					c->data_mod_arity = hfdl_frame_params[M1_match].scheme;
+					c->M1 = M1_match;
+					c->symbols_wanted = M2_LEN;
+					c->search_retries = 0;
+					c->fr_state = FRAMER_M2_SKIP;
+					c->s_state = SAMPLER_SKIP;
+				} else {
+					chan_debug("M1 sequence unreliable (val=%d corr=%f)\n", M1_match, corr_M1);
+					statsd_increment_per_channel(c->chan_freq, "demod.preamble.errors.M1_not_found");
+					framer_reset(c);
+				}
+				break;
+			case FRAMER_M2_SKIP:
+				cbuffercf_reset(c->training_symbols);
+				c->symbols_wanted = T_LEN;
+				c->eq_train_seq_cnt = 9;
+				c->fr_state = FRAMER_EQ_TRAIN;
+				c->s_state = SAMPLER_EMIT_SYMBOLS;
 #ifdef DUMP_CONST
-					if(Config.datadumps == true) {
-						fprintf(consts, "frame%lu = [];\n", frame_id);
-					}
+				if(Config.datadumps == true) {
+					fprintf(c->consts, "frame%lu = [];\n", c->frame_id);
+				}
 #endif
-					break;
-				case FRAMER_EQ_TRAIN:
-					ASSERT(cbuffercf_size(c->training_symbols) == T_LEN);
-					compute_train_bit_error_cnt(c);
-					cbuffercf_reset(c->training_symbols);
-					if(c->eq_train_seq_cnt > 1) {               // next frame is training sequence
-						c->eq_train_seq_cnt--;
-						c->symbols_wanted = T_LEN;
-						c->T_idx = 0;
-					} else if(c->data_segment_cnt > 0) {        // next frame is data frame
-						c->symbols_wanted = DATA_FRAME_LEN / 2;
-						c->fr_state = FRAMER_DATA_1;
-						c->current_mod_arity = c->data_mod_arity;
-						c->current_buffer = c->data_symbols;
-					} else {                                    // end of frame
-						chan_debug("train_bits_bad: %d/%d (%f%%)\n",
-								c->train_bits_bad, c->train_bits_total,
-								(float)c->train_bits_bad / (float)c->train_bits_total * 100.f);
-						decode_user_data(c);
-						framer_reset(c);
-						c->symbol_cnt = 0;
-					}
-					break;
-				case FRAMER_DATA_1:
-					c->symbols_wanted = DATA_FRAME_LEN / 2;
-					c->fr_state = FRAMER_DATA_2;
-					break;
-				case FRAMER_DATA_2:
-					c->data_segment_cnt--;
-					c->current_mod_arity = M_BPSK;
-					c->current_buffer = c->training_symbols;
-					c->fr_state = FRAMER_EQ_TRAIN;
-					c->eq_train_seq_cnt = 1;
+				break;
+			case FRAMER_EQ_TRAIN:
+				ASSERT(cbuffercf_size(c->training_symbols) == T_LEN);
+				compute_train_bit_error_cnt(c);
+				cbuffercf_reset(c->training_symbols);
+				if(c->eq_train_seq_cnt > 1) {               // next frame is training sequence
+					c->eq_train_seq_cnt--;
 					c->symbols_wanted = T_LEN;
 					c->T_idx = 0;
-					break;
+				} else if(c->data_segment_cnt > 0) {        // next frame is data frame
+					c->symbols_wanted = DATA_FRAME_LEN / 2;
+					c->fr_state = FRAMER_DATA_1;
+					c->current_mod_arity = c->data_mod_arity;
+					c->current_buffer = c->data_symbols;
+				} else {                                    // end of frame
+					chan_debug("train_bits_bad: %d/%d (%f%%)\n",
+							c->train_bits_bad, c->train_bits_total,
+							(float)c->train_bits_bad / (float)c->train_bits_total * 100.f);
+					decode_user_data(c);
+					framer_reset(c);
+					c->symbol_cnt = 0;
 				}
+				break;
+			case FRAMER_DATA_1:
+				c->symbols_wanted = DATA_FRAME_LEN / 2;
+				c->fr_state = FRAMER_DATA_2;
+				break;
+			case FRAMER_DATA_2:
+				c->data_segment_cnt--;
+				c->current_mod_arity = M_BPSK;
+				c->current_buffer = c->training_symbols;
+				c->fr_state = FRAMER_EQ_TRAIN;
+				c->eq_train_seq_cnt = 1;
+				c->symbols_wanted = T_LEN;
+				c->T_idx = 0;
+				break;
 			}
 		}
 	}
-#ifdef COSTAS_DEBUG
-	dumpfile_rf32_destroy(f_costas_dphi);
-	dumpfile_rf32_destroy(f_costas_err);
-	dumpfile_cf32_destroy(f_costas_out);
-#endif
-#ifdef SYMSYNC_DEBUG
-	dumpfile_cf32_destroy(f_symsync_out);
-#endif
-#ifdef CHAN_DEBUG
-	dumpfile_cf32_destroy(f_chan_out);
-#endif
-#ifdef MF_DEBUG
-	dumpfile_cf32_destroy(f_mf_out);
-#endif
-#ifdef AGC_DEBUG
-	dumpfile_cf32_destroy(f_agc_out);
-	dumpfile_rf32_destroy(f_agc_gain);
-	dumpfile_rf32_destroy(f_agc_rssi);
-	dumpfile_rf32_destroy(f_sig_level);
-	dumpfile_rf32_destroy(f_noise_floor);
-#endif
-#ifdef EQ_DEBUG
-	dumpfile_cf32_destroy(f_eq_out);
-#endif
-#ifdef CORR_DEBUG
-	dumpfile_rf32_destroy(f_corr_A1);
-	dumpfile_rf32_destroy(f_corr_A2);
-#endif
-#ifdef DUMP_CONST
-	if(Config.datadumps == true) {
-		fclose(consts);
+}
+
+static void *hfdl_decoder_thread(void *ctx) {
+	ASSERT(ctx != NULL);
+	struct block *block = ctx;
+	struct hfdl_channel *c = container_of(block, struct hfdl_channel, block);
+
+	while(true) {
+		float complex *frame = block_connection_one2many_frame_get(block->consumer.in, block->consumer.id);
+		if(frame == NULL) {
+			debug_print(D_MISC, "channel %d: Exiting (ordered shutdown)\n", c->chan_freq);
+			break;
+		}
+		hfdl_channel_process_frame(c, frame);
 	}
-#endif
-#ifdef DUMP_FFT
-	dumpfile_cf32_destroy(f_fft_out);
-#endif
-	XFREE(channelizer_output);
-	XFREE(resampled);
+	block_stats_update_cpu_time(block);
 	block->running = false;
 	return NULL;
 }
 
+// Worker pool variant of hfdl_decoder_thread.
+// Processes all frames available at the moment without waiting for more.
+static bool hfdl_decoder_task(struct block *block) {
+	struct hfdl_channel *c = container_of(block, struct hfdl_channel, block);
+	while(true) {
+		// Read the shutdown flag first, so that no frame published
+		// before the shutdown is missed
+		bool shutdown = block_connection_is_shutdown_signaled(block->consumer.in);
+		float complex *frame = block_connection_one2many_frame_try_get(block->consumer.in, block->consumer.id);
+		if(frame == NULL) {
+			if(shutdown) {
+				debug_print(D_MISC, "channel %d: Exiting (ordered shutdown)\n", c->chan_freq);
+				return false;
+			}
+			return true;
+		}
+		hfdl_channel_process_frame(c, frame);
+	}
+}
+
 static int32_t match_sequence(bsequence *templates, size_t template_cnt, bsequence bits, float *result_corr) {
 	float max_corr = 0.f;
 	int32_t max_idx = -1;
@@ -1032,6 +1158,7 @@ static void dispatch_pdu(struct hfdl_channel *c, uint8_t *buf, size_t len) {
 	struct hfdl_pdu_metadata *hm = container_of(m, struct hfdl_pdu_metadata, metadata);
 	hm->version = 1;
 	hm->freq = c->chan_freq;
+	hm->segment = c->segment;
 	hm->freq_err_hz = c->freq_err_hz;
 	hm->rssi = LEVEL_TO_DB(c->signal_level);
 	hm->noise_floor = LEVEL_TO_DB(c->noise_floor);
@@ -10,5 +10,7 @@
 void hfdl_init_globals(void);
 struct block *hfdl_channel_create(int32_t sample_rate, int32_t pre_decimation_rate,
 		float transition_bw, int32_t centerfreq, int32_t frequency);
+void hfdl_channel_set_segment(struct block *channel_block, int32_t segment);
+int64_t hfdl_segment_overlap(int32_t sample_rate);
 void hfdl_channel_destroy(struct block *channel_block);
 void hfdl_print_summary(void);
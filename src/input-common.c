@@ -4,14 +4,19 @@
 #include "config.h"
 #include "util.h"               // ASSERT, XCALLOC, NEW, container_of
 #include "input-common.h"
-#include "input-helpers.h"      // get_sample_converter
+#include "input-helpers.h"      // get_sample_converter, sample_lut_init
+#include "input-recorder.h"     // recorder_create, recorder_destroy
 #include "input-file.h"         // file_input_vtable
+#include "input-net.h"          // net_input_vtable
 #ifdef WITH_SOAPYSDR
 #include "input-soapysdr.h"     // soapysdr_input_vtable
 #endif
 
 static struct input_vtable *input_vtables[] = {
 	[INPUT_TYPE_FILE] = &file_input_vtable,
+	[INPUT_TYPE_RTLTCP] = &net_input_vtable,
+	[INPUT_TYPE_TCP] = &net_input_vtable,
+	[INPUT_TYPE_UDP] = &net_input_vtable,
 #ifdef WITH_SOAPYSDR
 	[INPUT_TYPE_SOAPYSDR] = &soapysdr_input_vtable,
 #endif
@@ -31,6 +36,7 @@ struct input_cfg *input_cfg_create() {
 	cfg->centerfreq= -1;
 	cfg->sample_rate = -1;
 	cfg->read_buffer_size = -1;
+	cfg->overflow_policy = -1;
 	cfg->sfmt = SFMT_UNDEF;
 	cfg->gain = AUTO_GAIN;
 	return cfg;
@@ -57,6 +63,7 @@ struct block *input_create(struct input_cfg *cfg) {
 	input->block.producer = producer;
 	input->block.consumer = consumer;
 	input->block.thread_routine = vtable->rx_thread_routine;
+	input->block.thread_class = THREAD_CLASS_INPUT;
 	input->config = cfg;
 	input->vtable = vtable;
 	return &input->block;
@@ -81,8 +88,16 @@ int32_t input_init(struct block *block) {
 		ret = -1;
 		goto end;
 	}
+	sample_lut_init(input);
 	// TODO: Lookup converters of other, non-native formats supported by the device
 
+	if(input->config->record != NULL) {
+		if((input->recorder = recorder_create(input->config->record, input)) == NULL) {
+			ret = -1;
+			goto end;
+		}
+	}
+
 end:
 	return ret;
 }
@@ -91,6 +106,8 @@ void input_destroy(struct block *block) {
 	if(block != NULL) {
 		struct input *input = container_of(block, struct input, block);
 		ASSERT(input != NULL);
+		recorder_destroy(input->recorder);
+		input->recorder = NULL;
 		if(input->vtable != NULL && input->vtable->destroy != NULL) {
 			input->vtable->destroy(input);
 		}
@@ -11,6 +11,9 @@ typedef enum {
 	INPUT_TYPE_SOAPYSDR,
 #endif
 	INPUT_TYPE_FILE,
+	INPUT_TYPE_RTLTCP,
+	INPUT_TYPE_TCP,
+	INPUT_TYPE_UDP,
 	INPUT_TYPE_MAX
 } input_type;
 
@@ -19,6 +22,9 @@ typedef enum {
 	SFMT_CU8,
 	SFMT_CS16,
 	SFMT_CF32,
+	SFMT_CS8,
+	SFMT_CS12,
+	SFMT_CF16,
 	SFMT_MAX
 } sample_format;
 
@@ -29,17 +35,20 @@ struct input_cfg {
 	char *gain_elements;
 	char *antenna;
 	char *device_settings;
+	char *record;                   // recording tap parameters (NULL = disabled)
 	double gain;
 	double correction;
 	int32_t sample_rate;
 	int32_t centerfreq;
 	int32_t freq_offset;
 	int32_t read_buffer_size;
+	int32_t overflow_policy;        // enum block_overflow_policy, -1 = default for the input type
 	input_type type;
 	sample_format sfmt;
 };
 
 struct input;   // forward declaration
+struct recorder;
 
 struct input_vtable {
 	struct input *(*create)(struct input_cfg *);
@@ -55,9 +64,10 @@ struct input {
 	struct input_vtable *vtable;
 	struct input_cfg *config;
 	convert_sample_buffer_fun convert_sample_buffer;
-	size_t overflow_count;          // TODO: replace with statsd
+	struct recorder *recorder;      // NULL = not recording
 	float full_scale;
 	int32_t bytes_per_sample;
+	float sample_lut[256];          // 8-bit sample value to float lookup table
 };
 
 struct input_cfg *input_cfg_create();
@@ -0,0 +1,409 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>              // FILE, fopen, fread, fseeko, rewind
+#include <stdlib.h>             // strtod
+#include <string.h>             // memcmp, strlen, strchr, strncmp, strspn
+#include <errno.h>              // errno
+#include <time.h>               // struct tm, timegm
+#include <sys/time.h>           // struct timeval
+#include <sys/stat.h>           // stat, S_ISREG
+#include "input-common.h"       // sample_format
+#include "input-file-format.h"
+#include "util.h"               // ASSERT, XCALLOC, XFREE, debug_print
+
+// Max size of SigMF metadata file that we are willing to read
+#define SIGMF_META_LEN_MAX (1024 * 1024)
+
+static uint16_t get_u16le(uint8_t const *buf) {
+	return buf[0] | buf[1] << 8;
+}
+
+static uint32_t get_u32le(uint8_t const *buf) {
+	return (uint32_t)buf[0] | (uint32_t)buf[1] << 8 | (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 24;
+}
+
+static uint64_t get_u64le(uint8_t const *buf) {
+	return (uint64_t)get_u32le(buf) | (uint64_t)get_u32le(buf + 4) << 32;
+}
+
+static bool ends_with(char const *str, char const *suffix) {
+	size_t len = strlen(str), slen = strlen(suffix);
+	return len >= slen && strcmp(str + len - slen, suffix) == 0;
+}
+
+/**********************************
+ * WAV / RF64
+ **********************************/
+
+#define WAVE_FORMAT_PCM         0x0001
+#define WAVE_FORMAT_IEEE_FLOAT  0x0003
+#define WAVE_FORMAT_EXTENSIBLE  0xFFFE
+
+static sample_format wav_sample_format(uint16_t format_tag, uint16_t bits_per_sample) {
+	if(format_tag == WAVE_FORMAT_PCM && bits_per_sample == 8) {
+		return SFMT_CU8;
+	} else if(format_tag == WAVE_FORMAT_PCM && bits_per_sample == 16) {
+		return SFMT_CS16;
+	} else if(format_tag == WAVE_FORMAT_IEEE_FLOAT && bits_per_sample == 32) {
+		return SFMT_CF32;
+	} else if(format_tag == WAVE_FORMAT_IEEE_FLOAT && bits_per_sample == 16) {
+		return SFMT_CF16;
+	}
+	return SFMT_UNDEF;
+}
+
+// Reads 'auxi' chunk, which is written by SpectraVue, SDR#, HDSDR and others.
+// It starts with two Windows SYSTEMTIME structures (recording start and stop time)
+// followed by the center frequency.
+static void wav_parse_auxi(uint8_t const *buf, uint32_t len, struct iq_file_format *result) {
+	if(len < 36) {
+		return;
+	}
+	struct tm tm = {
+		.tm_year = get_u16le(buf) - 1900,
+		.tm_mon = get_u16le(buf + 2) - 1,
+		.tm_mday = get_u16le(buf + 6),
+		.tm_hour = get_u16le(buf + 8),
+		.tm_min = get_u16le(buf + 10),
+		.tm_sec = get_u16le(buf + 12)
+	};
+	uint16_t msec = get_u16le(buf + 14);
+	if(tm.tm_year > 70 && tm.tm_mon >= 0 && tm.tm_mday > 0) {
+		result->start_time.tv_sec = timegm(&tm);
+		result->start_time.tv_usec = msec * 1000;
+		result->start_time_valid = true;
+	}
+	uint32_t centerfreq = get_u32le(buf + 32);
+	if(centerfreq > 0 && centerfreq <= INT32_MAX) {
+		result->centerfreq = centerfreq;
+	}
+}
+
+static int32_t wav_probe(FILE *f, char const *path, struct iq_file_format *result) {
+	uint8_t hdr[12];
+	if(fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) {
+		return 0;
+	}
+	bool is_rf64 = false;
+	if(memcmp(hdr, "RF64", 4) == 0 || memcmp(hdr, "BW64", 4) == 0) {
+		is_rf64 = true;
+	} else if(memcmp(hdr, "RIFF", 4) != 0) {
+		return 0;
+	}
+	if(memcmp(hdr + 8, "WAVE", 4) != 0) {
+		return 0;
+	}
+	result->container = is_rf64 ? "RF64" : "WAV";
+
+	uint64_t ds64_data_size = 0;
+	uint16_t format_tag = 0, channels = 0, bits_per_sample = 0;
+	uint32_t sample_rate = 0;
+	bool fmt_found = false;
+	uint8_t chunk_hdr[8];
+	uint8_t buf[64];
+	while(fread(chunk_hdr, 1, sizeof(chunk_hdr), f) == sizeof(chunk_hdr)) {
+		uint32_t chunk_len = get_u32le(chunk_hdr + 4);
+		off_t chunk_start = ftello(f);
+		uint32_t to_read = chunk_len < sizeof(buf) ? chunk_len : sizeof(buf);
+		debug_print(D_SDR, "%s: chunk '%.4s' len %u at offset %jd\n",
+				path, chunk_hdr, chunk_len, (intmax_t)chunk_start);
+		if(memcmp(chunk_hdr, "data", 4) == 0) {
+			if(!fmt_found) {
+				fprintf(stderr, "%s: data chunk found before fmt chunk\n", path);
+				return -1;
+			}
+			result->data_offset = chunk_start;
+			result->data_len = (is_rf64 && chunk_len == UINT32_MAX) ? (off_t)ds64_data_size : (off_t)chunk_len;
+			break;
+		}
+		if(fread(buf, 1, to_read, f) != to_read) {
+			break;
+		}
+		if(memcmp(chunk_hdr, "ds64", 4) == 0 && to_read >= 16) {
+			ds64_data_size = get_u64le(buf + 8);
+		} else if(memcmp(chunk_hdr, "fmt ", 4) == 0 && to_read >= 16) {
+			format_tag = get_u16le(buf);
+			channels = get_u16le(buf + 2);
+			sample_rate = get_u32le(buf + 4);
+			bits_per_sample = get_u16le(buf + 14);
+			if(format_tag == WAVE_FORMAT_EXTENSIBLE && to_read >= 26) {
+				// First two bytes of the subformat GUID contain the actual format tag
+				format_tag = get_u16le(buf + 24);
+			}
+			fmt_found = true;
+		} else if(memcmp(chunk_hdr, "auxi", 4) == 0) {
+			wav_parse_auxi(buf, to_read, result);
+		}
+		// chunks are padded to an even length
+		if(fseeko(f, chunk_start + chunk_len + (chunk_len & 1), SEEK_SET) != 0) {
+			break;
+		}
+	}
+	if(result->data_offset == 0) {
+		fprintf(stderr, "%s: no data chunk found\n", path);
+		return -1;
+	}
+	if(channels != 2) {
+		fprintf(stderr, "%s: unsupported number of channels: %u (I/Q recordings must have 2 channels)\n",
+				path, channels);
+		return -1;
+	}
+	result->sfmt = wav_sample_format(format_tag, bits_per_sample);
+	if(result->sfmt == SFMT_UNDEF) {
+		fprintf(stderr, "%s: unsupported sample format (format tag %u, %u bits per sample)\n",
+				path, format_tag, bits_per_sample);
+		return -1;
+	}
+	if(sample_rate > 0 && sample_rate <= INT32_MAX) {
+		result->sample_rate = sample_rate;
+	}
+	return 1;
+}
+
+/**********************************
+ * SigMF
+ **********************************/
+
+// A minimal scanner which looks up the first occurrence of the given key
+// and returns a pointer to its value. Good enough for reading a couple of
+// scalar fields from SigMF metadata, which have unique, namespaced names.
+static char const *json_find_value(char const *json, char const *key) {
+	size_t keylen = strlen(key);
+	for(char const *p = json; (p = strchr(p, '"')) != NULL; p++) {
+		if(strncmp(p + 1, key, keylen) == 0 && p[keylen + 1] == '"') {
+			p += keylen + 2;
+			p += strspn(p, " \t\r\n");
+			if(*p != ':') {
+				continue;
+			}
+			p++;
+			return p + strspn(p, " \t\r\n");
+		}
+	}
+	return NULL;
+}
+
+static bool json_get_string(char const *json, char const *key, char *buf, size_t buflen) {
+	char const *v = json_find_value(json, key);
+	if(v == NULL || *v != '"') {
+		return false;
+	}
+	v++;
+	size_t len = strcspn(v, "\"");
+	if(v[len] != '"' || len >= buflen) {
+		return false;
+	}
+	memcpy(buf, v, len);
+	buf[len] = '\0';
+	return true;
+}
+
+static bool json_get_double(char const *json, char const *key, double *result) {
+	char const *v = json_find_value(json, key);
+	if(v == NULL) {
+		return false;
+	}
+	char *endptr = NULL;
+	errno = 0;
+	double d = strtod(v, &endptr);
+	if(endptr == v || errno != 0) {
+		return false;
+	}
+	*result = d;
+	return true;
+}
+
+// Parses ISO 8601 UTC timestamp (as used by SigMF), eg. 2022-03-16T12:34:56.789Z
+static bool parse_iso8601_utc(char const *str, struct timeval *result) {
+	struct tm tm = {0};
+	int32_t consumed = 0;
+	if(sscanf(str, "%d-%d-%dT%d:%d:%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+				&tm.tm_hour, &tm.tm_min, &tm.tm_sec, &consumed) != 6) {
+		return false;
+	}
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	double frac = 0.0;
+	char const *p = str + consumed;
+	if(*p == '.') {
+		char *endptr = NULL;
+		frac = strtod(p, &endptr);
+		p = endptr;
+	}
+	if(*p != 'Z') {
+		return false;
+	}
+	result->tv_sec = timegm(&tm);
+	result->tv_usec = frac * 1e6;
+	return true;
+}
+
+static struct {
+	char const *name;
+	sample_format sfmt;
+} const sigmf_datatypes[] = {
+	{ .name = "cu8",     .sfmt = SFMT_CU8 },
+	{ .name = "ci16_le", .sfmt = SFMT_CS16 },
+	{ .name = "ci8",     .sfmt = SFMT_CS8 },
+	{ .name = "cf16_le", .sfmt = SFMT_CF16 },
+	{ .name = "cf32_le", .sfmt = SFMT_CF32 },
+	{ .name = NULL,      .sfmt = SFMT_UNDEF }
+};
+
+static sample_format sigmf_sample_format(char const *datatype) {
+	for(int32_t i = 0; sigmf_datatypes[i].name != NULL; i++) {
+		if(strcmp(datatype, sigmf_datatypes[i].name) == 0) {
+			return sigmf_datatypes[i].sfmt;
+		}
+	}
+	return SFMT_UNDEF;
+}
+
+// Returns SigMF datatype name of the given sample format
+// or NULL if the format can't be represented in SigMF
+char const *sigmf_datatype_name(sample_format sfmt) {
+	for(int32_t i = 0; sigmf_datatypes[i].name != NULL; i++) {
+		if(sigmf_datatypes[i].sfmt == sfmt) {
+			return sigmf_datatypes[i].name;
+		}
+	}
+	return NULL;
+}
+
+static int32_t sigmf_probe(char const *path, struct iq_file_format *result) {
+	// Accept path to the recording given in any of the following ways:
+	// foo.sigmf-meta, foo.sigmf-data or foo
+	char const *suffixes[] = { ".sigmf-meta", ".sigmf-data", NULL };
+	size_t baselen = strlen(path);
+	for(int32_t i = 0; suffixes[i] != NULL; i++) {
+		if(ends_with(path, suffixes[i])) {
+			baselen -= strlen(suffixes[i]);
+			break;
+		}
+	}
+	char meta_path[baselen + sizeof(".sigmf-meta")];
+	snprintf(meta_path, sizeof(meta_path), "%.*s.sigmf-meta", (int)baselen, path);
+	FILE *f = fopen(meta_path, "r");
+	if(f == NULL) {
+		if(ends_with(path, ".sigmf-meta") || ends_with(path, ".sigmf-data")) {
+			fprintf(stderr, "%s: could not open SigMF metadata file: %s\n", meta_path, strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
+	result->container = "SigMF";
+	int32_t ret = -1;
+	char *json = XCALLOC(SIGMF_META_LEN_MAX + 1, sizeof(char));
+	size_t len = fread(json, 1, SIGMF_META_LEN_MAX, f);
+	json[len] = '\0';
+
+	char buf[64];
+	if(json_get_string(json, "core:datatype", buf, sizeof(buf)) == false) {
+		fprintf(stderr, "%s: core:datatype not found\n", meta_path);
+		goto end;
+	}
+	if((result->sfmt = sigmf_sample_format(buf)) == SFMT_UNDEF) {
+		fprintf(stderr, "%s: unsupported data type %s\n", meta_path, buf);
+		goto end;
+	}
+	double d;
+	if(json_get_double(json, "core:sample_rate", &d) && d > 0.0 && d <= INT32_MAX) {
+		result->sample_rate = (int32_t)d;
+	}
+	if(json_get_double(json, "core:frequency", &d) && d > 0.0 && d <= INT32_MAX) {
+		result->centerfreq = (int32_t)d;
+	}
+	if(json_get_string(json, "core:datetime", buf, sizeof(buf))) {
+		if(parse_iso8601_utc(buf, &result->start_time)) {
+			result->start_time_valid = true;
+		} else {
+			fprintf(stderr, "%s: could not parse core:datetime value '%s', ignoring\n", meta_path, buf);
+		}
+	}
+	size_t data_path_len = baselen + sizeof(".sigmf-data");
+	result->data_path = XCALLOC(data_path_len, sizeof(char));
+	snprintf(result->data_path, data_path_len, "%.*s.sigmf-data", (int)baselen, path);
+	ret = 1;
+end:
+	XFREE(json);
+	fclose(f);
+	return ret;
+}
+
+/**********************************
+ * Compressed files
+ **********************************/
+
+#define ZSTD_FRAME_MAGIC 0xFD2FB528U
+
+// Only raw sample data is supported in compressed files,
+// container headers are not looked for.
+static int32_t zstd_probe(FILE *f, struct iq_file_format *result) {
+	uint8_t buf[4];
+	if(fread(buf, 1, sizeof(buf), f) != sizeof(buf) || get_u32le(buf) != ZSTD_FRAME_MAGIC) {
+		rewind(f);
+		return 0;
+	}
+	result->container = "zstd-compressed raw";
+	result->compression = IQ_FILE_COMPRESSION_ZSTD;
+	return 1;
+}
+
+/**********************************
+ * Public routines
+ **********************************/
+
+// Sets the properties of a headerless file with nothing known about its contents
+void iq_file_format_init(struct iq_file_format *fmt) {
+	ASSERT(fmt != NULL);
+	*fmt = (struct iq_file_format){
+		.container = "raw",
+		.data_path = NULL,
+		.data_offset = 0,
+		.data_len = -1,
+		.sfmt = SFMT_UNDEF,
+		.sample_rate = -1,
+		.centerfreq = -1,
+		.start_time_valid = false,
+		.compression = IQ_FILE_COMPRESSION_NONE
+	};
+}
+
+// Detects the container format of the given I/Q recording and reads
+// its properties. Headerless files are reported as "raw".
+// Returns 0 on success, -1 on error (unreadable or malformed file).
+int32_t iq_file_format_probe(char const *path, struct iq_file_format *result) {
+	ASSERT(path != NULL);
+	ASSERT(result != NULL);
+	iq_file_format_init(result);
+	int32_t ret = sigmf_probe(path, result);
+	if(ret != 0) {
+		return ret < 0 ? -1 : 0;
+	}
+	// Reading headers from pipes, FIFOs or devices would consume
+	// sample data, so look only into regular files
+	struct stat st;
+	if(stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+		// Let the caller report the error, if any
+		return 0;
+	}
+	FILE *f = fopen(path, "rb");
+	if(f == NULL) {
+		// Let the caller report the error
+		return 0;
+	}
+	if(zstd_probe(f, result) == 1) {
+		fclose(f);
+		return 0;
+	}
+	ret = wav_probe(f, path, result);
+	fclose(f);
+	return ret < 0 ? -1 : 0;
+}
+
+void iq_file_format_cleanup(struct iq_file_format *fmt) {
+	if(fmt != NULL) {
+		XFREE(fmt->data_path);
+	}
+}
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>          // off_t
+#include <sys/time.h>           // struct timeval
+#include "input-common.h"       // sample_format
+
+enum iq_file_compression {
+	IQ_FILE_COMPRESSION_NONE,
+	IQ_FILE_COMPRESSION_ZSTD
+};
+
+// Properties of an I/Q recording, as read from its container format
+struct iq_file_format {
+	char const *container;      // container format name
+	char *data_path;            // path of the sample data file (NULL = same as input path)
+	off_t data_offset;          // where the sample data starts
+	off_t data_len;             // sample data length in bytes (-1 = up to the end of file)
+	sample_format sfmt;         // SFMT_UNDEF = unknown
+	int32_t sample_rate;        // -1 = unknown
+	int32_t centerfreq;         // -1 = unknown
+	struct timeval start_time;  // timestamp of the first sample
+	bool start_time_valid;
+	enum iq_file_compression compression;
+};
+
+void iq_file_format_init(struct iq_file_format *fmt);
+int32_t iq_file_format_probe(char const *path, struct iq_file_format *result);
+void iq_file_format_cleanup(struct iq_file_format *fmt);
+char const *sigmf_datatype_name(sample_format sfmt);
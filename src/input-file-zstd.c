@@ -0,0 +1,198 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>              // fread, fprintf
+#include <string.h>             // strerror
+#include <inttypes.h>           // PRIu64
+#include <pthread.h>            // pthread_*
+#include <zstd.h>               // ZSTD_*
+#include "input-file-zstd.h"
+#include "util.h"               // debug_print, ASSERT, NEW, XCALLOC, XFREE
+#include "thread-sched.h"       // thread_sched_create
+
+// Decompressed data is passed to the reader in blocks of (approximately)
+// this size. The decompression thread may run ahead of the reader by
+// ZSTD_READER_BLOCK_CNT-1 blocks.
+#define ZSTD_READER_BLOCK_SIZE (4U * 1024U * 1024U)
+#define ZSTD_READER_BLOCK_CNT 8
+
+struct zstd_block {
+	uint8_t *buf;
+	size_t len;                 // length of valid data in buf
+	bool eof;                   // last block in the stream
+};
+
+struct zstd_reader {
+	FILE *fh;
+	char const *name;
+	ZSTD_DStream *dstream;
+	void *inbuf;
+	size_t inbuf_size;
+	struct zstd_block blocks[ZSTD_READER_BLOCK_CNT];
+	size_t block_size;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t filled;      // signaled by the decompression thread when a block is ready
+	pthread_cond_t freed;       // signaled by the reader when a block has been consumed
+	int32_t head;               // next block to fill
+	int32_t tail;               // block being read
+	int32_t filled_cnt;         // number of filled blocks (including the one being read)
+	size_t read_pos;            // read position in the tail block
+	size_t last_ret;            // last return value of ZSTD_decompressStream
+	uint64_t bytes_in, bytes_out;
+	bool thread_started;
+	bool stop;
+};
+
+// Decompresses data into the given block until it's full or the end
+// of input is reached. Returns false on end of input or error.
+static bool zstd_block_fill(struct zstd_reader *r, struct zstd_block *blk, ZSTD_inBuffer *in) {
+	ZSTD_outBuffer out = { .dst = blk->buf, .size = r->block_size, .pos = 0 };
+	while(out.pos < out.size) {
+		if(in->pos == in->size) {
+			in->size = fread(r->inbuf, 1, r->inbuf_size, r->fh);
+			in->pos = 0;
+			r->bytes_in += in->size;
+			if(in->size == 0) {
+				if(r->last_ret != 0) {
+					fprintf(stderr, "%s: compressed stream is truncated\n", r->name);
+				}
+				break;
+			}
+		}
+		r->last_ret = ZSTD_decompressStream(r->dstream, &out, in);
+		if(ZSTD_isError(r->last_ret)) {
+			fprintf(stderr, "%s: decompression failed: %s\n", r->name, ZSTD_getErrorName(r->last_ret));
+			break;
+		}
+	}
+	blk->len = out.pos;
+	r->bytes_out += out.pos;
+	return out.pos == out.size;
+}
+
+static void *zstd_reader_thread(void *ctx) {
+	ASSERT(ctx != NULL);
+	struct zstd_reader *r = ctx;
+	ZSTD_inBuffer in = { .src = r->inbuf, .size = 0, .pos = 0 };
+	bool more_data = true;
+	while(more_data) {
+		pthread_mutex_lock(&r->mutex);
+		while(r->filled_cnt == ZSTD_READER_BLOCK_CNT && !r->stop) {
+			pthread_cond_wait(&r->freed, &r->mutex);
+		}
+		bool stop = r->stop;
+		pthread_mutex_unlock(&r->mutex);
+		if(stop) {
+			break;
+		}
+		// The reader never touches blocks which are not filled yet,
+		// so the head block may be written without holding the lock.
+		struct zstd_block *blk = &r->blocks[r->head];
+		more_data = zstd_block_fill(r, blk, &in);
+		blk->eof = !more_data;
+
+		pthread_mutex_lock(&r->mutex);
+		r->head = (r->head + 1) % ZSTD_READER_BLOCK_CNT;
+		r->filled_cnt++;
+		pthread_cond_signal(&r->filled);
+		pthread_mutex_unlock(&r->mutex);
+	}
+	debug_print(D_SDR, "%s: decompression finished, %" PRIu64 " bytes in, %" PRIu64 " bytes out\n",
+			r->name, r->bytes_in, r->bytes_out);
+	return NULL;
+}
+
+// Creates a reader which decompresses zstd-compressed data from fh
+// in a separate thread. Reads of read_size bytes never cross block
+// boundaries, so they are always satisfied in full (except at the end
+// of the stream).
+struct zstd_reader *zstd_reader_create(FILE *fh, char const *name, size_t read_size) {
+	ASSERT(fh != NULL);
+	ASSERT(read_size > 0);
+	NEW(struct zstd_reader, r);
+	r->fh = fh;
+	r->name = name;
+	r->dstream = ZSTD_createDStream();
+	if(r->dstream == NULL) {
+		fprintf(stderr, "%s: failed to create decompression context\n", name);
+		goto fail;
+	}
+	ZSTD_initDStream(r->dstream);
+	r->inbuf_size = ZSTD_DStreamInSize();
+	r->inbuf = XCALLOC(r->inbuf_size, sizeof(uint8_t));
+	r->block_size = max(ZSTD_READER_BLOCK_SIZE / read_size, 1U) * read_size;
+	for(int32_t i = 0; i < ZSTD_READER_BLOCK_CNT; i++) {
+		r->blocks[i].buf = XCALLOC(r->block_size, sizeof(uint8_t));
+	}
+	pthread_mutex_init(&r->mutex, NULL);
+	pthread_cond_init(&r->filled, NULL);
+	pthread_cond_init(&r->freed, NULL);
+	int32_t ret = thread_sched_create(&r->thread, THREAD_CLASS_INPUT, zstd_reader_thread, r);
+	if(ret != 0) {
+		fprintf(stderr, "%s: failed to start decompression thread: %s\n", name, strerror(ret));
+		goto fail;
+	}
+	r->thread_started = true;
+	debug_print(D_SDR, "%s: block size: %zu\n", name, r->block_size);
+	return r;
+fail:
+	zstd_reader_destroy(r);
+	return NULL;
+}
+
+// Returns a pointer to at most len bytes of decompressed data in *data.
+// The data remains valid until the next call.
+// Returns the number of bytes available (0 = end of stream).
+size_t zstd_reader_read(struct zstd_reader *r, void **data, size_t len) {
+	ASSERT(r != NULL);
+	struct zstd_block *blk = NULL;
+	pthread_mutex_lock(&r->mutex);
+	while(true) {
+		while(r->filled_cnt == 0) {
+			pthread_cond_wait(&r->filled, &r->mutex);
+		}
+		blk = &r->blocks[r->tail];
+		if(r->read_pos < blk->len) {
+			break;
+		}
+		if(blk->eof) {
+			pthread_mutex_unlock(&r->mutex);
+			return 0;
+		}
+		// Block consumed, hand it back to the decompression thread
+		r->tail = (r->tail + 1) % ZSTD_READER_BLOCK_CNT;
+		r->filled_cnt--;
+		r->read_pos = 0;
+		pthread_cond_signal(&r->freed);
+	}
+	pthread_mutex_unlock(&r->mutex);
+	if(len > blk->len - r->read_pos) {
+		len = blk->len - r->read_pos;
+	}
+	*data = blk->buf + r->read_pos;
+	r->read_pos += len;
+	return len;
+}
+
+void zstd_reader_destroy(struct zstd_reader *r) {
+	if(r == NULL) {
+		return;
+	}
+	if(r->thread_started) {
+		pthread_mutex_lock(&r->mutex);
+		r->stop = true;
+		pthread_cond_signal(&r->freed);
+		pthread_mutex_unlock(&r->mutex);
+		pthread_join(r->thread, NULL);
+		pthread_mutex_destroy(&r->mutex);
+		pthread_cond_destroy(&r->filled);
+		pthread_cond_destroy(&r->freed);
+	}
+	for(int32_t i = 0; i < ZSTD_READER_BLOCK_CNT; i++) {
+		XFREE(r->blocks[i].buf);
+	}
+	XFREE(r->inbuf);
+	ZSTD_freeDStream(r->dstream);
+	XFREE(r);
+}
@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdio.h>              // FILE
+#include <stddef.h>             // size_t
+
+struct zstd_reader;
+
+struct zstd_reader *zstd_reader_create(FILE *fh, char const *name, size_t read_size);
+size_t zstd_reader_read(struct zstd_reader *r, void **data, size_t len);
+void zstd_reader_destroy(struct zstd_reader *r);
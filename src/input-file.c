@@ -3,73 +3,221 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
-#include <unistd.h>         // usleep
+#include <inttypes.h>       // PRId64
+#include <unistd.h>         // sysconf
 #include <errno.h>          // errno
-#include <liquid/liquid.h>  // cbuffercf_*
+#include <time.h>           // gmtime, strftime
+#include <fcntl.h>          // posix_fadvise
+#include <sys/mman.h>       // mmap, madvise, munmap
+#include <sys/stat.h>       // fstat
 #include "block.h"          // block_*
 #include "input-common.h"   // input, sample_format, input_vtable
-#include "input-helpers.h"  // get_sample_full_scale_value, get_sample_size
+#include "input-helpers.h"  // get_sample_full_scale_value, get_sample_size, complex_samples_*
+#include "input-file-format.h"  // iq_file_format_*
+#ifdef WITH_ZSTD
+#include "input-file-zstd.h"    // zstd_reader_*
+#endif
+#include "sample-clock.h"   // sample_clock_*
 #include "util.h"	        // debug_print, ASSERT, XCALLOC
 #include "globals.h"        // do_exit
 
 #define INPUT_FILE_BUFSIZE_DEFAULT 320000U
+// Regular files are read through a sliding memory-mapped window of this size
+#define INPUT_FILE_MMAP_WINDOW_SIZE (64U * 1024U * 1024U)
 
 struct file_input {
 	struct input input;
 	FILE *fh;
+	struct iq_file_format format;
+	void *readbuf;              // read buffer (stdio mode only)
+#ifdef WITH_ZSTD
+	struct zstd_reader *zstd;   // decompressor (compressed files only)
+#endif
+	uint8_t *map;               // currently mapped window (mmap mode only)
+	off_t map_offset;           // file offset of the mapped window
+	size_t map_len;             // length of the mapped window
+	size_t window_size;         // nominal length of the mapped window
+	off_t data_start;           // start of sample data in the file
+	off_t data_end;             // end of sample data in the file (-1 = unknown, stdio mode only)
+	off_t pos;                  // current read position
+	bool use_mmap;
 };
 
+static void file_input_apply_format(struct file_input *fi, struct input_cfg *cfg) {
+	struct iq_file_format const *fmt = &fi->format;
+	// Parameters specified by the user take precedence over those read from the file
+	if(fmt->sfmt != SFMT_UNDEF && cfg->sfmt == SFMT_UNDEF) {
+		cfg->sfmt = fmt->sfmt;
+	}
+	if(fmt->sample_rate > 0 && cfg->sample_rate < 0) {
+		cfg->sample_rate = fmt->sample_rate;
+	}
+	if(fmt->centerfreq > 0 && cfg->centerfreq < 0) {
+		cfg->centerfreq = fmt->centerfreq;
+	}
+	fprintf(stderr, "%s: %s recording, sample format: %s, sample rate: %d\n",
+			cfg->source, fmt->container, get_sample_format_name(cfg->sfmt), cfg->sample_rate);
+	if(cfg->centerfreq > 0) {
+		fprintf(stderr, "%s: center frequency: %.3f kHz\n", cfg->source, HZ_TO_KHZ(cfg->centerfreq));
+	}
+	if(fmt->start_time_valid) {
+		char timebuf[32];
+		time_t t = fmt->start_time.tv_sec;
+		strftime(timebuf, sizeof(timebuf), "%F %T", gmtime(&t));
+		fprintf(stderr, "%s: recording start time: %s.%03ld UTC\n", cfg->source, timebuf,
+				(long)fmt->start_time.tv_usec / 1000);
+		sample_clock_set_start(&fi->input.block.clock, &fmt->start_time);
+	}
+}
+
 struct input *file_input_create(struct input_cfg *cfg) {
-	UNUSED(cfg);
+	ASSERT(cfg != NULL);
 	NEW(struct file_input, file_input);
+	if(strcmp(cfg->source, "-") == 0) {
+		// Can't look for headers on a pipe without consuming data
+		iq_file_format_init(&file_input->format);
+		return &file_input->input;
+	}
+	if(iq_file_format_probe(cfg->source, &file_input->format) < 0) {
+		XFREE(file_input);
+		return NULL;
+	}
+	if(file_input->format.data_path != NULL || file_input->format.data_offset > 0 ||
+			file_input->format.compression != IQ_FILE_COMPRESSION_NONE) {
+		file_input_apply_format(file_input, cfg);
+	}
 	return &file_input->input;
 }
 
 void file_input_destroy(struct input *input) {
 	if(input != NULL) {
 		struct file_input *fi = container_of(input, struct file_input, input);
+#ifdef WITH_ZSTD
+		zstd_reader_destroy(fi->zstd);
+#endif
+		if(fi->map != NULL) {
+			munmap(fi->map, fi->map_len);
+		}
+		if(fi->fh != NULL) {
+			fclose(fi->fh);
+		}
+		XFREE(fi->readbuf);
+		iq_file_format_cleanup(&fi->format);
 		XFREE(fi);
 	}
 }
 
+// Maps the window of the file which contains the range [pos, pos+len).
+// The window starts at a page boundary, so a range of up to
+// window_size - page_size bytes always fits in it.
+static int32_t file_input_map_window(struct file_input *fi, size_t len) {
+	static long page_size = 0;
+	if(page_size == 0) {
+		page_size = sysconf(_SC_PAGESIZE);
+	}
+	if(fi->map != NULL) {
+		munmap(fi->map, fi->map_len);
+		fi->map = NULL;
+	}
+	off_t offset = fi->pos - fi->pos % page_size;
+	size_t map_len = max(fi->window_size, len + (size_t)(fi->pos - offset));
+	if(offset + (off_t)map_len > fi->data_end) {
+		map_len = fi->data_end - offset;
+	}
+	void *map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fileno(fi->fh), offset);
+	if(map == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap failed: %s\n", fi->input.config->source, strerror(errno));
+		return -1;
+	}
+	// Data is read sequentially and once, so let the kernel read ahead
+	// aggressively and populate the whole window in the background.
+	// Also start reading the next window, so that it's already
+	// in the page cache when we get there.
+	madvise(map, map_len, MADV_SEQUENTIAL);
+	madvise(map, map_len, MADV_WILLNEED);
+	if(offset + (off_t)map_len < fi->data_end) {
+		posix_fadvise(fileno(fi->fh), offset + map_len, fi->window_size, POSIX_FADV_WILLNEED);
+	}
+	fi->map = map;
+	fi->map_offset = offset;
+	fi->map_len = map_len;
+	debug_print(D_SDR, "%s: mapped %zu bytes at offset %jd\n",
+			fi->input.config->source, map_len, (intmax_t)offset);
+	return 0;
+}
+
+// Returns a pointer to at most len bytes of input data in *data.
+// In mmap mode this points directly into the mapped file, otherwise
+// the data is read into the read buffer.
+// Returns the number of bytes available.
+static size_t file_input_read(struct file_input *fi, void **data, size_t len) {
+#ifdef WITH_ZSTD
+	if(fi->zstd != NULL) {
+		return zstd_reader_read(fi->zstd, data, len);
+	}
+#endif
+	if(!fi->use_mmap) {
+		if(fi->data_end >= 0 && fi->data_end - fi->pos < (off_t)len) {
+			len = fi->data_end - fi->pos;
+		}
+		*data = fi->readbuf;
+		size_t const read_len = fread(fi->readbuf, 1, len, fi->fh);
+		fi->pos += read_len;
+		return read_len;
+	}
+	if(fi->pos >= fi->data_end) {
+		return 0;
+	}
+	if(fi->data_end - fi->pos < (off_t)len) {
+		len = fi->data_end - fi->pos;
+	}
+	if(fi->map == NULL || fi->pos + (off_t)len > fi->map_offset + (off_t)fi->map_len) {
+		if(file_input_map_window(fi, len) < 0) {
+			return 0;
+		}
+	}
+	*data = fi->map + (fi->pos - fi->map_offset);
+	fi->pos += len;
+	return len;
+}
+
 void *file_input_thread(void *ctx) {
 	ASSERT(ctx);
 	struct block *block = ctx;
 	struct input *input = container_of(block, struct input, block);
 	struct file_input *file_input = container_of(input, struct file_input, input);
-	struct circ_buffer *circ_buffer = &block->producer.out->circ_buffer;
 
 	ASSERT(file_input->fh != NULL);
 	ASSERT(input->config->read_buffer_size > 0);
 	size_t bufsize = input->config->read_buffer_size;
 
-	void *inbuf = XCALLOC(bufsize, sizeof(uint8_t));
-	float complex *outbuf = XCALLOC(bufsize / input->bytes_per_sample,
-			sizeof(float complex));
-	size_t space_available, len, samples_read;
+	void *inbuf = NULL;
+	size_t len, samples_read;
 	do {
-		len = fread(inbuf, 1, bufsize, file_input->fh);
+		len = file_input_read(file_input, &inbuf, bufsize);
 		samples_read = len / input->bytes_per_sample;
-		while(true) {
-			pthread_mutex_lock(circ_buffer->mutex);
-			space_available = cbuffercf_space_available(circ_buffer->buf);
-			pthread_mutex_unlock(circ_buffer->mutex);
-			if(space_available * input->bytes_per_sample >= len) {
-				break;
-			}
-			usleep(100000);
-		}
-		input->convert_sample_buffer(input, inbuf, len, outbuf);
-		complex_samples_produce(circ_buffer, outbuf, samples_read);
+		// Reading from file is (usually) faster than the rest of the pipeline.
+		// The default overflow policy for files makes the reservation wait
+		// until the consumer releases enough space, so that no samples get lost.
+		float complex *outbuf = complex_samples_reserve(block->producer.out, &samples_read);
+		input->convert_sample_buffer(input, inbuf, samples_read * input->bytes_per_sample, outbuf);
+		complex_samples_commit(block->producer.out, samples_read);
+		block->stats.samples_processed += samples_read;
 	} while(len == bufsize && do_exit == 0);
+	if(file_input->map != NULL) {
+		munmap(file_input->map, file_input->map_len);
+		file_input->map = NULL;
+	}
+#ifdef WITH_ZSTD
+	zstd_reader_destroy(file_input->zstd);
+	file_input->zstd = NULL;
+#endif
 	fclose(file_input->fh);
 	file_input->fh = NULL;
 	debug_print(D_MISC, "Shutdown ordered, signaling consumer shutdown\n");
 	block_connection_one2one_shutdown(block->producer.out);
-	do_exit = 1;
+	block_stats_update_cpu_time(block);
 	block->running = false;
-	XFREE(inbuf);
-	XFREE(outbuf);
 	return NULL;
 }
 
@@ -81,35 +229,147 @@ int32_t file_input_init(struct input *input) {
 		fprintf(stderr, "Sample format must be specified for file inputs\n");
 		return -1;
 	}
-	if(input->config->read_buffer_size <= 0) {
-		input->config->read_buffer_size = INPUT_FILE_BUFSIZE_DEFAULT;
-	}
-	if(strcmp(input->config->source, "-") == 0) {
+	char const *path = file_input->format.data_path != NULL ?
+		file_input->format.data_path : input->config->source;
+	if(strcmp(path, "-") == 0) {
 		file_input->fh = stdin;
 	} else {
-		file_input->fh = fopen(input->config->source, "rb");
+		file_input->fh = fopen(path, "rb");
 	}
 	if(file_input->fh == NULL) {
 		fprintf(stderr, "Failed to open input file %s: %s\n",
-				input->config->source, strerror(errno));
+				path, strerror(errno));
 		return -1;
 	}
 
 	input->full_scale = get_sample_full_scale_value(input->config->sfmt);
 	input->bytes_per_sample = get_sample_size(input->config->sfmt);
 	ASSERT(input->bytes_per_sample > 0);
+	if(input->config->read_buffer_size <= 0) {
+		// Round down to a multiple of the sample size (which is not always a power of 2)
+		input->config->read_buffer_size = INPUT_FILE_BUFSIZE_DEFAULT -
+			INPUT_FILE_BUFSIZE_DEFAULT % input->bytes_per_sample;
+	}
 	if(input->config->read_buffer_size % input->bytes_per_sample != 0) {
 		fprintf(stderr, "Invalid --read-buffer-size value "
 				"(must be a multiple of sample size, which is %d bytes)\n",
 				input->bytes_per_sample);
 		return -1;
 	}
+	struct stat st;
+	if(file_input->format.compression == IQ_FILE_COMPRESSION_ZSTD) {
+#ifdef WITH_ZSTD
+		// Decompress in a separate thread, so that it runs in parallel with DSP
+		file_input->zstd = zstd_reader_create(file_input->fh, input->config->source,
+				input->config->read_buffer_size);
+		if(file_input->zstd == NULL) {
+			return -1;
+		}
+		debug_print(D_SDR, "%s: using zstd\n", input->config->source);
+#else
+		fprintf(stderr, "%s: file is compressed with zstd, but zstd support is not enabled\n",
+				input->config->source);
+		return -1;
+#endif
+	} else if(fstat(fileno(file_input->fh), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		// Use mmap for regular files, fall back to stdio for pipes, devices, etc.
+		// Skip container headers and trailers, if any
+		struct iq_file_format const *fmt = &file_input->format;
+		file_input->use_mmap = true;
+		file_input->data_start = file_input->pos = fmt->data_offset;
+		file_input->data_end = st.st_size;
+		if(fmt->data_len >= 0 && fmt->data_offset + fmt->data_len < st.st_size) {
+			file_input->data_end = fmt->data_offset + fmt->data_len;
+		}
+		file_input->window_size = max(INPUT_FILE_MMAP_WINDOW_SIZE,
+				2 * (size_t)input->config->read_buffer_size);
+		posix_fadvise(fileno(file_input->fh), 0, 0, POSIX_FADV_SEQUENTIAL);
+		debug_print(D_SDR, "%s: using mmap\n", input->config->source);
+	} else {
+		// Skip container headers and trailers, if any
+		struct iq_file_format const *fmt = &file_input->format;
+		if(fmt->data_offset > 0 && fseeko(file_input->fh, fmt->data_offset, SEEK_SET) != 0) {
+			fprintf(stderr, "%s: could not seek to the start of sample data: %s\n",
+					path, strerror(errno));
+			return -1;
+		}
+		file_input->data_start = file_input->pos = fmt->data_offset;
+		file_input->data_end = fmt->data_len >= 0 ? fmt->data_offset + fmt->data_len : -1;
+		file_input->readbuf = XCALLOC(input->config->read_buffer_size, sizeof(uint8_t));
+		debug_print(D_SDR, "%s: using stdio\n", input->config->source);
+	}
 	input->block.producer.max_tu = input->config->read_buffer_size / input->bytes_per_sample;
 	debug_print(D_SDR, "%s: max_tu=%zu\n",
 			input->config->source, input->block.producer.max_tu);
 	return 0;
 }
 
+// Creates another input reading the same file with the same parameters.
+// The clone needs to be initialized with input_init.
+struct block *file_input_clone(struct block *block) {
+	ASSERT(block != NULL);
+	struct input *input = container_of(block, struct input, block);
+	struct file_input *file_input = container_of(input, struct file_input, input);
+	NEW(struct file_input, clone);
+	*clone = *file_input;
+	clone->fh = NULL;
+	clone->readbuf = NULL;
+	clone->map = NULL;
+	clone->map_len = 0;
+	clone->use_mmap = false;
+#ifdef WITH_ZSTD
+	clone->zstd = NULL;
+#endif
+	if(file_input->format.data_path != NULL) {
+		clone->format.data_path = strdup(file_input->format.data_path);
+	}
+	return &clone->input.block;
+}
+
+int64_t file_input_get_sample_cnt(struct block *block) {
+	ASSERT(block != NULL);
+	struct input *input = container_of(block, struct input, block);
+	struct file_input *file_input = container_of(input, struct file_input, input);
+	if(!file_input->use_mmap) {
+		return -1;
+	}
+	return (file_input->data_end - file_input->data_start) / input->bytes_per_sample;
+}
+
+// Restricts reading to sample_cnt samples starting at first_sample.
+// Shifts the sample clock accordingly, so that timestamps remain
+// relative to the start of the recording.
+// Must be called after file_input_init and before starting the block.
+int32_t file_input_set_segment(struct block *block, int64_t first_sample, int64_t sample_cnt) {
+	ASSERT(block != NULL);
+	struct input *input = container_of(block, struct input, block);
+	struct file_input *file_input = container_of(input, struct file_input, input);
+	if(!file_input->use_mmap) {
+		fprintf(stderr, "%s: segmented reading is supported only for regular files\n",
+				input->config->source);
+		return -1;
+	}
+	off_t start = file_input->data_start + (off_t)first_sample * input->bytes_per_sample;
+	off_t end = start + (off_t)sample_cnt * input->bytes_per_sample;
+	if(first_sample < 0 || sample_cnt <= 0 || start >= file_input->data_end) {
+		fprintf(stderr, "%s: invalid segment: first sample: %" PRId64 ", sample count: %" PRId64 "\n",
+				input->config->source, first_sample, sample_cnt);
+		return -1;
+	}
+	file_input->pos = start;
+	if(end < file_input->data_end) {
+		file_input->data_end = end;
+	}
+	if(sample_clock_is_valid(&block->clock)) {
+		struct timeval segment_start;
+		sample_clock_get_time(&block->clock, first_sample, input->config->sample_rate, &segment_start);
+		sample_clock_set_start(&block->clock, &segment_start);
+	}
+	debug_print(D_SDR, "%s: segment: offset %jd-%jd\n", input->config->source,
+			(intmax_t)file_input->pos, (intmax_t)file_input->data_end);
+	return 0;
+}
+
 struct input_vtable const file_input_vtable = {
 	.create = file_input_create,
 	.init = file_input_init,
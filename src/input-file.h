@@ -1,6 +1,11 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #pragma once
-
+#include <stdint.h>
+#include "block.h"              // struct block
 #include "input-common.h"       // struct input_vtable
 
 extern struct input_vtable file_input_vtable;
+
+struct block *file_input_clone(struct block *block);
+int64_t file_input_get_sample_cnt(struct block *block);
+int32_t file_input_set_segment(struct block *block, int64_t first_sample, int64_t sample_cnt);
@@ -1,101 +1,591 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include <limits.h>             // SHRT_MAX, SCHAR_MAX, UCHAR_MAX
+#include <math.h>               // lrintf
 #include <complex.h>            // CMPLXF
+#include <string.h>             // memcpy
 #include <strings.h>            // strcasecmp()
 #include <pthread.h>            // pthread_*
-#include <liquid/liquid.h>      // cbuffercf_*
 #include "input-common.h"       // struct input
+#include "input-helpers.h"      // encode_sample_buffer_fun
 #include "util.h"               // ASSERT, debug_print
 
-static void convert_cf32(struct input *input, void *inbuf, size_t len,
-		float complex *outbuf) {
+// Vectorized conversion routines.
+// The baseline instruction set of the target (SSE2 on x86-64, NEON on ARM)
+// is used unconditionally. AVX2 variants are compiled in separately and
+// selected at runtime (once, in get_sample_converter()) if the CPU supports them.
+#if defined(__SSE2__)
+#include <emmintrin.h>          // _mm_*
+#define CONVERTER_ISA "SSE2"
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>           // v*q_*
+#define CONVERTER_ISA "NEON"
+#else
+#define CONVERTER_ISA "generic"
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WITH_AVX2_CONVERTERS
+#include <immintrin.h>          // _mm256_*
+#define TARGET_AVX2 __attribute__((target("avx2")))
+// All AVX2-capable CPUs support F16C, but virtual machines might hide it,
+// so it's checked separately
+#define TARGET_AVX2_F16C __attribute__((target("avx2,f16c")))
+#endif
+
+// Full scale value of packed 12-bit samples
+#define CS12_FULL_SCALE 2047.5f
+
+static size_t sample_buf_len_check(struct input *input, size_t len) {
 	if(UNLIKELY(len % input->bytes_per_sample != 0)) {
 		debug_print(D_SDR, "Warning: buf len %zu is not a multiple of %d, truncating\n",
 				len, input->bytes_per_sample);
 		len -= (len % input->bytes_per_sample);
 	}
+	return len;
+}
+
+// Scales a float buffer of length len by scale.
+// Works in place, if in == out.
+static inline void scale_floats(float const *in, float *out, size_t len, float const scale) {
+	size_t i = 0;
+#if defined(__SSE2__)
+	__m128 const s = _mm_set1_ps(scale);
+	for(; i + 4 <= len; i += 4) {
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), s));
+	}
+#elif defined(__ARM_NEON)
+	for(; i + 4 <= len; i += 4) {
+		vst1q_f32(out + i, vmulq_n_f32(vld1q_f32(in + i), scale));
+	}
+#endif
+	for(; i < len; i++) {
+		out[i] = in[i] * scale;
+	}
+}
+
+static inline void scale_shorts(int16_t const *in, float *out, size_t len, float const scale) {
+	size_t i = 0;
+#if defined(__SSE2__)
+	__m128 const s = _mm_set1_ps(scale);
+	for(; i + 8 <= len; i += 8) {
+		__m128i const v = _mm_loadu_si128((__m128i const *)(in + i));
+		// Sign-extend 16-bit values to 32 bits by unpacking them into
+		// upper halves and shifting right arithmetically
+		__m128i const lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i const hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_ps(out + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), s));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), s));
+	}
+#elif defined(__ARM_NEON)
+	for(; i + 8 <= len; i += 8) {
+		int16x8_t const v = vld1q_s16(in + i);
+		float32x4_t const lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+		float32x4_t const hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+		vst1q_f32(out + i,     vmulq_n_f32(lo, scale));
+		vst1q_f32(out + i + 4, vmulq_n_f32(hi, scale));
+	}
+#endif
+	for(; i < len; i++) {
+		out[i] = (float)in[i] * scale;
+	}
+}
+
+static inline void scale_chars(int8_t const *in, float *out, size_t len, float const scale) {
+	size_t i = 0;
+#if defined(__SSE2__)
+	__m128 const s = _mm_set1_ps(scale);
+	for(; i + 16 <= len; i += 16) {
+		__m128i const v = _mm_loadu_si128((__m128i const *)(in + i));
+		// Sign-extend 8-bit values to 16 bits, then 16-bit values to 32 bits
+		__m128i const lo = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+		__m128i const hi = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+		_mm_storeu_ps(out + i,      _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16)), s));
+		_mm_storeu_ps(out + i + 4,  _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16)), s));
+		_mm_storeu_ps(out + i + 8,  _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16)), s));
+		_mm_storeu_ps(out + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16)), s));
+	}
+#elif defined(__ARM_NEON)
+	for(; i + 16 <= len; i += 16) {
+		int8x16_t const v = vld1q_s8(in + i);
+		int16x8_t const lo = vmovl_s8(vget_low_s8(v));
+		int16x8_t const hi = vmovl_s8(vget_high_s8(v));
+		vst1q_f32(out + i,      vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(lo))), scale));
+		vst1q_f32(out + i + 4,  vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(lo))), scale));
+		vst1q_f32(out + i + 8,  vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(hi))), scale));
+		vst1q_f32(out + i + 12, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(hi))), scale));
+	}
+#endif
+	for(; i < len; i++) {
+		out[i] = (float)in[i] * scale;
+	}
+}
+
+// IEEE 754 half precision float conversions.
+// Based on public domain code by Fabian Giesen
+// (https://gist.github.com/rygorous/2156668).
+// Denormals are handled by letting the FPU rescale the value.
+union fp32 {
+	uint32_t u;
+	float f;
+};
+
+static inline float half_to_float(uint16_t h) {
+	union fp32 const magic = { .u = (254U - 15U) << 23 };
+	union fp32 const was_infnan = { .u = (127U + 16U) << 23 };
+	union fp32 o = { .u = (uint32_t)(h & 0x7fffU) << 13 };
+	o.f *= magic.f;
+	if(o.f >= was_infnan.f) {
+		o.u |= 255U << 23;
+	}
+	o.u |= (uint32_t)(h & 0x8000U) << 16;
+	return o.f;
+}
+
+// Rounds to nearest even
+static inline uint16_t float_to_half(float f) {
+	union fp32 const f32infty = { .u = 255U << 23 };
+	union fp32 const f16max = { .u = (127U + 16U) << 23 };
+	union fp32 const denorm_magic = { .u = ((127U - 15U) + (23U - 10U) + 1U) << 23 };
+	union fp32 in = { .f = f };
+	uint32_t const sign = in.u & 0x80000000U;
+	uint16_t o;
+	in.u ^= sign;
+	if(in.u >= f16max.u) {
+		// Inf or NaN (all exponent bits set); NaN -> qNaN, Inf -> Inf
+		o = in.u > f32infty.u ? 0x7e00 : 0x7c00;
+	} else if(in.u < (113U << 23)) {
+		// Resulting value is a subnormal or zero
+		in.f += denorm_magic.f;
+		o = (uint16_t)(in.u - denorm_magic.u);
+	} else {
+		uint32_t const mant_odd = (in.u >> 13) & 1;
+		in.u += ((uint32_t)(15 - 127) << 23) + 0xfffU;
+		in.u += mant_odd;
+		o = (uint16_t)(in.u >> 13);
+	}
+	return o | (uint16_t)(sign >> 16);
+}
+
+static inline void halves_to_floats(uint16_t const *in, float *out, size_t len, float const scale) {
+	size_t i = 0;
+#if defined(__SSE2__)
+	__m128i const mask_nosign = _mm_set1_epi32(0x7fff);
+	__m128 const magic = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+	__m128i const was_infnan = _mm_set1_epi32(0x7bff);
+	__m128i const exp_infnan = _mm_set1_epi32(255 << 23);
+	__m128i const zero = _mm_setzero_si128();
+	__m128 const s = _mm_set1_ps(scale);
+	for(; i + 4 <= len; i += 4) {
+		__m128i const h = _mm_unpacklo_epi16(_mm_loadl_epi64((__m128i const *)(in + i)), zero);
+		__m128i const expmant = _mm_and_si128(mask_nosign, h);
+		__m128i const justsign = _mm_xor_si128(h, expmant);
+		__m128 const scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expmant, 13)), magic);
+		__m128i const infnanexp = _mm_and_si128(_mm_cmpgt_epi32(expmant, was_infnan), exp_infnan);
+		__m128i const sign_inf = _mm_or_si128(_mm_slli_epi32(justsign, 16), infnanexp);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_or_ps(scaled, _mm_castsi128_ps(sign_inf)), s));
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	for(; i + 4 <= len; i += 4) {
+		float32x4_t const f = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(in + i)));
+		vst1q_f32(out + i, vmulq_n_f32(f, scale));
+	}
+#endif
+	for(; i < len; i++) {
+		out[i] = half_to_float(in[i]) * scale;
+	}
+}
+
+static void convert_cf32(struct input *input, void *inbuf, size_t len,
+		float complex *outbuf) {
+	len = sample_buf_len_check(input, len);
 	if(UNLIKELY(len == 0)) {
 		return;
 	}
-	float *floatbuf = inbuf;
-	size_t floatbuf_len = len / sizeof(float);
-	size_t outbuf_idx = 0;
-	float re = 0.f, im = 0.f;
 	float const full_scale = input->full_scale;
 	ASSERT(full_scale > 0.f);
-	for(size_t i = 0; i < floatbuf_len;) {
-		re = floatbuf[i++] / full_scale;
-		im = floatbuf[i++] / full_scale;
-		outbuf[outbuf_idx++] = CMPLXF(re, im);
+	if(full_scale == 1.0f) {
+		memcpy(outbuf, inbuf, len);
+	} else {
+		scale_floats(inbuf, (float *)outbuf, len / sizeof(float), 1.0f / full_scale);
 	}
 }
 
 static void convert_cs16(struct input *input, void *inbuf, size_t len,
 		float complex *outbuf) {
-	if(UNLIKELY(len % input->bytes_per_sample != 0)) {
-		debug_print(D_SDR, "Warning: buf len %zu is not a multiple of %d, truncating\n",
-				len, input->bytes_per_sample);
-		len -= (len % input->bytes_per_sample);
+	len = sample_buf_len_check(input, len);
+	if(UNLIKELY(len == 0)) {
+		return;
 	}
+	float const full_scale = input->full_scale;
+	ASSERT(full_scale > 0.f);
+	scale_shorts(inbuf, (float *)outbuf, len / sizeof(int16_t), 1.0f / full_scale);
+}
+
+static void convert_cs8(struct input *input, void *inbuf, size_t len,
+		float complex *outbuf) {
+	len = sample_buf_len_check(input, len);
 	if(UNLIKELY(len == 0)) {
 		return;
 	}
-	int16_t *shortbuf = inbuf;
-	size_t shortbuf_len = len / sizeof(int16_t);
-	size_t outbuf_idx = 0;
-	float re = 0.f, im = 0.f;
 	float const full_scale = input->full_scale;
 	ASSERT(full_scale > 0.f);
-	for(size_t i = 0; i < shortbuf_len;) {
-		re = (float)shortbuf[i++] / full_scale;
-		im = (float)shortbuf[i++] / full_scale;
-		outbuf[outbuf_idx++] = CMPLXF(re, im);
+	scale_chars(inbuf, (float *)outbuf, len, 1.0f / full_scale);
+}
+
+// Packed 12-bit samples (as produced eg. by SoapySDR in CS12 format).
+// Each complex sample occupies 3 octets:
+// I[7:0], Q[3:0]I[11:8], Q[11:4]
+static void convert_cs12(struct input *input, void *inbuf, size_t len,
+		float complex *outbuf) {
+	len = sample_buf_len_check(input, len);
+	if(UNLIKELY(len == 0)) {
+		return;
+	}
+	float const full_scale = input->full_scale;
+	ASSERT(full_scale > 0.f);
+	float const scale = 1.0f / full_scale;
+	uint8_t const *in = inbuf;
+	float *out = (float *)outbuf;
+	size_t const sample_cnt = len / 3;
+	size_t i = 0;
+#if defined(__ARM_NEON)
+	// Deinterleave octets of 16 samples and assemble I and Q values
+	// from adjacent octet pairs, sign-extending them with shifts
+	for(; i + 16 <= sample_cnt; i += 16) {
+		uint8x16x3_t const v = vld3q_u8(in + 3 * i);
+		for(int32_t half = 0; half < 2; half++) {
+			uint8x8_t const b0 = half ? vget_high_u8(v.val[0]) : vget_low_u8(v.val[0]);
+			uint8x8_t const b1 = half ? vget_high_u8(v.val[1]) : vget_low_u8(v.val[1]);
+			uint8x8_t const b2 = half ? vget_high_u8(v.val[2]) : vget_low_u8(v.val[2]);
+			int16x8_t const re = vshrq_n_s16(vshlq_n_s16(vreinterpretq_s16_u16(
+							vorrq_u16(vmovl_u8(b0), vshll_n_u8(b1, 8))), 4), 4);
+			int16x8_t const im = vshrq_n_s16(vreinterpretq_s16_u16(
+						vorrq_u16(vmovl_u8(b1), vshll_n_u8(b2, 8))), 4);
+			float *o = out + 2 * (i + 8 * half);
+			float32x4x2_t lo = {{
+				vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(re))), scale),
+				vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(im))), scale)
+			}};
+			float32x4x2_t hi = {{
+				vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(re))), scale),
+				vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(im))), scale)
+			}};
+			vst2q_f32(o, lo);
+			vst2q_f32(o + 8, hi);
+		}
+	}
+#endif
+	for(; i < sample_cnt; i++) {
+		uint8_t const *s = in + 3 * i;
+		int16_t const re = (int16_t)((s[0] | (s[1] << 8)) << 4) >> 4;
+		int16_t const im = (int16_t)(s[1] | (s[2] << 8)) >> 4;
+		out[2 * i] = (float)re * scale;
+		out[2 * i + 1] = (float)im * scale;
 	}
 }
 
-static void convert_cu8(struct input *input, void *inbuf, size_t len,
+static void convert_cf16(struct input *input, void *inbuf, size_t len,
 		float complex *outbuf) {
-	if(UNLIKELY(len % input->bytes_per_sample != 0)) {
-		debug_print(D_SDR, "Warning: buf len %zu is not a multiple of %d, truncating\n",
-				len, input->bytes_per_sample);
-		len -= (len % input->bytes_per_sample);
+	len = sample_buf_len_check(input, len);
+	if(UNLIKELY(len == 0)) {
+		return;
 	}
+	float const full_scale = input->full_scale;
+	ASSERT(full_scale > 0.f);
+	halves_to_floats(inbuf, (float *)outbuf, len / sizeof(uint16_t), 1.0f / full_scale);
+}
+
+#ifdef WITH_AVX2_CONVERTERS
+TARGET_AVX2 static void convert_cf32_avx2(struct input *input, void *inbuf, size_t len,
+		float complex *outbuf) {
+	len = sample_buf_len_check(input, len);
 	if(UNLIKELY(len == 0)) {
 		return;
 	}
-	uint8_t *bytebuf = inbuf;
-	size_t bytebuf_len = len / sizeof(uint8_t);
-	size_t outbuf_idx = 0;
-	float re = 0.f, im = 0.f;
 	float const full_scale = input->full_scale;
 	ASSERT(full_scale > 0.f);
-	float const shift = input->full_scale / 2.0f;
-	for(size_t i = 0; i < bytebuf_len;) {
-		re = (bytebuf[i++] - shift) / full_scale;
-		im = (bytebuf[i++] - shift) / full_scale;
-		outbuf[outbuf_idx++] = CMPLXF(re, im);
+	if(full_scale == 1.0f) {
+		memcpy(outbuf, inbuf, len);
+		return;
+	}
+	float const *in = inbuf;
+	float *out = (float *)outbuf;
+	size_t const floatbuf_len = len / sizeof(float);
+	float const scale = 1.0f / full_scale;
+	__m256 const s = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for(; i + 8 <= floatbuf_len; i += 8) {
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), s));
+	}
+	for(; i < floatbuf_len; i++) {
+		out[i] = in[i] * scale;
 	}
 }
 
-void complex_samples_produce(struct circ_buffer *circ_buffer,
-		float complex *samples, size_t num_samples) {
-	pthread_mutex_lock(circ_buffer->mutex);
-	size_t cbuf_available = cbuffercf_space_available(circ_buffer->buf);
-	if(cbuf_available < num_samples) {
-		fprintf(stderr, "Sample buffer overrun (%zu/%zu samples lost)\n",
-				num_samples - cbuf_available, num_samples);
-		num_samples = cbuf_available;
+TARGET_AVX2 static void convert_cs16_avx2(struct input *input, void *inbuf, size_t len,
+		float complex *outbuf) {
+	len = sample_buf_len_check(input, len);
+	if(UNLIKELY(len == 0)) {
+		return;
+	}
+	float const full_scale = input->full_scale;
+	ASSERT(full_scale > 0.f);
+	int16_t const *in = inbuf;
+	float *out = (float *)outbuf;
+	size_t const shortbuf_len = len / sizeof(int16_t);
+	float const scale = 1.0f / full_scale;
+	__m256 const s = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for(; i + 8 <= shortbuf_len; i += 8) {
+		__m128i const v = _mm_loadu_si128((__m128i const *)(in + i));
+		__m256 const f = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v));
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(f, s));
+	}
+	for(; i < shortbuf_len; i++) {
+		out[i] = (float)in[i] * scale;
 	}
-	cbuffercf_write(circ_buffer->buf, samples, num_samples);
-	pthread_mutex_unlock(circ_buffer->mutex);
-	pthread_cond_signal(circ_buffer->cond);
 }
 
+TARGET_AVX2 static void convert_cs8_avx2(struct input *input, void *inbuf, size_t len,
+		float complex *outbuf) {
+	len = sample_buf_len_check(input, len);
+	if(UNLIKELY(len == 0)) {
+		return;
+	}
+	float const full_scale = input->full_scale;
+	ASSERT(full_scale > 0.f);
+	int8_t const *in = inbuf;
+	float *out = (float *)outbuf;
+	float const scale = 1.0f / full_scale;
+	__m256 const s = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for(; i + 8 <= len; i += 8) {
+		__m128i const v = _mm_loadl_epi64((__m128i const *)(in + i));
+		__m256 const f = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(v));
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(f, s));
+	}
+	for(; i < len; i++) {
+		out[i] = (float)in[i] * scale;
+	}
+}
+
+TARGET_AVX2 static void convert_cs12_avx2(struct input *input, void *inbuf, size_t len,
+		float complex *outbuf) {
+	len = sample_buf_len_check(input, len);
+	if(UNLIKELY(len == 0)) {
+		return;
+	}
+	float const full_scale = input->full_scale;
+	ASSERT(full_scale > 0.f);
+	float const scale = 1.0f / full_scale;
+	uint8_t const *in = inbuf;
+	float *out = (float *)outbuf;
+	size_t const sample_cnt = len / 3;
+	// Each 128-bit lane holds 4 packed samples (12 octets). Copy the octet
+	// pair of every I and Q value into a separate 16-bit word. I values
+	// are then shifted left by 4 bits (by multiplying them by 16), so that
+	// all values can be sign-extended with a single arithmetic right shift.
+	__m256i const shuf = _mm256_setr_epi8(
+			0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11,
+			0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+	__m256i const mul = _mm256_setr_epi16(16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1);
+	__m256 const s = _mm256_set1_ps(scale);
+	size_t i = 0;
+	// The second lane is loaded from offset 12 and is 16 octets long,
+	// so 4 octets past the last processed sample must be readable.
+	for(; 3 * i + 28 <= len; i += 8) {
+		uint8_t const *p = in + 3 * i;
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+					_mm_loadu_si128((__m128i const *)p)),
+				_mm_loadu_si128((__m128i const *)(p + 12)), 1);
+		v = _mm256_srai_epi16(_mm256_mullo_epi16(_mm256_shuffle_epi8(v, shuf), mul), 4);
+		__m256 const lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(v)));
+		__m256 const hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1)));
+		_mm256_storeu_ps(out + 2 * i, _mm256_mul_ps(lo, s));
+		_mm256_storeu_ps(out + 2 * i + 8, _mm256_mul_ps(hi, s));
+	}
+	for(; i < sample_cnt; i++) {
+		uint8_t const *p = in + 3 * i;
+		int16_t const re = (int16_t)((p[0] | (p[1] << 8)) << 4) >> 4;
+		int16_t const im = (int16_t)(p[1] | (p[2] << 8)) >> 4;
+		out[2 * i] = (float)re * scale;
+		out[2 * i + 1] = (float)im * scale;
+	}
+}
+
+TARGET_AVX2_F16C static void convert_cf16_avx2(struct input *input, void *inbuf, size_t len,
+		float complex *outbuf) {
+	len = sample_buf_len_check(input, len);
+	if(UNLIKELY(len == 0)) {
+		return;
+	}
+	float const full_scale = input->full_scale;
+	ASSERT(full_scale > 0.f);
+	uint16_t const *in = inbuf;
+	float *out = (float *)outbuf;
+	size_t const halfbuf_len = len / sizeof(uint16_t);
+	float const scale = 1.0f / full_scale;
+	__m256 const s = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for(; i + 8 <= halfbuf_len; i += 8) {
+		__m256 const f = _mm256_cvtph_ps(_mm_loadu_si128((__m128i const *)(in + i)));
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(f, s));
+	}
+	for(; i < halfbuf_len; i++) {
+		out[i] = half_to_float(in[i]) * scale;
+	}
+}
+#endif
+
+// CU8 samples are converted with a lookup table which is precomputed
+// by sample_lut_init() for the current full scale value.
+static void convert_cu8(struct input *input, void *inbuf, size_t len,
+		float complex *outbuf) {
+	len = sample_buf_len_check(input, len);
+	if(UNLIKELY(len == 0)) {
+		return;
+	}
+	uint8_t const *bytebuf = inbuf;
+	float *out = (float *)outbuf;
+	float const *lut = input->sample_lut;
+	for(size_t i = 0; i < len; i++) {
+		out[i] = lut[bytebuf[i]];
+	}
+}
+
+// Reserves space for up to *num_samples samples in the output buffer.
+// If the buffer is full, the overflow policy of the connection decides
+// whether to wait for the consumer or to drop samples. In the latter case
+// *num_samples may be reduced to the number of samples that fit.
+// Samples are to be written directly into the returned region and then
+// handed over to the consumer with complex_samples_commit().
+float complex *complex_samples_reserve(struct block_connection *connection, size_t *num_samples) {
+	*num_samples = block_connection_one2one_make_space(connection, *num_samples);
+	return circ_buffer_reserve(&connection->circ_buffer, *num_samples);
+}
+
+void complex_samples_commit(struct block_connection *connection, size_t num_samples) {
+	block_connection_one2one_commit(connection, num_samples);
+}
+
+// Sample encoders - the reverse of the converters above.
+// They convert complex float samples into the given format
+// (saturating values outside of the full scale range) and return
+// the number of octets written to outbuf.
+
+static inline int32_t clamp_sample(float val, int32_t min, int32_t max) {
+	int32_t const ret = (int32_t)lrintf(val);
+	return ret < min ? min : (ret > max ? max : ret);
+}
+
+// Written in the usual offset binary format (as used by rtl_sdr)
+static size_t encode_cu8(float complex const *samples, size_t num_samples, void *outbuf) {
+	float const *in = (float const *)samples;
+	uint8_t *out = outbuf;
+	float const half = ((float)UCHAR_MAX + 1.0f) / 2.0f;
+	for(size_t i = 0; i < 2 * num_samples; i++) {
+		out[i] = (uint8_t)clamp_sample(in[i] * half + half - 0.5f, 0, UCHAR_MAX);
+	}
+	return 2 * num_samples;
+}
+
+static size_t encode_cs8(float complex const *samples, size_t num_samples, void *outbuf) {
+	float const *in = (float const *)samples;
+	int8_t *out = outbuf;
+	float const scale = (float)SCHAR_MAX + 0.5f;
+	size_t const len = 2 * num_samples;
+	size_t i = 0;
+#if defined(__SSE2__)
+	__m128 const s = _mm_set1_ps(scale);
+	for(; i + 16 <= len; i += 16) {
+		__m128i const a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), s));
+		__m128i const b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 4), s));
+		__m128i const c = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 8), s));
+		__m128i const d = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 12), s));
+		_mm_storeu_si128((__m128i *)(out + i),
+				_mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+	}
+#endif
+	for(; i < len; i++) {
+		out[i] = (int8_t)clamp_sample(in[i] * scale, SCHAR_MIN, SCHAR_MAX);
+	}
+	return len;
+}
+
+static size_t encode_cs16(float complex const *samples, size_t num_samples, void *outbuf) {
+	float const *in = (float const *)samples;
+	int16_t *out = outbuf;
+	float const scale = (float)SHRT_MAX + 0.5f;
+	size_t const len = 2 * num_samples;
+	size_t i = 0;
+#if defined(__SSE2__)
+	__m128 const s = _mm_set1_ps(scale);
+	for(; i + 8 <= len; i += 8) {
+		__m128i const a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), s));
+		__m128i const b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 4), s));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+	}
+#endif
+	for(; i < len; i++) {
+		out[i] = (int16_t)clamp_sample(in[i] * scale, SHRT_MIN, SHRT_MAX);
+	}
+	return len * sizeof(int16_t);
+}
+
+static size_t encode_cs12(float complex const *samples, size_t num_samples, void *outbuf) {
+	float const *in = (float const *)samples;
+	uint8_t *out = outbuf;
+	for(size_t i = 0; i < num_samples; i++) {
+		uint16_t const re = (uint16_t)clamp_sample(in[2 * i] * CS12_FULL_SCALE, -2048, 2047) & 0xfff;
+		uint16_t const im = (uint16_t)clamp_sample(in[2 * i + 1] * CS12_FULL_SCALE, -2048, 2047) & 0xfff;
+		out[3 * i] = re & 0xff;
+		out[3 * i + 1] = (re >> 8) | ((im & 0xf) << 4);
+		out[3 * i + 2] = im >> 4;
+	}
+	return 3 * num_samples;
+}
+
+static size_t encode_cf16(float complex const *samples, size_t num_samples, void *outbuf) {
+	float const *in = (float const *)samples;
+	uint16_t *out = outbuf;
+	for(size_t i = 0; i < 2 * num_samples; i++) {
+		out[i] = float_to_half(in[i]);
+	}
+	return 2 * num_samples * sizeof(uint16_t);
+}
+
+static size_t encode_cf32(float complex const *samples, size_t num_samples, void *outbuf) {
+	memcpy(outbuf, samples, num_samples * sizeof(float complex));
+	return num_samples * sizeof(float complex);
+}
+
+#ifdef WITH_AVX2_CONVERTERS
+TARGET_AVX2_F16C static size_t encode_cf16_avx2(float complex const *samples, size_t num_samples, void *outbuf) {
+	float const *in = (float const *)samples;
+	uint16_t *out = outbuf;
+	size_t const len = 2 * num_samples;
+	size_t i = 0;
+	for(; i + 8 <= len; i += 8) {
+		_mm_storeu_si128((__m128i *)(out + i),
+				_mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+	}
+	for(; i < len; i++) {
+		out[i] = float_to_half(in[i]);
+	}
+	return len * sizeof(uint16_t);
+}
+#endif
+
 struct sample_format_params {
 	char const *name;
 	size_t sample_size;                         // octets per complex sample
 	float full_scale;                           // max raw sample value
 	convert_sample_buffer_fun convert_fun;      // sample conversion routine
+	encode_sample_buffer_fun encode_fun;        // sample encoding routine
+#ifdef WITH_AVX2_CONVERTERS
+	convert_sample_buffer_fun convert_fun_avx2; // AVX2 variants (optional)
+	encode_sample_buffer_fun encode_fun_avx2;
+#endif
 };
 
 static struct sample_format_params const sample_format_params[] = {
@@ -109,19 +599,59 @@ static struct sample_format_params const sample_format_params[] = {
 		.name = "CU8",
 		.sample_size = 2 * sizeof(uint8_t),
 		.full_scale = (float)SCHAR_MAX,
-		.convert_fun = convert_cu8
+		.convert_fun = convert_cu8,
+		.encode_fun = encode_cu8
 	},
 	[SFMT_CS16] = {
 		.name = "CS16",
 		.sample_size = 2 * sizeof(int16_t),
 		.full_scale = (float)SHRT_MAX + 0.5f,
-		.convert_fun = convert_cs16
+		.convert_fun = convert_cs16,
+		.encode_fun = encode_cs16,
+#ifdef WITH_AVX2_CONVERTERS
+		.convert_fun_avx2 = convert_cs16_avx2
+#endif
 	},
 	[SFMT_CF32] = {
 		.name = "CF32",
 		.sample_size = 2 * sizeof(float),
 		.full_scale = 1.0f,
-		.convert_fun = convert_cf32
+		.convert_fun = convert_cf32,
+		.encode_fun = encode_cf32,
+#ifdef WITH_AVX2_CONVERTERS
+		.convert_fun_avx2 = convert_cf32_avx2
+#endif
+	},
+	[SFMT_CS8] = {
+		.name = "CS8",
+		.sample_size = 2 * sizeof(int8_t),
+		.full_scale = (float)SCHAR_MAX + 0.5f,
+		.convert_fun = convert_cs8,
+		.encode_fun = encode_cs8,
+#ifdef WITH_AVX2_CONVERTERS
+		.convert_fun_avx2 = convert_cs8_avx2
+#endif
+	},
+	[SFMT_CS12] = {
+		.name = "CS12",
+		.sample_size = 3,
+		.full_scale = CS12_FULL_SCALE,
+		.convert_fun = convert_cs12,
+		.encode_fun = encode_cs12,
+#ifdef WITH_AVX2_CONVERTERS
+		.convert_fun_avx2 = convert_cs12_avx2
+#endif
+	},
+	[SFMT_CF16] = {
+		.name = "CF16",
+		.sample_size = 2 * sizeof(uint16_t),
+		.full_scale = 1.0f,
+		.convert_fun = convert_cf16,
+		.encode_fun = encode_cf16,
+#ifdef WITH_AVX2_CONVERTERS
+		.convert_fun_avx2 = convert_cf16_avx2,
+		.encode_fun_avx2 = encode_cf16_avx2
+#endif
 	}
 };
 
@@ -139,8 +669,64 @@ float get_sample_full_scale_value(sample_format format) {
 	return 0.f;
 }
 
+char const *get_sample_format_name(sample_format format) {
+	if(format > SFMT_UNDEF && format < SFMT_MAX) {
+		return sample_format_params[format].name;
+	}
+	return "unknown";
+}
+
+#ifdef WITH_AVX2_CONVERTERS
+static bool cpu_supports_avx2(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+}
+#endif
+
 convert_sample_buffer_fun get_sample_converter(sample_format format) {
-	return format < SFMT_MAX ? sample_format_params[format].convert_fun : NULL;
+	if(format >= SFMT_MAX) {
+		return NULL;
+	}
+	struct sample_format_params const *p = &sample_format_params[format];
+#ifdef WITH_AVX2_CONVERTERS
+	if(p->convert_fun_avx2 != NULL && cpu_supports_avx2()) {
+		debug_print(D_SDR, "%s: using AVX2 sample converter\n", p->name);
+		return p->convert_fun_avx2;
+	}
+#endif
+	debug_print(D_SDR, "%s: using %s sample converter\n", p->name, CONVERTER_ISA);
+	return p->convert_fun;
+}
+
+encode_sample_buffer_fun get_sample_encoder(sample_format format) {
+	if(format >= SFMT_MAX) {
+		return NULL;
+	}
+	struct sample_format_params const *p = &sample_format_params[format];
+#ifdef WITH_AVX2_CONVERTERS
+	if(p->encode_fun_avx2 != NULL && cpu_supports_avx2()) {
+		debug_print(D_SDR, "%s: using AVX2 sample encoder\n", p->name);
+		return p->encode_fun_avx2;
+	}
+#endif
+	return p->encode_fun;
+}
+
+void sample_lut_init(struct input *input) {
+	ASSERT(input != NULL);
+	float const full_scale = input->full_scale;
+	ASSERT(full_scale > 0.f);
+	switch(input->config->sfmt) {
+		case SFMT_CU8: {
+			float const shift = full_scale / 2.0f;
+			for(int32_t i = 0; i <= UCHAR_MAX; i++) {
+				input->sample_lut[i] = ((float)i - shift) / full_scale;
+			}
+			break;
+		}
+		default:
+			break;
+	}
 }
 
 sample_format sample_format_from_string(char const *str) {
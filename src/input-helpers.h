@@ -3,12 +3,19 @@
 
 #include <stddef.h>             // size_t
 #include <complex.h>            // float complex
-#include "block.h"              // struct circ_buffer
+#include "block.h"              // struct block_connection
 #include "input-common.h"       // sample_format, convert_sample_buffer_fun
 
+// Converts num_samples complex samples to the given sample format.
+// Returns the number of octets written to the output buffer.
+typedef size_t (*encode_sample_buffer_fun)(float complex const *, size_t, void *);
+
 size_t get_sample_size(sample_format format);
 float get_sample_full_scale_value(sample_format format);
+char const *get_sample_format_name(sample_format format);
 convert_sample_buffer_fun get_sample_converter(sample_format format);
+encode_sample_buffer_fun get_sample_encoder(sample_format format);
+void sample_lut_init(struct input *input);
 sample_format sample_format_from_string(char const *str);
-void complex_samples_produce(struct circ_buffer *circ_buffer,
-		float complex *samples, size_t num_samples);
+float complex *complex_samples_reserve(struct block_connection *connection, size_t *num_samples);
+void complex_samples_commit(struct block_connection *connection, size_t num_samples);
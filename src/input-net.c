@@ -0,0 +1,601 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#define _GNU_SOURCE             // recvmmsg
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>              // fprintf
+#include <stdlib.h>             // strtol
+#include <string.h>             // strdup, strerror, strrchr, memmove
+#include <inttypes.h>           // PRIu64
+#include <unistd.h>             // close
+#include <errno.h>              // errno
+#include <sys/types.h>          // socket, connect
+#include <sys/socket.h>         // socket, connect, recv, recvmmsg, setsockopt
+#include <sys/time.h>           // struct timeval
+#include <netdb.h>              // getaddrinfo
+#include "config.h"             // HAVE_RECVMMSG
+#include "block.h"              // block_*
+#include "input-common.h"       // input, sample_format, input_vtable
+#include "input-helpers.h"      // get_sample_full_scale_value, get_sample_size, complex_samples_*
+#include "input-recorder.h"     // recorder_write, recorder_skip
+#include "kvargs.h"             // kvargs_*
+#include "statsd.h"             // statsd_*
+#include "util.h"               // debug_print, ASSERT, XCALLOC, NEW
+#include "globals.h"            // do_exit
+
+#define NET_TCP_BUFSIZE_DEFAULT 65536U
+#define NET_RCVBUF_SIZE_DEFAULT (4U * 1024U * 1024U)
+#define NET_RECV_TIMEOUT_SEC 1
+#define NET_UDP_BATCH_SIZE 32
+#define NET_UDP_DATAGRAM_SIZE_MAX 65536U
+// A sequence number going back by more than this is treated as
+// a restart of the sender rather than a reordered datagram. A jump forward
+// by more than this is not treated as loss either (it is more likely a
+// sender restart or a corrupted header), so no gap is signaled.
+#define NET_UDP_SEQNUM_RESYNC_THRESHOLD 1000U
+
+#define RTLTCP_MAGIC "RTL0"
+#define RTLTCP_HEADER_LEN 12
+#define RTLTCP_CMD_SET_FREQ             0x01
+#define RTLTCP_CMD_SET_SAMPLE_RATE      0x02
+#define RTLTCP_CMD_SET_GAIN_MODE        0x03
+#define RTLTCP_CMD_SET_GAIN             0x04
+#define RTLTCP_CMD_SET_FREQ_CORRECTION  0x05
+#define RTLTCP_CMD_SET_AGC_MODE         0x08
+#define RTLTCP_CMD_SET_DIRECT_SAMPLING  0x09
+#define RTLTCP_CMD_SET_BIAS_TEE         0x0e
+
+typedef enum {
+	NET_UDP_HEADER_NONE,
+	NET_UDP_HEADER_SEQNUM       // 64-bit little-endian datagram counter
+} net_udp_header_type;
+
+struct net_input {
+	struct input input;
+	char *host;
+	char *port;
+	int sockfd;
+	int32_t rcvbuf_size;
+	net_udp_header_type udp_header;
+	// rtl_tcp settings (-1 = don't touch)
+	int32_t rtltcp_direct_sampling;
+	int32_t rtltcp_agc;
+	int32_t rtltcp_bias_tee;
+	// UDP loss accounting
+	uint64_t next_seqnum;
+	bool seqnum_valid;
+	uint64_t datagrams_received;
+	uint64_t datagrams_lost;
+	uint64_t datagrams_out_of_order;
+	uint64_t datagrams_malformed;
+	uint64_t samples_lost;
+	size_t last_datagram_samples;
+};
+
+#ifdef WITH_STATSD
+static char *net_input_counters[] = {
+	"input.net.datagrams.lost",
+	"input.net.datagrams.out_of_order",
+	"input.net.datagrams.malformed",
+	"input.net.samples.lost",
+	NULL
+};
+#endif
+
+struct input *net_input_create(struct input_cfg *cfg) {
+	UNUSED(cfg);
+	NEW(struct net_input, net_input);
+	net_input->sockfd = -1;
+	net_input->rcvbuf_size = NET_RCVBUF_SIZE_DEFAULT;
+	net_input->udp_header = NET_UDP_HEADER_NONE;
+	net_input->rtltcp_direct_sampling = -1;
+	net_input->rtltcp_agc = -1;
+	net_input->rtltcp_bias_tee = -1;
+	return &net_input->input;
+}
+
+void net_input_destroy(struct input *input) {
+	if(input != NULL) {
+		struct net_input *ni = container_of(input, struct net_input, input);
+		if(ni->sockfd >= 0) {
+			close(ni->sockfd);
+		}
+		XFREE(ni->host);
+		XFREE(ni->port);
+		XFREE(ni);
+	}
+}
+
+// Splits source string into host and port parts.
+// Accepted syntax: <host>:<port>, [<ipv6_address>]:<port>
+// and - when host_optional is true - <port>.
+static int32_t net_parse_source(char const *source, bool host_optional, char **host, char **port) {
+	char *sep = strrchr(source, ':');
+	if(sep == NULL) {
+		if(host_optional && source[0] != '\0') {
+			*host = NULL;
+			*port = strdup(source);
+			return 0;
+		}
+		return -1;
+	}
+	if(sep == source || sep[1] == '\0') {
+		return -1;
+	}
+	char const *h = source;
+	size_t hlen = sep - source;
+	if(h[0] == '[' && h[hlen - 1] == ']') {
+		h++;
+		hlen -= 2;
+	}
+	*host = strndup(h, hlen);
+	*port = strdup(sep + 1);
+	return 0;
+}
+
+static bool net_parse_int_setting(kvargs *kv, char const *key, int32_t *result) {
+	char *val = kvargs_get(kv, key);
+	if(val == NULL) {
+		return true;
+	}
+	errno = 0;
+	char *endptr = NULL;
+	long l = strtol(val, &endptr, 10);
+	if(errno != 0 || endptr == val || *endptr != '\0' || l < 0 || l > INT32_MAX) {
+		fprintf(stderr, "Invalid value of device setting '%s': %s\n", key, val);
+		return false;
+	}
+	*result = (int32_t)l;
+	return true;
+}
+
+static int32_t net_parse_device_settings(struct net_input *ni) {
+	struct input_cfg *cfg = ni->input.config;
+	if(cfg->device_settings == NULL) {
+		return 0;
+	}
+	int32_t ret = -1;
+	char *settings = strdup(cfg->device_settings);
+	kvargs_parse_result parsed = kvargs_from_string(settings);
+	if(parsed.err != 0) {
+		fprintf(stderr, "%s: unable to parse --device-settings argument '%s': %s at position %td\n",
+				cfg->source, cfg->device_settings, kvargs_get_errstr(parsed.err), parsed.err_pos + 1);
+		goto end;
+	}
+	kvargs *kv = parsed.result;
+	char *header = kvargs_get(kv, "header");
+	if(header != NULL) {
+		if(strcmp(header, "none") == 0) {
+			ni->udp_header = NET_UDP_HEADER_NONE;
+		} else if(strcmp(header, "seqnum") == 0) {
+			ni->udp_header = NET_UDP_HEADER_SEQNUM;
+		} else {
+			fprintf(stderr, "%s: unknown datagram header type '%s'\n", cfg->source, header);
+			goto end;
+		}
+	}
+	if(net_parse_int_setting(kv, "rcvbuf", &ni->rcvbuf_size) == false ||
+			net_parse_int_setting(kv, "direct_sampling", &ni->rtltcp_direct_sampling) == false ||
+			net_parse_int_setting(kv, "agc", &ni->rtltcp_agc) == false ||
+			net_parse_int_setting(kv, "bias_tee", &ni->rtltcp_bias_tee) == false) {
+		goto end;
+	}
+	ret = 0;
+end:
+	kvargs_destroy(parsed.result);
+	XFREE(settings);
+	return ret;
+}
+
+static void net_socket_setup(struct net_input *ni, int sockfd) {
+	char const *source = ni->input.config->source;
+	// A large receive buffer absorbs scheduling hiccups of the
+	// rx thread, which would otherwise cause packet loss (UDP)
+	// or stall the sender (TCP).
+	int32_t rcvbuf = ni->rcvbuf_size;
+	if(setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) {
+		fprintf(stderr, "%s: could not set socket receive buffer size: %s\n", source, strerror(errno));
+	}
+	socklen_t optlen = sizeof(rcvbuf);
+	if(getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen) == 0) {
+		debug_print(D_SDR, "%s: SO_RCVBUF: requested %d, got %d\n", source, ni->rcvbuf_size, rcvbuf);
+		// Linux doubles the requested value to account for bookkeeping overhead
+		if(rcvbuf < ni->rcvbuf_size) {
+			fprintf(stderr, "%s: warning: socket receive buffer size is %d bytes, "
+					"less than requested %d bytes (check net.core.rmem_max sysctl)\n",
+					source, rcvbuf, ni->rcvbuf_size);
+		}
+	}
+	// Don't block forever, so that the rx thread notices do_exit
+	struct timeval tv = { .tv_sec = NET_RECV_TIMEOUT_SEC, .tv_usec = 0 };
+	if(setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+		fprintf(stderr, "%s: could not set socket receive timeout: %s\n", source, strerror(errno));
+	}
+}
+
+static int net_socket_open(struct net_input *ni, int socktype) {
+	char const *source = ni->input.config->source;
+	struct addrinfo hints, *result, *rptr;
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = socktype;
+	hints.ai_flags = (socktype == SOCK_DGRAM ? AI_PASSIVE : 0);
+	int ret = getaddrinfo(ni->host, ni->port, &hints, &result);
+	if(ret != 0) {
+		fprintf(stderr, "%s: could not resolve address: %s\n", source, gai_strerror(ret));
+		return -1;
+	}
+	int sockfd = -1;
+	for(rptr = result; rptr != NULL; rptr = rptr->ai_next) {
+		sockfd = socket(rptr->ai_family, rptr->ai_socktype, rptr->ai_protocol);
+		if(sockfd == -1) {
+			continue;
+		}
+		// Set the receive buffer size before connecting, so that
+		// a proper TCP window scale gets negotiated
+		net_socket_setup(ni, sockfd);
+		if(socktype == SOCK_DGRAM) {
+			if(bind(sockfd, rptr->ai_addr, rptr->ai_addrlen) == 0) {
+				break;
+			}
+		} else if(connect(sockfd, rptr->ai_addr, rptr->ai_addrlen) == 0) {
+			break;
+		}
+		close(sockfd);
+		sockfd = -1;
+	}
+	freeaddrinfo(result);
+	if(sockfd < 0) {
+		fprintf(stderr, "%s: could not %s: all addresses failed\n", source,
+				socktype == SOCK_DGRAM ? "bind UDP socket" : "connect");
+	}
+	return sockfd;
+}
+
+/**********************************
+ * rtl_tcp
+ **********************************/
+
+static int32_t rtltcp_send_command(struct net_input *ni, uint8_t cmd, uint32_t param) {
+	uint8_t buf[5] = {
+		cmd,
+		(param >> 24) & 0xff,
+		(param >> 16) & 0xff,
+		(param >>  8) & 0xff,
+		param & 0xff
+	};
+	if(send(ni->sockfd, buf, sizeof(buf), 0) != sizeof(buf)) {
+		fprintf(stderr, "%s: failed to send command 0x%02x to rtl_tcp server: %s\n",
+				ni->input.config->source, cmd, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int32_t rtltcp_setup(struct net_input *ni) {
+	struct input_cfg *cfg = ni->input.config;
+	uint8_t header[RTLTCP_HEADER_LEN];
+	if(recv(ni->sockfd, header, sizeof(header), MSG_WAITALL) != sizeof(header)) {
+		fprintf(stderr, "%s: failed to read rtl_tcp header\n", cfg->source);
+		return -1;
+	}
+	if(memcmp(header, RTLTCP_MAGIC, strlen(RTLTCP_MAGIC)) != 0) {
+		fprintf(stderr, "%s: not a rtl_tcp server (bad header magic)\n", cfg->source);
+		return -1;
+	}
+	uint32_t tuner_type = header[4] << 24 | header[5] << 16 | header[6] << 8 | header[7];
+	uint32_t gain_cnt = header[8] << 24 | header[9] << 16 | header[10] << 8 | header[11];
+	fprintf(stderr, "%s: connected to rtl_tcp server (tuner type: %u, gain count: %u)\n",
+			cfg->source, tuner_type, gain_cnt);
+
+	if(ni->rtltcp_direct_sampling >= 0 &&
+			rtltcp_send_command(ni, RTLTCP_CMD_SET_DIRECT_SAMPLING, ni->rtltcp_direct_sampling) < 0) {
+		return -1;
+	}
+	if(rtltcp_send_command(ni, RTLTCP_CMD_SET_SAMPLE_RATE, cfg->sample_rate) < 0 ||
+		rtltcp_send_command(ni, RTLTCP_CMD_SET_FREQ, cfg->centerfreq + cfg->freq_offset) < 0 ||
+		rtltcp_send_command(ni, RTLTCP_CMD_SET_FREQ_CORRECTION, (int32_t)cfg->correction) < 0) {
+		return -1;
+	}
+	fprintf(stderr, "%s: center frequency set to %.3f kHz\n", cfg->source,
+			HZ_TO_KHZ(cfg->centerfreq + cfg->freq_offset));
+	if(cfg->gain != AUTO_GAIN) {
+		if(rtltcp_send_command(ni, RTLTCP_CMD_SET_GAIN_MODE, 1) < 0 ||
+				rtltcp_send_command(ni, RTLTCP_CMD_SET_GAIN, (int32_t)(cfg->gain * 10.0)) < 0) {
+			return -1;
+		}
+		fprintf(stderr, "%s: gain set to %.1f dB\n", cfg->source, cfg->gain);
+	} else {
+		if(rtltcp_send_command(ni, RTLTCP_CMD_SET_GAIN_MODE, 0) < 0) {
+			return -1;
+		}
+		fprintf(stderr, "%s: auto gain enabled\n", cfg->source);
+	}
+	if(ni->rtltcp_agc >= 0 && rtltcp_send_command(ni, RTLTCP_CMD_SET_AGC_MODE, ni->rtltcp_agc) < 0) {
+		return -1;
+	}
+	if(ni->rtltcp_bias_tee >= 0 && rtltcp_send_command(ni, RTLTCP_CMD_SET_BIAS_TEE, ni->rtltcp_bias_tee) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/**********************************
+ * Init
+ **********************************/
+
+int32_t net_input_init(struct input *input) {
+	ASSERT(input != NULL);
+	struct net_input *ni = container_of(input, struct net_input, input);
+	struct input_cfg *cfg = input->config;
+
+	if(net_parse_source(cfg->source, cfg->type == INPUT_TYPE_UDP, &ni->host, &ni->port) < 0) {
+		fprintf(stderr, "%s: invalid network address (must be %s)\n", cfg->source,
+				cfg->type == INPUT_TYPE_UDP ? "[<host>:]<port>" : "<host>:<port>");
+		return -1;
+	}
+	if(net_parse_device_settings(ni) < 0) {
+		return -1;
+	}
+	if(cfg->type == INPUT_TYPE_RTLTCP) {
+		if(cfg->sfmt != SFMT_UNDEF && cfg->sfmt != SFMT_CU8) {
+			fprintf(stderr, "%s: rtl_tcp only supports CU8 sample format\n", cfg->source);
+			return -1;
+		}
+		cfg->sfmt = SFMT_CU8;
+	} else if(cfg->sfmt == SFMT_UNDEF) {
+		fprintf(stderr, "Sample format must be specified for network inputs\n");
+		return -1;
+	}
+	input->full_scale = get_sample_full_scale_value(cfg->sfmt);
+	input->bytes_per_sample = get_sample_size(cfg->sfmt);
+	ASSERT(input->bytes_per_sample > 0);
+
+	ni->sockfd = net_socket_open(ni, cfg->type == INPUT_TYPE_UDP ? SOCK_DGRAM : SOCK_STREAM);
+	if(ni->sockfd < 0) {
+		return -1;
+	}
+	if(cfg->type == INPUT_TYPE_RTLTCP && rtltcp_setup(ni) < 0) {
+		return -1;
+	}
+
+	if(cfg->type == INPUT_TYPE_UDP) {
+		input->block.producer.max_tu = NET_UDP_BATCH_SIZE * NET_UDP_DATAGRAM_SIZE_MAX / input->bytes_per_sample;
+	} else {
+		if(cfg->read_buffer_size <= 0) {
+			cfg->read_buffer_size = NET_TCP_BUFSIZE_DEFAULT;
+		}
+		if(cfg->read_buffer_size < input->bytes_per_sample) {
+			fprintf(stderr, "Invalid --read-buffer-size value (must be at least %d bytes)\n",
+					input->bytes_per_sample);
+			return -1;
+		}
+		input->block.producer.max_tu = cfg->read_buffer_size / input->bytes_per_sample;
+	}
+	debug_print(D_SDR, "%s: host: %s port: %s max_tu=%zu\n", cfg->source,
+			ni->host ? ni->host : "(any)", ni->port, input->block.producer.max_tu);
+	return 0;
+}
+
+/**********************************
+ * Rx threads
+ **********************************/
+
+static void net_tcp_rx_loop(struct net_input *ni) {
+	struct input *input = &ni->input;
+	struct block_connection *output = input->block.producer.out;
+	size_t const bufsize = input->config->read_buffer_size;
+	size_t const bps = input->bytes_per_sample;
+	uint8_t *inbuf = XCALLOC(bufsize, sizeof(uint8_t));
+	size_t leftover = 0;
+
+	while(do_exit == 0) {
+		ssize_t len = recv(ni->sockfd, inbuf + leftover, bufsize - leftover, 0);
+		if(len < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "%s: recv failed: %s\n", input->config->source, strerror(errno));
+			break;
+		} else if(len == 0) {
+			fprintf(stderr, "%s: connection closed by peer\n", input->config->source);
+			break;
+		}
+		// TCP is a byte stream; carry partial samples over to the next read
+		len += leftover;
+		size_t samples_read = len / bps;
+		size_t consumed = samples_read * bps;
+		size_t samples_stored = samples_read;
+		float complex *outbuf = complex_samples_reserve(output, &samples_stored);
+		input->convert_sample_buffer(input, inbuf, samples_stored * bps, outbuf);
+		if(input->recorder != NULL) {
+			recorder_write(input->recorder, inbuf, outbuf, samples_stored);
+			recorder_skip(input->recorder, samples_read - samples_stored);
+		}
+		complex_samples_commit(output, samples_stored);
+		input->block.stats.samples_processed += samples_read;
+		leftover = len - consumed;
+		if(leftover > 0) {
+			memmove(inbuf, inbuf + consumed, leftover);
+		}
+	}
+	XFREE(inbuf);
+}
+
+// Returns the number of samples written to outbuf.
+// Samples which don't fit in outbuf_len are dropped.
+// written is the number of samples already stored in the output buffer
+// in this batch, ie. the position of outbuf relative to the write position.
+static size_t net_udp_process_datagram(struct net_input *ni, uint8_t *buf, size_t len,
+		float complex *outbuf, size_t outbuf_len, size_t written) {
+	struct input *input = &ni->input;
+	ni->datagrams_received++;
+	if(ni->udp_header == NET_UDP_HEADER_SEQNUM) {
+		if(len < sizeof(uint64_t)) {
+			ni->datagrams_malformed++;
+			statsd_increment("input.net.datagrams.malformed");
+			return 0;
+		}
+		uint64_t seqnum = 0;
+		for(int32_t i = sizeof(uint64_t) - 1; i >= 0; i--) {
+			seqnum = seqnum << 8 | buf[i];
+		}
+		buf += sizeof(uint64_t);
+		len -= sizeof(uint64_t);
+		if(ni->seqnum_valid) {
+			if(seqnum > ni->next_seqnum && seqnum - ni->next_seqnum > NET_UDP_SEQNUM_RESYNC_THRESHOLD) {
+				fprintf(stderr, "%s: datagram sequence number jumped from %" PRIu64 " to %" PRIu64
+						", resynchronizing\n", input->config->source, ni->next_seqnum, seqnum);
+			} else if(seqnum > ni->next_seqnum) {
+				uint64_t lost = seqnum - ni->next_seqnum;
+				uint64_t samples_lost = lost * ni->last_datagram_samples;
+				ni->datagrams_lost += lost;
+				ni->samples_lost += samples_lost;
+				statsd_increment_by("input.net.datagrams.lost", lost);
+				statsd_increment_by("input.net.samples.lost", samples_lost);
+				block_connection_one2one_gap_add(input->block.producer.out, written, samples_lost);
+				if(input->recorder != NULL) {
+					recorder_skip(input->recorder, samples_lost);
+				}
+				debug_print(D_SDR, "%s: seqnum gap: expected %" PRIu64 ", got %" PRIu64 " (%" PRIu64 " datagrams lost)\n",
+						input->config->source, ni->next_seqnum, seqnum, lost);
+			} else if(seqnum < ni->next_seqnum && ni->next_seqnum - seqnum <= NET_UDP_SEQNUM_RESYNC_THRESHOLD) {
+				// Samples from this datagram should have been processed already. Drop it.
+				ni->datagrams_out_of_order++;
+				statsd_increment("input.net.datagrams.out_of_order");
+				return 0;
+			} else if(seqnum < ni->next_seqnum) {
+				fprintf(stderr, "%s: datagram sequence number went back from %" PRIu64 " to %" PRIu64
+						", assuming sender restart\n", input->config->source, ni->next_seqnum, seqnum);
+			}
+		}
+		ni->next_seqnum = seqnum + 1;
+		ni->seqnum_valid = true;
+	}
+	size_t const samples_received = len / input->bytes_per_sample;
+	ni->last_datagram_samples = samples_received;
+	size_t samples = samples_received;
+	if(samples > outbuf_len) {
+		samples = outbuf_len;
+	}
+	input->convert_sample_buffer(input, buf, samples * input->bytes_per_sample, outbuf);
+	if(input->recorder != NULL) {
+		recorder_write(input->recorder, buf, outbuf, samples);
+		recorder_skip(input->recorder, samples_received - samples);
+	}
+	return samples;
+}
+
+struct net_udp_batch {
+	uint8_t *buf;
+	size_t len[NET_UDP_BATCH_SIZE];
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[NET_UDP_BATCH_SIZE];
+	struct iovec iovecs[NET_UDP_BATCH_SIZE];
+#endif
+};
+
+static void net_udp_batch_init(struct net_udp_batch *b) {
+	b->buf = XCALLOC(NET_UDP_BATCH_SIZE, NET_UDP_DATAGRAM_SIZE_MAX);
+#ifdef HAVE_RECVMMSG
+	memset(b->msgs, 0, sizeof(b->msgs));
+	for(int32_t i = 0; i < NET_UDP_BATCH_SIZE; i++) {
+		b->iovecs[i].iov_base = b->buf + i * NET_UDP_DATAGRAM_SIZE_MAX;
+		b->iovecs[i].iov_len = NET_UDP_DATAGRAM_SIZE_MAX;
+		b->msgs[i].msg_hdr.msg_iov = &b->iovecs[i];
+		b->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+}
+
+// Receives up to NET_UDP_BATCH_SIZE datagrams with a single system call
+// (if recvmmsg is available). Blocks until at least one datagram arrives
+// or receive timeout expires.
+// Returns the number of datagrams received or -1 on error.
+static int32_t net_udp_batch_receive(int sockfd, struct net_udp_batch *b) {
+#ifdef HAVE_RECVMMSG
+	int32_t cnt = recvmmsg(sockfd, b->msgs, NET_UDP_BATCH_SIZE, MSG_WAITFORONE, NULL);
+	for(int32_t i = 0; i < cnt; i++) {
+		b->len[i] = b->msgs[i].msg_len;
+	}
+	return cnt;
+#else
+	ssize_t len = recv(sockfd, b->buf, NET_UDP_DATAGRAM_SIZE_MAX, 0);
+	if(len < 0) {
+		return -1;
+	}
+	b->len[0] = len;
+	return 1;
+#endif
+}
+
+static void net_udp_rx_loop(struct net_input *ni) {
+	struct input *input = &ni->input;
+	struct block_connection *output = input->block.producer.out;
+	struct net_udp_batch batch;
+	net_udp_batch_init(&batch);
+
+	while(do_exit == 0) {
+		int32_t cnt = net_udp_batch_receive(ni->sockfd, &batch);
+		if(cnt < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "%s: recv failed: %s\n", input->config->source, strerror(errno));
+			break;
+		}
+		size_t const header_len = ni->udp_header == NET_UDP_HEADER_SEQNUM ? sizeof(uint64_t) : 0;
+		size_t batch_samples = 0;
+		for(int32_t i = 0; i < cnt; i++) {
+			if(batch.len[i] > header_len) {
+				batch_samples += (batch.len[i] - header_len) / input->bytes_per_sample;
+			}
+		}
+		size_t space = batch_samples;
+		float complex *outbuf = complex_samples_reserve(output, &space);
+		size_t samples = 0;
+		for(int32_t i = 0; i < cnt; i++) {
+			samples += net_udp_process_datagram(ni, batch.buf + i * NET_UDP_DATAGRAM_SIZE_MAX,
+					batch.len[i], outbuf + samples, space - samples, samples);
+		}
+		complex_samples_commit(output, samples);
+		input->block.stats.samples_processed += batch_samples;
+	}
+	if(ni->udp_header == NET_UDP_HEADER_SEQNUM) {
+		fprintf(stderr, "%s: datagrams received: %" PRIu64 ", lost: %" PRIu64 " (approx. %" PRIu64
+				" samples), out of order: %" PRIu64 ", malformed: %" PRIu64 "\n",
+				input->config->source, ni->datagrams_received, ni->datagrams_lost, ni->samples_lost,
+				ni->datagrams_out_of_order, ni->datagrams_malformed);
+	}
+	XFREE(batch.buf);
+}
+
+void *net_input_thread(void *ctx) {
+	ASSERT(ctx);
+	struct block *block = ctx;
+	struct input *input = container_of(block, struct input, block);
+	struct net_input *ni = container_of(input, struct net_input, input);
+
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(net_input_counters);
+#endif
+	if(input->config->type == INPUT_TYPE_UDP) {
+		net_udp_rx_loop(ni);
+	} else {
+		net_tcp_rx_loop(ni);
+	}
+	close(ni->sockfd);
+	ni->sockfd = -1;
+	// Stop the program if the connection has been lost
+	do_exit = 1;
+	debug_print(D_MISC, "Shutdown ordered, signaling consumer shutdown\n");
+	block_connection_one2one_shutdown(block->producer.out);
+	block->running = false;
+	return NULL;
+}
+
+struct input_vtable const net_input_vtable = {
+	.create = net_input_create,
+	.init = net_input_init,
+	.destroy = net_input_destroy,
+	.rx_thread_routine = net_input_thread
+};
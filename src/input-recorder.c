@@ -0,0 +1,478 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>              // FILE, fopen, fwrite, fprintf, snprintf
+#include <stdlib.h>             // strtol
+#include <string.h>             // memcpy, strcmp, strdup, strerror
+#include <errno.h>              // errno
+#include <inttypes.h>           // PRIu64
+#include <time.h>               // struct tm, gmtime_r, localtime_r, strftime
+#include <sys/time.h>           // struct timeval, gettimeofday
+#include <pthread.h>            // pthread_*
+#ifdef __linux__
+#include <sys/resource.h>       // setpriority
+#endif
+#include "config.h"
+#include "input-common.h"       // struct input, sample_format
+#include "input-helpers.h"      // get_sample_encoder, get_sample_size, sample_format_from_string
+#include "input-file-format.h"  // sigmf_datatype_name
+#include "input-recorder.h"
+#include "sample-clock.h"       // sample_clock_*
+#include "kvargs.h"             // kvargs_*
+#include "globals.h"            // Config
+#include "statsd.h"             // statsd_*
+#include "util.h"               // NEW, XCALLOC, XFREE, ASSERT, debug_print
+#include "thread-sched.h"       // thread_sched_create
+
+// I/Q recording tap.
+// The input thread copies (or encodes) samples into fixed-size blocks of
+// a preallocated pool. Full blocks are queued to a low priority writer
+// thread which stores them in SigMF recordings. When storage can't keep up
+// and the pool runs out of free blocks, the block being filled is discarded
+// instead of stalling the input. The next block then starts a new file, so
+// that the timestamp in the recording metadata stays correct.
+
+#define RECORDER_BLOCK_SIZE (1U << 20)          // octets (approximately)
+#define RECORDER_BUFFER_SIZE_DEFAULT 64         // megabytes
+#define RECORDER_BLOCK_CNT_MIN 4
+#define RECORDER_THREAD_NICE 10
+
+typedef enum {
+	REC_ROT_NONE,
+	REC_ROT_HOURLY,
+	REC_ROT_DAILY
+} recorder_rotation_mode;
+
+struct recorder_block {
+	uint8_t *buf;
+	size_t len;
+	struct timeval start_time;      // timestamp of the first sample in the block
+	bool gap;                       // data has been dropped before this block
+};
+
+struct recorder {
+	char *path_prefix;
+	char const *source;
+	char const *datatype;           // SigMF datatype
+	encode_sample_buffer_fun encode;  // NULL = store input samples unconverted
+	size_t sample_size;
+	int32_t sample_rate;
+	int32_t centerfreq;
+	struct sample_clock const *clock;
+	recorder_rotation_mode rotate;
+	uint64_t max_file_size;         // 0 = unlimited
+
+	struct recorder_block *blocks;
+	int32_t block_cnt;
+	size_t block_size;
+
+	// Used by the input thread only
+	int32_t current;                // index of the block being filled
+	uint64_t sample_pos;
+	bool gap;
+	uint64_t blocks_dropped;
+
+	// Protected by the mutex
+	pthread_mutex_t mutex;
+	pthread_cond_t filled;          // signaled by the input thread when a block is queued
+	pthread_cond_t freed;           // signaled by the writer when a block has been written
+	int32_t tail;                   // oldest queued block
+	int32_t queued;                 // number of queued blocks
+	bool stop;
+
+	// Used by the writer thread only
+	FILE *fh;
+	struct tm current_tm;
+	uint64_t file_len;
+	uint64_t bytes_written;
+	int32_t files_created;
+	bool failed;
+
+	pthread_t thread;
+	bool thread_started;
+};
+
+#ifdef WITH_STATSD
+static char *recorder_counters[] = {
+	"input.record.blocks_written",
+	"input.record.blocks_dropped",
+	NULL
+};
+#endif
+
+static void recorder_localtime(struct timeval const *tv, struct tm *result) {
+	time_t t = tv->tv_sec;
+	if(Config.utc == true) {
+		gmtime_r(&t, result);
+	} else {
+		localtime_r(&t, result);
+	}
+}
+
+static int32_t recorder_write_metadata(struct recorder *r, char const *path,
+		struct timeval const *start_time) {
+	FILE *f = fopen(path, "w");
+	if(f == NULL) {
+		fprintf(stderr, "%s: could not create %s: %s\n", r->source, path, strerror(errno));
+		return -1;
+	}
+	struct tm tm;
+	time_t t = start_time->tv_sec;
+	gmtime_r(&t, &tm);
+	char datetime[32];
+	strftime(datetime, sizeof(datetime), "%Y-%m-%dT%H:%M:%S", &tm);
+	fprintf(f,
+			"{\n"
+			"    \"global\": {\n"
+			"        \"core:datatype\": \"%s\",\n"
+			"        \"core:sample_rate\": %d,\n"
+			"        \"core:version\": \"1.0.0\",\n"
+			"        \"core:recorder\": \"dumphfdl\"\n"
+			"    },\n"
+			"    \"captures\": [\n"
+			"        {\n"
+			"            \"core:sample_start\": 0,\n"
+			"            \"core:frequency\": %d,\n"
+			"            \"core:datetime\": \"%s.%06ldZ\"\n"
+			"        }\n"
+			"    ],\n"
+			"    \"annotations\": []\n"
+			"}\n",
+			r->datatype, r->sample_rate, r->centerfreq, datetime, (long)start_time->tv_usec);
+	if(fclose(f) != 0) {
+		fprintf(stderr, "%s: could not write %s: %s\n", r->source, path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Starts a new recording named after the timestamp of its first sample
+static int32_t recorder_file_open(struct recorder *r, struct timeval const *start_time) {
+	recorder_localtime(start_time, &r->current_tm);
+	char timestamp[32];
+	strftime(timestamp, sizeof(timestamp), "%Y%m%d_%H%M%S", &r->current_tm);
+	size_t const path_len = strlen(r->path_prefix) + strlen(timestamp) + 32;
+	char base[path_len], data_path[path_len + 16], meta_path[path_len + 16];
+	// Recordings may be started more often than once per second
+	// (eg. after a gap), so add a sequence number when necessary
+	for(int32_t seq = 0; ; seq++) {
+		if(seq == 0) {
+			snprintf(base, sizeof(base), "%s_%s", r->path_prefix, timestamp);
+		} else {
+			snprintf(base, sizeof(base), "%s_%s_%d", r->path_prefix, timestamp, seq);
+		}
+		snprintf(data_path, sizeof(data_path), "%s.sigmf-data", base);
+		if((r->fh = fopen(data_path, "wbx")) != NULL) {
+			break;
+		} else if(errno != EEXIST) {
+			fprintf(stderr, "%s: could not create %s: %s\n", r->source, data_path, strerror(errno));
+			return -1;
+		}
+	}
+	snprintf(meta_path, sizeof(meta_path), "%s.sigmf-meta", base);
+	if(recorder_write_metadata(r, meta_path, start_time) < 0) {
+		fclose(r->fh);
+		r->fh = NULL;
+		return -1;
+	}
+	r->file_len = 0;
+	r->files_created++;
+	debug_print(D_MISC, "%s: recording to %s\n", r->source, data_path);
+	return 0;
+}
+
+static bool recorder_file_needs_rotation(struct recorder *r, struct recorder_block const *blk) {
+	if(r->fh == NULL || blk->gap) {
+		return true;
+	}
+	if(r->max_file_size > 0 && r->file_len > 0 && r->file_len + blk->len > r->max_file_size) {
+		return true;
+	}
+	if(r->rotate != REC_ROT_NONE) {
+		struct tm tm;
+		recorder_localtime(&blk->start_time, &tm);
+		return (r->rotate == REC_ROT_HOURLY && tm.tm_hour != r->current_tm.tm_hour) ||
+			(r->rotate == REC_ROT_DAILY && tm.tm_mday != r->current_tm.tm_mday);
+	}
+	return false;
+}
+
+static void recorder_block_store(struct recorder *r, struct recorder_block const *blk) {
+	if(r->failed) {
+		return;
+	}
+	if(recorder_file_needs_rotation(r, blk)) {
+		if(r->fh != NULL) {
+			fclose(r->fh);
+			r->fh = NULL;
+		}
+		if(recorder_file_open(r, &blk->start_time) < 0) {
+			goto fail;
+		}
+	}
+	if(fwrite(blk->buf, 1, blk->len, r->fh) != blk->len) {
+		fprintf(stderr, "%s: could not write recording: %s\n", r->source, strerror(errno));
+		goto fail;
+	}
+	r->file_len += blk->len;
+	r->bytes_written += blk->len;
+	return;
+fail:
+	fprintf(stderr, "%s: recording stopped\n", r->source);
+	if(r->fh != NULL) {
+		fclose(r->fh);
+		r->fh = NULL;
+	}
+	r->failed = true;
+}
+
+static void *recorder_thread(void *ctx) {
+	ASSERT(ctx != NULL);
+	struct recorder *r = ctx;
+#ifdef __linux__
+	// On Linux the nice value is a per-thread attribute
+	if(setpriority(PRIO_PROCESS, 0, RECORDER_THREAD_NICE) < 0) {
+		debug_print(D_MISC, "%s: setpriority failed: %s\n", r->source, strerror(errno));
+	}
+#endif
+	while(true) {
+		pthread_mutex_lock(&r->mutex);
+		while(r->queued == 0 && !r->stop) {
+			pthread_cond_wait(&r->filled, &r->mutex);
+		}
+		if(r->queued == 0) {
+			pthread_mutex_unlock(&r->mutex);
+			break;
+		}
+		// The input thread never touches queued blocks,
+		// so the tail block may be stored without holding the lock.
+		struct recorder_block *blk = &r->blocks[r->tail];
+		pthread_mutex_unlock(&r->mutex);
+
+		recorder_block_store(r, blk);
+		statsd_increment("input.record.blocks_written");
+
+		pthread_mutex_lock(&r->mutex);
+		blk->len = 0;
+		r->tail = (r->tail + 1) % r->block_cnt;
+		r->queued--;
+		pthread_cond_signal(&r->freed);
+		pthread_mutex_unlock(&r->mutex);
+	}
+	if(r->fh != NULL) {
+		fclose(r->fh);
+		r->fh = NULL;
+	}
+	return NULL;
+}
+
+// Passes the current block to the writer thread or discards its contents,
+// if there are no free blocks left.
+static void recorder_block_submit(struct recorder *r, bool wait) {
+	pthread_mutex_lock(&r->mutex);
+	while(wait && r->queued == r->block_cnt - 1) {
+		pthread_cond_wait(&r->freed, &r->mutex);
+	}
+	bool const queued = r->queued < r->block_cnt - 1;
+	if(queued) {
+		r->queued++;
+		r->current = (r->current + 1) % r->block_cnt;
+		pthread_cond_signal(&r->filled);
+	}
+	pthread_mutex_unlock(&r->mutex);
+	if(!queued) {
+		if(r->blocks_dropped++ == 0) {
+			fprintf(stderr, "%s: recording can't keep up, dropping data\n", r->source);
+		}
+		statsd_increment("input.record.blocks_dropped");
+		r->blocks[r->current].len = 0;
+		r->gap = true;
+	}
+}
+
+void recorder_write(struct recorder *r, void const *raw, float complex const *samples, size_t sample_cnt) {
+	ASSERT(r != NULL);
+	uint8_t const *rawptr = raw;
+	while(sample_cnt > 0) {
+		struct recorder_block *blk = &r->blocks[r->current];
+		if(blk->len == 0) {
+			if(sample_clock_is_valid(r->clock)) {
+				sample_clock_get_time(r->clock, r->sample_pos, r->sample_rate, &blk->start_time);
+			} else {
+				gettimeofday(&blk->start_time, NULL);
+			}
+			blk->gap = r->gap;
+			r->gap = false;
+		}
+		size_t n = (r->block_size - blk->len) / r->sample_size;
+		if(n > sample_cnt) {
+			n = sample_cnt;
+		}
+		if(r->encode != NULL) {
+			r->encode(samples, n, blk->buf + blk->len);
+			samples += n;
+		} else {
+			memcpy(blk->buf + blk->len, rawptr, n * r->sample_size);
+			rawptr += n * r->sample_size;
+		}
+		blk->len += n * r->sample_size;
+		r->sample_pos += n;
+		sample_cnt -= n;
+		if(blk->len == r->block_size) {
+			recorder_block_submit(r, false);
+		}
+	}
+}
+
+// Accounts for samples lost before they could be recorded (eg. due to
+// input buffer overruns). Samples recorded so far are flushed and the
+// following ones go to a new file, which gets the correct start time.
+void recorder_skip(struct recorder *r, size_t sample_cnt) {
+	ASSERT(r != NULL);
+	if(sample_cnt == 0) {
+		return;
+	}
+	if(r->blocks[r->current].len > 0) {
+		recorder_block_submit(r, false);
+	}
+	r->gap = true;
+	r->sample_pos += sample_cnt;
+}
+
+static bool recorder_parse_uint(char const *key, char const *str, int32_t *result) {
+	char *endptr = NULL;
+	long val = strtol(str, &endptr, 10);
+	if(endptr == str || *endptr != '\0' || val < 0 || val > INT32_MAX) {
+		fprintf(stderr, "record: invalid %s value: %s\n", key, str);
+		return false;
+	}
+	*result = (int32_t)val;
+	return true;
+}
+
+// Creates a recording tap for the given (initialized) input.
+// spec is a comma-separated list of key=value pairs.
+struct recorder *recorder_create(char const *spec, struct input *input) {
+	ASSERT(spec != NULL);
+	ASSERT(input != NULL);
+	struct input_cfg const *cfg = input->config;
+	char *spec_copy = strdup(spec);
+	kvargs_parse_result kv = kvargs_from_string(spec_copy);
+	XFREE(spec_copy);
+	if(kv.err != 0) {
+		fprintf(stderr, "record: could not parse parameters at position %td: %s\n",
+				kv.err_pos + 1, kvargs_get_errstr(kv.err));
+		return NULL;
+	}
+	NEW(struct recorder, r);
+	r->source = cfg->source;
+	r->sample_rate = cfg->sample_rate;
+	r->centerfreq = cfg->centerfreq;
+	r->clock = &input->block.clock;
+	int32_t buffer_size = RECORDER_BUFFER_SIZE_DEFAULT;
+	int32_t max_file_size = 0;
+
+	char *val;
+	if((val = kvargs_get(kv.result, "path")) == NULL) {
+		fprintf(stderr, "record: path not specified\n");
+		goto fail;
+	}
+	r->path_prefix = strdup(val);
+	// Store input samples unconverted, unless they need to be converted
+	// to a different format or can't be stored in SigMF recordings
+	sample_format sfmt = cfg->sfmt;
+	if((val = kvargs_get(kv.result, "format")) != NULL) {
+		if((sfmt = sample_format_from_string(val)) == SFMT_UNDEF) {
+			fprintf(stderr, "record: unknown sample format: %s\n", val);
+			goto fail;
+		}
+	} else if(sigmf_datatype_name(sfmt) == NULL) {
+		sfmt = SFMT_CS16;
+	}
+	if((r->datatype = sigmf_datatype_name(sfmt)) == NULL) {
+		fprintf(stderr, "record: sample format %s is not supported\n", get_sample_format_name(sfmt));
+		goto fail;
+	}
+	if(sfmt != cfg->sfmt) {
+		r->encode = get_sample_encoder(sfmt);
+		ASSERT(r->encode != NULL);
+	}
+	r->sample_size = get_sample_size(sfmt);
+	if((val = kvargs_get(kv.result, "rotate")) != NULL) {
+		if(!strcmp(val, "hourly")) {
+			r->rotate = REC_ROT_HOURLY;
+		} else if(!strcmp(val, "daily")) {
+			r->rotate = REC_ROT_DAILY;
+		} else {
+			fprintf(stderr, "record: invalid rotation mode: %s\n", val);
+			goto fail;
+		}
+	}
+	if((val = kvargs_get(kv.result, "max_size")) != NULL &&
+			recorder_parse_uint("max_size", val, &max_file_size) == false) {
+		goto fail;
+	}
+	r->max_file_size = (uint64_t)max_file_size * 1024 * 1024;
+	if((val = kvargs_get(kv.result, "buffer")) != NULL &&
+			recorder_parse_uint("buffer", val, &buffer_size) == false) {
+		goto fail;
+	}
+
+	r->block_size = RECORDER_BLOCK_SIZE / r->sample_size * r->sample_size;
+	r->block_cnt = max((int32_t)((uint64_t)buffer_size * 1024 * 1024 / r->block_size), RECORDER_BLOCK_CNT_MIN);
+	r->blocks = XCALLOC(r->block_cnt, sizeof(struct recorder_block));
+	for(int32_t i = 0; i < r->block_cnt; i++) {
+		r->blocks[i].buf = XCALLOC(r->block_size, sizeof(uint8_t));
+	}
+	pthread_mutex_init(&r->mutex, NULL);
+	pthread_cond_init(&r->filled, NULL);
+	pthread_cond_init(&r->freed, NULL);
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(recorder_counters);
+#endif
+	int32_t ret = thread_sched_create(&r->thread, THREAD_CLASS_OUTPUT, recorder_thread, r);
+	if(ret != 0) {
+		fprintf(stderr, "%s: failed to start recording thread: %s\n", r->source, strerror(ret));
+		goto fail;
+	}
+	r->thread_started = true;
+	kvargs_destroy(kv.result);
+	fprintf(stderr, "%s: recording %s samples to %s_*.sigmf-data (buffer: %d blocks of %zu bytes)\n",
+			r->source, get_sample_format_name(sfmt), r->path_prefix, r->block_cnt, r->block_size);
+	return r;
+fail:
+	kvargs_destroy(kv.result);
+	recorder_destroy(r);
+	return NULL;
+}
+
+// Stores remaining data and stops the writer thread.
+// Must be called after the input thread has finished.
+void recorder_destroy(struct recorder *r) {
+	if(r == NULL) {
+		return;
+	}
+	if(r->thread_started) {
+		if(r->blocks[r->current].len > 0) {
+			recorder_block_submit(r, true);
+		}
+		pthread_mutex_lock(&r->mutex);
+		r->stop = true;
+		pthread_cond_signal(&r->filled);
+		pthread_mutex_unlock(&r->mutex);
+		pthread_join(r->thread, NULL);
+		pthread_mutex_destroy(&r->mutex);
+		pthread_cond_destroy(&r->filled);
+		pthread_cond_destroy(&r->freed);
+		fprintf(stderr, "%s: recorded %" PRIu64 " bytes in %d file(s), %" PRIu64 " blocks dropped\n",
+				r->source, r->bytes_written, r->files_created, r->blocks_dropped);
+	}
+	if(r->blocks != NULL) {
+		for(int32_t i = 0; i < r->block_cnt; i++) {
+			XFREE(r->blocks[i].buf);
+		}
+		XFREE(r->blocks);
+	}
+	XFREE(r->path_prefix);
+	XFREE(r);
+}
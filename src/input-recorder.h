@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stddef.h>             // size_t
+#include <complex.h>            // float complex
+
+struct input;
+struct recorder;
+
+struct recorder *recorder_create(char const *spec, struct input *input);
+void recorder_write(struct recorder *r, void const *raw, float complex const *samples, size_t sample_cnt);
+void recorder_skip(struct recorder *r, size_t sample_cnt);
+void recorder_destroy(struct recorder *r);
@@ -1,9 +1,14 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include <stdio.h>              // fprintf()
 #include <stdint.h>
-#include <stdlib.h>             // atof()
-#include <string.h>             // strcmp()
+#include <stdbool.h>
+#include <stdlib.h>             // atof(), llabs()
+#include <string.h>             // strcmp(), strerror()
 #include <unistd.h>             // usleep()
+#include <inttypes.h>           // PRIu64
+#include <stdatomic.h>          // atomic_*
+#include <pthread.h>            // pthread_*
+#include <sys/time.h>           // gettimeofday
 #include <SoapySDR/Version.h>   // SOAPY_SDR_API_VERSION
 #include <SoapySDR/Types.h>     // SoapySDRKwargs_*
 #include <SoapySDR/Device.h>    // SoapySDRStream, SoapySDRDevice_*
@@ -11,14 +16,72 @@
 #include "globals.h"            // do_exit
 #include "block.h"              // block_*
 #include "input-common.h"       // input, sample_format, input_vtable
-#include "input-helpers.h"      // get_sample_full_scale_value, get_sample_size
+#include "input-helpers.h"      // get_sample_full_scale_value, get_sample_size, complex_samples_*
+#include "input-recorder.h"     // recorder_write, recorder_skip
+#include "sample-clock.h"       // sample_clock_*
+#include "statsd.h"             // statsd_*
 #include "util.h"               // XCALLOC, XFREE, container_of, HZ_TO_KHZ
+#include "thread-sched.h"       // thread_sched_create
+
+// Number of raw sample buffers (each one holding up to MTU samples)
+// which may be queued between the receiver thread and the converter.
+#define SOAPYSDR_RX_POOL_SIZE 32
+
+// A new sample clock anchor is recorded when buffer timestamp departs
+// from the one predicted from the sample count by more than this.
+// Host timestamps jitter with scheduling delays, hence a larger tolerance.
+#define SOAPYSDR_CLOCK_TOLERANCE_HW_NS 1000LL
+#define SOAPYSDR_CLOCK_TOLERANCE_HOST_NS 10000000LL
+
+struct soapysdr_rx_buf {
+	void *data;                     // raw samples in device format
+	int32_t sample_cnt;
+	int32_t flags;
+	long long timeNs;               // timestamp of the first sample (ns since the Epoch)
+	uint64_t lost;                  // samples lost just before this buffer
+};
+
+// The receiver thread only calls readStream and fills buffers from the pool.
+// The converter thread (the input block thread) converts them to complex
+// floats and passes them downstream. The pool is a single-producer,
+// single-consumer ring indexed by free-running counters, so the receiver
+// never takes a lock unless the converter is sleeping on an empty pool.
+struct soapysdr_rx_pool {
+	struct soapysdr_rx_buf bufs[SOAPYSDR_RX_POOL_SIZE];
+	void *scratch;                  // readStream target when the pool is full
+	atomic_size_t head;             // next buffer to fill (written by the receiver)
+	atomic_size_t tail;             // next buffer to convert (written by the converter)
+	atomic_bool converter_waiting;
+	atomic_bool rx_done;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;            // signaled when a buffer has been filled
+	// Counters updated by the receiver and exported by the converter
+	atomic_uint_fast64_t overflows;         // SOAPY_SDR_OVERFLOW errors reported by the driver
+	atomic_uint_fast64_t pool_overruns;     // buffers dropped due to the pool being full
+	atomic_uint_fast64_t samples_dropped;   // samples in the above buffers
+};
 
 struct soapysdr_input {
 	struct input input;
 	SoapySDRDevice *sdr;
 	SoapySDRStream *stream;
+	struct soapysdr_rx_pool pool;
+	pthread_t rx_thread;
+	long long hw_time_offset;       // host time minus device time (receiver thread only)
+	bool hw_time_offset_valid;
+	long long anchor_ns;            // last sample clock anchor (converter thread only)
+	uint64_t anchor_pos;
+	bool anchor_valid;
+};
+
+#ifdef WITH_STATSD
+static char *soapysdr_input_counters[] = {
+	"input.soapysdr.overflows",
+	"input.soapysdr.pool_overruns",
+	"input.soapysdr.samples_dropped",
+	NULL
 };
+#endif
 
 struct input *soapysdr_input_create(struct input_cfg *cfg) {
 	UNUSED(cfg);
@@ -208,6 +271,23 @@ int32_t soapysdr_input_init(struct input *input) {
 	}
 
 	input->block.producer.max_tu = SoapySDRDevice_getStreamMTU(sdr, stream);
+	struct soapysdr_rx_pool *pool = &soapysdr_input->pool;
+	for(int32_t i = 0; i < SOAPYSDR_RX_POOL_SIZE; i++) {
+		pool->bufs[i].data = XCALLOC(input->block.producer.max_tu, input->bytes_per_sample);
+	}
+	pool->scratch = XCALLOC(input->block.producer.max_tu, input->bytes_per_sample);
+	atomic_init(&pool->head, 0);
+	atomic_init(&pool->tail, 0);
+	atomic_init(&pool->converter_waiting, false);
+	atomic_init(&pool->rx_done, false);
+	atomic_init(&pool->overflows, 0);
+	atomic_init(&pool->pool_overruns, 0);
+	atomic_init(&pool->samples_dropped, 0);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	sample_clock_anchors_create(&input->block.clock);
+	debug_print(D_SDR, "%s: MTU: %zu samples, rx pool size: %d buffers\n",
+			cfg->source, input->block.producer.max_tu, SOAPYSDR_RX_POOL_SIZE);
 	soapysdr_input->sdr = sdr;
 	soapysdr_input->stream = stream;
 	return 0;
@@ -216,20 +296,206 @@ int32_t soapysdr_input_init(struct input *input) {
 void soapysdr_input_destroy(struct input *input) {
 	if(input != NULL) {
 		struct soapysdr_input *si = container_of(input, struct soapysdr_input, input);
+		for(int32_t i = 0; i < SOAPYSDR_RX_POOL_SIZE; i++) {
+			XFREE(si->pool.bufs[i].data);
+		}
+		XFREE(si->pool.scratch);
+		sample_clock_anchors_destroy(&si->input.block.clock);
 		XFREE(si);
 	}
 }
 
 #define SOAPYSDR_READSTREAM_TIMEOUT_US 1000000L
 
+static void soapysdr_rx_pool_wake_converter(struct soapysdr_rx_pool *pool, bool force) {
+	if(force || atomic_load(&pool->converter_waiting)) {
+		pthread_mutex_lock(&pool->mutex);
+		pthread_cond_signal(&pool->cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+
+// Returns the timestamp of the first sample of a buffer which has just been read.
+// Device time is converted to host time with an offset measured on the first
+// timestamped buffer. If the driver does not provide timestamps, the time of
+// reception (minus the buffer duration) is used, which is still free of
+// any processing delays further down the pipeline.
+static long long soapysdr_buf_timestamp(struct soapysdr_input *si, int32_t flags,
+		long long timeNs, int32_t sample_cnt) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	long long const now_ns = now.tv_sec * 1000000000LL + now.tv_usec * 1000LL;
+	long long const duration_ns = sample_cnt * 1000000000LL / si->input.config->sample_rate;
+	if((flags & SOAPY_SDR_HAS_TIME) == 0) {
+		return now_ns - duration_ns;
+	}
+	if(!si->hw_time_offset_valid) {
+		si->hw_time_offset = now_ns - duration_ns - timeNs;
+		si->hw_time_offset_valid = true;
+		debug_print(D_SDR, "%s: using device timestamps, offset to host time: %lld ns\n",
+				si->input.config->source, si->hw_time_offset);
+	}
+	return timeNs + si->hw_time_offset;
+}
+
+// Receiver thread - keeps the device stream drained and does nothing else.
+// When the converter falls behind and the pool gets full, samples are read
+// into a scratch buffer and discarded, so that the device buffer never
+// overflows because of a stall further down the pipeline.
+// The number of samples lost before each buffer (discarded ones plus those
+// lost in device overflows, estimated from buffer timestamps) is passed
+// to the converter, which signals it downstream as a gap.
+static void *soapysdr_rx_thread(void *ctx) {
+	ASSERT(ctx);
+	struct soapysdr_input *soapysdr_input = ctx;
+	struct input *input = &soapysdr_input->input;
+	struct soapysdr_rx_pool *pool = &soapysdr_input->pool;
+	size_t const mtu = input->block.producer.max_tu;
+	uint64_t const sample_rate = input->config->sample_rate;
+	uint64_t lost = 0;
+	bool overflow = false;
+	long long next_timeNs = 0;      // expected timestamp of the next buffer (0 = unknown)
+
+	while(do_exit == 0) {
+		size_t const head = atomic_load_explicit(&pool->head, memory_order_relaxed);
+		size_t const tail = atomic_load_explicit(&pool->tail, memory_order_acquire);
+		bool const pool_full = head - tail == SOAPYSDR_RX_POOL_SIZE;
+		struct soapysdr_rx_buf *buf = &pool->bufs[head % SOAPYSDR_RX_POOL_SIZE];
+		void *data = pool_full ? pool->scratch : buf->data;
+		int32_t flags = 0;
+		long long timeNs = 0;
+		int32_t samples_read = SoapySDRDevice_readStream(soapysdr_input->sdr, soapysdr_input->stream,
+				&data, mtu, &flags, &timeNs, SOAPYSDR_READSTREAM_TIMEOUT_US);
+		if(samples_read < 0) {	// when it's negative, it's the error code
+			if(samples_read == SOAPY_SDR_OVERFLOW) {
+				atomic_fetch_add_explicit(&pool->overflows, 1, memory_order_relaxed);
+				overflow = true;
+			} else if(samples_read != SOAPY_SDR_TIMEOUT) {
+				fprintf(stderr, "SoapySDR device '%s': readStream failed: %s\n",
+						input->config->source, SoapySDR_errToStr(samples_read));
+			}
+			continue;
+		}
+		if(samples_read == 0) {
+			continue;
+		}
+		long long const buf_timeNs = soapysdr_buf_timestamp(soapysdr_input, flags, timeNs, samples_read);
+		if(overflow && next_timeNs != 0 && buf_timeNs > next_timeNs) {
+			lost += (uint64_t)(buf_timeNs - next_timeNs) * sample_rate / 1000000000ULL;
+		}
+		overflow = false;
+		next_timeNs = buf_timeNs + (long long)((uint64_t)samples_read * 1000000000ULL / sample_rate);
+		if(pool_full) {
+			atomic_fetch_add_explicit(&pool->pool_overruns, 1, memory_order_relaxed);
+			atomic_fetch_add_explicit(&pool->samples_dropped, samples_read, memory_order_relaxed);
+			lost += samples_read;
+			continue;
+		}
+		buf->sample_cnt = samples_read;
+		buf->flags = flags;
+		buf->timeNs = buf_timeNs;
+		buf->lost = lost;
+		lost = 0;
+		// Publish the buffer, then check if the converter needs a wakeup.
+		// Both operations are sequentially consistent, pairing with
+		// the store to converter_waiting and the load of head
+		// in soapysdr_rx_pool_get, so that a wakeup is never lost.
+		atomic_store(&pool->head, head + 1);
+		soapysdr_rx_pool_wake_converter(pool, false);
+	}
+	atomic_store(&pool->rx_done, true);
+	soapysdr_rx_pool_wake_converter(pool, true);
+	return NULL;
+}
+
+// Returns the oldest filled buffer from the pool, waiting for one if necessary.
+// Returns NULL when the pool is empty and the receiver thread has finished.
+static struct soapysdr_rx_buf *soapysdr_rx_pool_get(struct soapysdr_rx_pool *pool) {
+	size_t const tail = atomic_load_explicit(&pool->tail, memory_order_relaxed);
+	while(atomic_load_explicit(&pool->head, memory_order_acquire) == tail) {
+		if(atomic_load(&pool->rx_done)) {
+			// Recheck, the receiver might have published a buffer before finishing
+			if(atomic_load(&pool->head) == tail) {
+				return NULL;
+			}
+			break;
+		}
+		pthread_mutex_lock(&pool->mutex);
+		atomic_store(&pool->converter_waiting, true);
+		if(atomic_load(&pool->head) == tail && !atomic_load(&pool->rx_done)) {
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		}
+		atomic_store(&pool->converter_waiting, false);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	return &pool->bufs[tail % SOAPYSDR_RX_POOL_SIZE];
+}
+
+static void soapysdr_rx_pool_release(struct soapysdr_rx_pool *pool) {
+	atomic_fetch_add_explicit(&pool->tail, 1, memory_order_release);
+}
+
+// Records a sample clock anchor for the buffer starting at sample_pos
+// if its timestamp does not match the time base (eg. after samples have
+// been lost due to an overflow or a pool overrun).
+static void soapysdr_update_clock(struct soapysdr_input *si, struct soapysdr_rx_buf const *buf,
+		uint64_t sample_pos) {
+	long long const tolerance = (buf->flags & SOAPY_SDR_HAS_TIME) ?
+		SOAPYSDR_CLOCK_TOLERANCE_HW_NS : SOAPYSDR_CLOCK_TOLERANCE_HOST_NS;
+	if(si->anchor_valid) {
+		long long const predicted = si->anchor_ns +
+			(long long)((sample_pos - si->anchor_pos) * 1000000000ULL / si->input.config->sample_rate);
+		if(llabs(buf->timeNs - predicted) <= tolerance) {
+			return;
+		}
+		debug_print(D_SDR, "%s: time base adjusted by %lld ns at sample %" PRIu64 "\n",
+				si->input.config->source, buf->timeNs - predicted, sample_pos);
+	}
+	si->anchor_ns = buf->timeNs;
+	si->anchor_pos = sample_pos;
+	si->anchor_valid = true;
+	struct timeval const tv = {
+		.tv_sec = buf->timeNs / 1000000000LL,
+		.tv_usec = buf->timeNs % 1000000000LL / 1000LL
+	};
+	sample_clock_add_anchor(&si->input.block.clock, sample_pos, si->input.config->sample_rate, &tv);
+}
+
+struct soapysdr_counters {
+	uint64_t overflows, pool_overruns, samples_dropped;
+};
+
+// Exports counter increments since the last call
+static void soapysdr_update_counters(struct soapysdr_rx_pool *pool, struct soapysdr_counters *last) {
+	struct soapysdr_counters const now = {
+		.overflows = atomic_load_explicit(&pool->overflows, memory_order_relaxed),
+		.pool_overruns = atomic_load_explicit(&pool->pool_overruns, memory_order_relaxed),
+		.samples_dropped = atomic_load_explicit(&pool->samples_dropped, memory_order_relaxed)
+	};
+	if(now.overflows != last->overflows) {
+		statsd_increment_by("input.soapysdr.overflows", now.overflows - last->overflows);
+	}
+	if(now.pool_overruns != last->pool_overruns) {
+		statsd_increment_by("input.soapysdr.pool_overruns", now.pool_overruns - last->pool_overruns);
+		statsd_increment_by("input.soapysdr.samples_dropped", now.samples_dropped - last->samples_dropped);
+	}
+	*last = now;
+}
+
 void *soapysdr_input_thread(void *ctx) {
 	ASSERT(ctx);
 	struct block *block = ctx;
 	struct input *input = container_of(block, struct input, block);
 	struct soapysdr_input *soapysdr_input = container_of(input, struct soapysdr_input, input);
-	void *inbuf = XCALLOC(input->block.producer.max_tu, input->bytes_per_sample);
-	float complex *outbuf = XCALLOC(input->block.producer.max_tu, sizeof(float complex));
+	struct soapysdr_rx_pool *pool = &soapysdr_input->pool;
+	struct block_connection *output = block->producer.out;
+	struct soapysdr_counters counters = {0};
+	uint64_t sample_pos = 0;
+	bool rx_thread_started = false;
 	int32_t ret;
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(soapysdr_input_counters);
+#endif
 	if((ret = SoapySDRDevice_activateStream(soapysdr_input->sdr, soapysdr_input->stream, 0, 0, 0)) != 0) {
 		fprintf(stderr, "Failed to activate stream for SoapySDR device '%s': %s\n",
 			input->config->source, SoapySDR_errToStr(ret));
@@ -237,29 +503,61 @@ void *soapysdr_input_thread(void *ctx) {
 		goto shutdown;
 	}
 	usleep(100000);
+	if((ret = thread_sched_create(&soapysdr_input->rx_thread, THREAD_CLASS_INPUT,
+			soapysdr_rx_thread, soapysdr_input)) != 0) {
+		fprintf(stderr, "%s: failed to start receiver thread: %s\n",
+				input->config->source, strerror(ret));
+		do_exit = 1;
+		goto shutdown;
+	}
+	rx_thread_started = true;
 
-	while(do_exit == 0) {
-		int32_t flags;
-		long long timeNs;
-		int32_t samples_read = SoapySDRDevice_readStream(soapysdr_input->sdr, soapysdr_input->stream, &inbuf,
-			input->block.producer.max_tu, &flags, &timeNs, SOAPYSDR_READSTREAM_TIMEOUT_US);
-		if(samples_read < 0) {	// when it's negative, it's the error code
-			fprintf(stderr, "SoapySDR device '%s': readStream failed: %s\n",
-				input->config->source, SoapySDR_errToStr(samples_read));
-			continue;
+	struct soapysdr_rx_buf *buf = NULL;
+	while((buf = soapysdr_rx_pool_get(pool)) != NULL) {
+		// Samples lost by the receiver thread still count into the position
+		// of the following ones, so that timestamps stay correct
+		if(buf->lost > 0) {
+			block_connection_one2one_gap_add(output, 0, buf->lost);
+			if(input->recorder != NULL) {
+				recorder_skip(input->recorder, buf->lost);
+			}
+			sample_pos += buf->lost;
 		}
-		input->convert_sample_buffer(input, inbuf, samples_read * input->bytes_per_sample, outbuf);
-		complex_samples_produce(&input->block.producer.out->circ_buffer, outbuf, samples_read);
+		soapysdr_update_clock(soapysdr_input, buf, sample_pos);
+		size_t samples = buf->sample_cnt;
+		block->stats.samples_processed += samples;
+		float complex *outbuf = complex_samples_reserve(output, &samples);
+		input->convert_sample_buffer(input, buf->data, samples * input->bytes_per_sample, outbuf);
+		if(input->recorder != NULL) {
+			recorder_write(input->recorder, buf->data, outbuf, samples);
+			recorder_skip(input->recorder, buf->sample_cnt - samples);
+		}
+		complex_samples_commit(output, samples);
+		// Samples dropped by complex_samples_reserve() due to a full output
+		// buffer are signaled downstream as a gap by the block layer, so they
+		// still count into the position of the following ones
+		sample_pos += buf->sample_cnt;
+		soapysdr_rx_pool_release(pool);
+		soapysdr_update_counters(pool, &counters);
 	}
 shutdown:
 	debug_print(D_MISC, "Shutdown ordered, signaling consumer shutdown\n");
+	if(rx_thread_started) {
+		pthread_join(soapysdr_input->rx_thread, NULL);
+	}
+	soapysdr_update_counters(pool, &counters);
+	if(counters.overflows > 0 || counters.pool_overruns > 0) {
+		fprintf(stderr, "%s: device overflows: %" PRIu64 ", rx pool overruns: %" PRIu64
+				" (%" PRIu64 " samples dropped)\n", input->config->source,
+				counters.overflows, counters.pool_overruns, counters.samples_dropped);
+	}
 	SoapySDRDevice_deactivateStream(soapysdr_input->sdr, soapysdr_input->stream, 0, 0);
 	SoapySDRDevice_closeStream(soapysdr_input->sdr, soapysdr_input->stream);
 	SoapySDRDevice_unmake(soapysdr_input->sdr);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->cond);
 	block_connection_one2one_shutdown(block->producer.out);
 	block->running = false;
-	XFREE(inbuf);
-	XFREE(outbuf);
 	return NULL;
 }
 
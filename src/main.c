@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include <stdint.h>
+#include <inttypes.h>           // PRIu64
 #include <stdio.h>
 #include <stdlib.h>             // strtol, strtof
 #define _GNU_SOURCE             // getopt_long
@@ -8,7 +9,9 @@
 #include <signal.h>             // sigaction, SIG*
 #include <string.h>             // strlen, strsep
 #include <math.h>               // roundf
-#include <unistd.h>             // usleep
+#include <unistd.h>             // usleep, sysconf
+#include <time.h>               // clock_gettime
+#include <sys/time.h>           // gettimeofday
 #include <libacars/libacars.h>  // la_config_set_int
 #include <libacars/acars.h>     // LA_ACARS_BEARER_HFDL
 #include <libacars/list.h>      // la_list
@@ -20,18 +23,47 @@
 #include "globals.h"            // do_exit, Systable
 #include "block.h"              // block_*
 #include "libcsdr.h"            // compute_filter_relative_transition_bw
-#include "fft.h"                // csdr_fft_init, csdr_fft_destroy, fft_create
+#include "fft.h"                // csdr_fft_*, fft_create, fft_prepare
+#include "decimator.h"          // decimator_*
 #include "util.h"               // ASSERT
 #include "ac_cache.h"           // ac_cache_create, ac_cache_destroy
 #include "ac_data.h"            // ac_data_create, ac_data_destroy
 #include "input-common.h"       // sample_format_t, input_create
 #include "input-helpers.h"      // sample_format_from_string
+#include "input-file.h"         // file_input_*
 #include "output-common.h"      // output_*, fmtr_*
 #include "kvargs.h"             // kvargs
 #include "hfdl.h"               // hfdl_channel_create
 #include "pdu.h"                // hfdl_pdu_*
 #include "systable.h"           // systable_*
 #include "statsd.h"             // statsd_*
+#include "sample-clock.h"       // sample_clock_*
+#include "worker-pool.h"        // worker_pool_*
+#include "thread-sched.h"       // thread_sched_*
+
+// Segments shorter than this number of overlap lengths are not worth the effort
+#define SEGMENT_LEN_MIN_OVERLAPS 4
+
+// Default --lag-warning threshold (seconds)
+#define LAG_WARNING_DEFAULT 2.0
+
+// With --stage-fusion auto, live inputs up to this sample rate are processed
+// by a single thread up to (and including) the FFT
+#define STAGE_FUSION_AUTO_MAX_SAMPLE_RATE 500000
+
+// Input -> [decimator ->] FFT -> channels processing chain
+struct pipeline {
+	struct input_cfg *input_cfg;
+	int32_t *frequencies;
+	int32_t channel_cnt;
+	int32_t pre_decimation;         // -1 = disabled, 0 = auto
+	int32_t stage_fusion;           // -1 = auto, 0 = off, 1 = on
+	struct block *input;
+	struct block *decimator;
+	struct block *fft;
+	struct block **channels;
+	bool finished;
+};
 
 typedef struct {
 	char *output_spec_string;
@@ -211,6 +243,65 @@ static bool parse_frequency(char const *str, int32_t *result) {
 	return true;
 }
 
+static bool parse_overflow_policy(char const *str, int32_t *result) {
+	ASSERT(str != NULL);
+	ASSERT(result != NULL);
+	static char const *names[BLOCK_OVERFLOW_POLICY_CNT] = {
+		[BLOCK_OVERFLOW_BLOCK] = "block",
+		[BLOCK_OVERFLOW_DROP_NEWEST] = "drop-newest",
+		[BLOCK_OVERFLOW_DROP_OLDEST] = "drop-oldest"
+	};
+	for(int32_t i = 0; i < BLOCK_OVERFLOW_POLICY_CNT; i++) {
+		if(!strcmp(str, names[i])) {
+			*result = i;
+			return true;
+		}
+	}
+	fprintf(stderr, "Invalid --overflow-policy value '%s': must be block, drop-newest or drop-oldest\n", str);
+	return false;
+}
+
+static bool parse_fft_planner_effort(char const *str, int32_t *result) {
+	ASSERT(str != NULL);
+	ASSERT(result != NULL);
+	static char const *names[FFT_PLANNER_EFFORT_CNT] = {
+		[FFT_PLANNER_ESTIMATE] = "estimate",
+		[FFT_PLANNER_MEASURE] = "measure",
+		[FFT_PLANNER_PATIENT] = "patient"
+	};
+	for(int32_t i = 0; i < FFT_PLANNER_EFFORT_CNT; i++) {
+		if(!strcmp(str, names[i])) {
+			*result = i;
+			return true;
+		}
+	}
+	fprintf(stderr, "Invalid --fft-planner value '%s': must be estimate, measure or patient\n", str);
+	return false;
+}
+
+// Parses a comma-separated list of frequencies (in kHz).
+// Returns the number of frequencies or -1 on error.
+static int32_t parse_frequency_list(char const *str, int32_t **result) {
+	ASSERT(str != NULL);
+	ASSERT(result != NULL);
+	char *list = strdup(str);
+	char *ptr = list, *token = NULL;
+	int32_t cnt = 0;
+	int32_t *freqs = NULL;
+	while((token = strsep(&ptr, ",")) != NULL) {
+		freqs = XREALLOC(freqs, (cnt + 1) * sizeof(int32_t));
+		if(parse_frequency(token, &freqs[cnt]) == false) {
+			XFREE(freqs);
+			XFREE(list);
+			return -1;
+		}
+		cnt++;
+	}
+	XFREE(list);
+	*result = freqs;
+	return cnt;
+}
+
 static bool check_frequency_span(int32_t *freqs, int32_t cnt, int32_t centerfreq, int32_t source_rate) {
 	ASSERT(freqs);
 	int32_t half_bandwidth = source_rate / 2;
@@ -238,6 +329,524 @@ static bool compute_centerfreq(int32_t *freqs, int32_t cnt, int32_t *result) {
 	return true;
 }
 
+static double timespec_diff(struct timespec const *start, struct timespec const *end) {
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void print_block_stats(char const *name, struct block *block) {
+	struct block_stats const *s = &block->stats;
+	struct block_metrics m;
+	block_get_metrics(block, &m);
+	fprintf(stderr, "%-16s %12" PRIu64 " samples in, %12" PRIu64 " out, CPU time: %8.3f s, %7.3f Msamples/s, "
+			"waiting for input: %8.3f s, output: %8.3f s\n",
+			name, m.samples_in, m.samples_out, s->cpu_time,
+			s->cpu_time > 0.0 ? m.samples_in / s->cpu_time / 1e6 : 0.0,
+			m.input_wait_ns / 1e9, m.output_wait_ns / 1e9);
+	if(m.output_drops > 0) {
+		fprintf(stderr, "%-16s %12" PRIu64 " samples lost in %" PRIu64 " output buffer overruns\n",
+				"", m.output_samples_dropped, m.output_drops);
+	}
+	if(block->lag_max > 0.0) {
+		fprintf(stderr, "%-16s %12.3f s maximum lag\n", "", block->lag_max);
+	}
+}
+
+// Returns how far (in seconds) the block is behind real time. For live
+// inputs with a known time base this is measured against the wall clock,
+// so that it includes delays in the device driver and the input itself.
+// Otherwise it's measured against the current position of the input.
+// Returns a negative value if the lag can't be computed.
+static double pipeline_block_lag(struct pipeline *p, struct block *block, struct timeval const *now) {
+	struct timeval block_time, ref_time;
+	if(!block_get_stream_time(block, &block_time)) {
+		return -1.0;
+	}
+	if(p->input_cfg->type != INPUT_TYPE_FILE && sample_clock_is_valid(&p->input->clock)) {
+		ref_time = *now;
+	} else if(!block_get_stream_time(p->input, &ref_time)) {
+		return -1.0;
+	}
+	double const lag = (ref_time.tv_sec - block_time.tv_sec) + (ref_time.tv_usec - block_time.tv_usec) / 1e6;
+	return lag > 0.0 ? lag : 0.0;
+}
+
+// Updates the maximum lag of all blocks of the pipeline and warns about
+// blocks falling behind the input by more than the given threshold (seconds).
+// Files may be read faster than real time, so being behind the reader is
+// not a problem and file inputs are skipped.
+static void pipeline_check_lag(struct pipeline *p, double threshold) {
+	if(p->input_cfg->type == INPUT_TYPE_FILE) {
+		return;
+	}
+	struct block *blocks[3 + p->channel_cnt];
+	char const *names[3 + p->channel_cnt];
+	int32_t block_cnt = 0;
+	blocks[block_cnt] = p->input; names[block_cnt++] = "input";
+	if(p->decimator != NULL) {
+		blocks[block_cnt] = p->decimator; names[block_cnt++] = "decimator";
+	}
+	blocks[block_cnt] = p->fft; names[block_cnt++] = "fft";
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	for(int32_t i = 0; i < block_cnt + p->channel_cnt; i++) {
+		struct block *block = i < block_cnt ? blocks[i] : p->channels[i - block_cnt];
+		double const lag = pipeline_block_lag(p, block, &now);
+		if(lag < 0.0) {
+			continue;
+		}
+		block->lag_max = max(block->lag_max, lag);
+		if(threshold <= 0.0) {
+			continue;
+		}
+		char name[32];
+		if(i < block_cnt) {
+			snprintf(name, sizeof(name), "%s", names[i]);
+		} else {
+			snprintf(name, sizeof(name), "channel %.3f", HZ_TO_KHZ(p->frequencies[i - block_cnt]));
+		}
+		if(!block->lag_warned && lag > threshold) {
+			fprintf(stderr, "%s: %s is %.1f seconds behind real time, samples may soon be lost\n",
+					p->input_cfg->source, name, lag);
+			block->lag_warned = true;
+		} else if(block->lag_warned && lag < threshold / 2.0) {
+			fprintf(stderr, "%s: %s has caught up with real time\n", p->input_cfg->source, name);
+			block->lag_warned = false;
+		}
+	}
+}
+
+static void print_processing_stats(struct timespec const *start, struct timespec const *end,
+		int32_t pipeline_cnt, struct pipeline pipelines[pipeline_cnt]) {
+	double wall_time = timespec_diff(start, end);
+	double signal_time = 0.0;
+	for(int32_t i = 0; i < pipeline_cnt; i++) {
+		signal_time += (double)pipelines[i].input->stats.samples_processed /
+			pipelines[i].input_cfg->sample_rate;
+	}
+	fprintf(stderr, "Processed %.3f seconds of I/Q data in %.3f seconds (%.2fx real time)\n",
+			signal_time, wall_time, wall_time > 0.0 ? signal_time / wall_time : 0.0);
+}
+
+// Prints the counters of all processing blocks, so that the bottleneck
+// of the pipeline may be found
+static void print_pipeline_stats(int32_t pipeline_cnt, struct pipeline pipelines[pipeline_cnt], bool segmented) {
+	char name[32];
+	for(int32_t i = 0; i < pipeline_cnt; i++) {
+		struct pipeline *p = &pipelines[i];
+		if(segmented) {
+			fprintf(stderr, "Segment %d:\n", i);
+		} else if(pipeline_cnt > 1) {
+			fprintf(stderr, "Input %s:\n", p->input_cfg->source);
+		}
+		print_block_stats("input", p->input);
+		if(p->decimator != NULL) {
+			print_block_stats("decimator", p->decimator);
+		}
+		print_block_stats("fft", p->fft);
+		for(int32_t j = 0; j < p->channel_cnt; j++) {
+			snprintf(name, sizeof(name), "channel %.3f", HZ_TO_KHZ(p->frequencies[j]));
+			print_block_stats(name, p->channels[j]);
+		}
+	}
+}
+
+#ifdef WITH_STATSD
+#define BLOCK_METRICS_INTERVAL 10       // seconds
+
+// Sends the increase of block counters since the previous call,
+// current buffer fill levels and lag to StatsD
+static void report_block_metrics(char const *prefix, struct pipeline *p, struct block *block,
+		struct timeval const *now) {
+	struct block_metrics m;
+	block_get_metrics(block, &m);
+	struct block_metrics *prev = &block->metrics_reported;
+	char metric[256];
+	snprintf(metric, sizeof(metric), "%s.samples_in", prefix);
+	statsd_increment_by(metric, m.samples_in - prev->samples_in);
+	snprintf(metric, sizeof(metric), "%s.samples_out", prefix);
+	statsd_increment_by(metric, m.samples_out - prev->samples_out);
+	// Wait times are reported in whole milliseconds. The remainder
+	// is carried over to the next report.
+	uint64_t input_wait_ms = (m.input_wait_ns - prev->input_wait_ns) / 1000000;
+	uint64_t output_wait_ms = (m.output_wait_ns - prev->output_wait_ns) / 1000000;
+	snprintf(metric, sizeof(metric), "%s.input_wait_ms", prefix);
+	statsd_increment_by(metric, input_wait_ms);
+	snprintf(metric, sizeof(metric), "%s.output_wait_ms", prefix);
+	statsd_increment_by(metric, output_wait_ms);
+	if(m.output_drops != prev->output_drops) {
+		snprintf(metric, sizeof(metric), "%s.output_drops", prefix);
+		statsd_increment_by(metric, m.output_drops - prev->output_drops);
+		snprintf(metric, sizeof(metric), "%s.output_samples_dropped", prefix);
+		statsd_increment_by(metric, m.output_samples_dropped - prev->output_samples_dropped);
+	}
+	if(m.input_fill >= 0.0f) {
+		snprintf(metric, sizeof(metric), "%s.input_fill_pct", prefix);
+		statsd_set(metric, (size_t)(m.input_fill * 100.0f));
+	}
+	if(m.output_fill >= 0.0f) {
+		snprintf(metric, sizeof(metric), "%s.output_fill_pct", prefix);
+		statsd_set(metric, (size_t)(m.output_fill * 100.0f));
+	}
+	double const lag = pipeline_block_lag(p, block, now);
+	if(lag >= 0.0) {
+		snprintf(metric, sizeof(metric), "%s.lag_ms", prefix);
+		statsd_set(metric, (size_t)(lag * 1000.0));
+	}
+	prev->samples_in = m.samples_in;
+	prev->samples_out = m.samples_out;
+	prev->output_drops = m.output_drops;
+	prev->output_samples_dropped = m.output_samples_dropped;
+	prev->input_wait_ns += input_wait_ms * 1000000;
+	prev->output_wait_ns += output_wait_ms * 1000000;
+}
+
+static void report_pipeline_metrics(int32_t pipeline_cnt, struct pipeline pipelines[pipeline_cnt]) {
+	char prefix[64];
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	for(int32_t i = 0; i < pipeline_cnt; i++) {
+		struct pipeline *p = &pipelines[i];
+		snprintf(prefix, sizeof(prefix), "blocks.%d.input", i);
+		report_block_metrics(prefix, p, p->input, &now);
+		if(p->decimator != NULL) {
+			snprintf(prefix, sizeof(prefix), "blocks.%d.decimator", i);
+			report_block_metrics(prefix, p, p->decimator, &now);
+		}
+		snprintf(prefix, sizeof(prefix), "blocks.%d.fft", i);
+		report_block_metrics(prefix, p, p->fft, &now);
+		for(int32_t j = 0; j < p->channel_cnt; j++) {
+			snprintf(prefix, sizeof(prefix), "channels.%d.block", p->frequencies[j]);
+			report_block_metrics(prefix, p, p->channels[j], &now);
+		}
+	}
+}
+#endif
+
+// Returns the number of segments to split the input file into
+// or -1 if the input can't be split.
+static int32_t compute_segment_cnt(struct block *input, int32_t sample_rate, int32_t requested_cnt) {
+	int64_t sample_cnt = file_input_get_sample_cnt(input);
+	if(sample_cnt < 0) {
+		fprintf(stderr, "--parallel-segments requires a regular uncompressed file as input\n");
+		return -1;
+	}
+	int64_t segment_cnt = requested_cnt > 0 ? requested_cnt : sysconf(_SC_NPROCESSORS_ONLN);
+	int64_t max_segment_cnt = sample_cnt / (SEGMENT_LEN_MIN_OVERLAPS * hfdl_segment_overlap(sample_rate));
+	if(segment_cnt > max_segment_cnt) {
+		segment_cnt = max(max_segment_cnt, 1);
+		if(requested_cnt > 0) {
+			fprintf(stderr, "Input file is too short for %d segments, using %" PRId64 "\n",
+					requested_cnt, segment_cnt);
+		}
+	}
+	return (int32_t)segment_cnt;
+}
+
+// Creates a worker pool and moves all channel blocks onto it.
+// requested_cnt < 0 means one worker per CPU core (but not more than
+// there are channels), 0 means no pool (one thread per channel).
+static struct worker_pool *setup_worker_pool(int32_t pipeline_cnt, struct pipeline pipelines[pipeline_cnt],
+		int32_t requested_cnt) {
+	if(requested_cnt == 0) {
+		return NULL;
+	}
+	int32_t channel_cnt = 0;
+	for(int32_t i = 0; i < pipeline_cnt; i++) {
+		channel_cnt += pipelines[i].channel_cnt;
+	}
+	int32_t thread_cnt = requested_cnt;
+	if(thread_cnt < 0) {
+		int64_t cpu_cnt = sysconf(_SC_NPROCESSORS_ONLN);
+		thread_cnt = cpu_cnt > 0 && cpu_cnt < channel_cnt ? (int32_t)cpu_cnt : channel_cnt;
+	}
+	struct worker_pool *pool = worker_pool_create(thread_cnt, THREAD_CLASS_CHANNEL);
+	if(pool == NULL) {
+		return NULL;
+	}
+	for(int32_t i = 0; i < pipeline_cnt; i++) {
+		for(int32_t j = 0; j < pipelines[i].channel_cnt; j++) {
+			block_set_worker_pool(pipelines[i].channels[j], pool);
+		}
+	}
+	debug_print(D_MISC, "%d channels running on %d worker threads\n", channel_cnt, thread_cnt);
+	return pool;
+}
+
+// Splits the input file into segment_cnt segments and creates an input
+// for each of them. Each segment except the first one starts a bit earlier,
+// so that frames crossing segment boundaries are not lost.
+static int32_t setup_segment_inputs(struct block *input, int32_t sample_rate,
+		int32_t segment_cnt, struct pipeline pipelines[segment_cnt]) {
+	int64_t sample_cnt = file_input_get_sample_cnt(input);
+	int64_t overlap = hfdl_segment_overlap(sample_rate);
+	int64_t segment_len = (sample_cnt + segment_cnt - 1) / segment_cnt;
+	// Segment outputs are merged in timestamp order, so a consistent
+	// time base is needed even if the recording does not provide one.
+	if(!sample_clock_is_valid(&input->clock)) {
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		sample_clock_set_start(&input->clock, &now);
+		fprintf(stderr, "Recording start time unknown, timestamps will be relative to the current time\n");
+	}
+	pipelines[0].input = input;
+	for(int32_t i = 1; i < segment_cnt; i++) {
+		// All segments share the configuration of the original input
+		pipelines[i].input_cfg = pipelines[0].input_cfg;
+		pipelines[i].frequencies = pipelines[0].frequencies;
+		pipelines[i].channel_cnt = pipelines[0].channel_cnt;
+		pipelines[i].pre_decimation = pipelines[0].pre_decimation;
+		pipelines[i].stage_fusion = pipelines[0].stage_fusion;
+		if((pipelines[i].input = file_input_clone(input)) == NULL ||
+				input_init(pipelines[i].input) < 0) {
+			return -1;
+		}
+	}
+	for(int32_t i = 0; i < segment_cnt; i++) {
+		int64_t start = i * segment_len;
+		int64_t end = start + segment_len < sample_cnt ? start + segment_len : sample_cnt;
+		if(i > 0) {
+			start -= overlap;
+		}
+		if(file_input_set_segment(pipelines[i].input, start, end - start) < 0) {
+			return -1;
+		}
+	}
+	fprintf(stderr, "Decoding in %d parallel segments, %.1f seconds each\n",
+			segment_cnt, (double)segment_len / sample_rate);
+	return 0;
+}
+
+// Adds a new input to the pipeline list and returns its configuration.
+// The first input is created before the command line is parsed, so that
+// input options given before the input itself apply to it (this is how
+// the program has always worked with a single input).
+static struct input_cfg *pipeline_add_input(struct pipeline **pipelines, int32_t *input_cnt,
+		struct input_cfg *current) {
+	if(current != NULL && current->type == INPUT_TYPE_UNDEF) {
+		return current;
+	}
+	*pipelines = XREALLOC(*pipelines, (*input_cnt + 1) * sizeof(struct pipeline));
+	struct pipeline *p = &(*pipelines)[*input_cnt];
+	memset(p, 0, sizeof(struct pipeline));
+	p->input_cfg = input_cfg_create();
+	p->pre_decimation = -1;
+	p->stage_fusion = -1;
+	(*input_cnt)++;
+	return p->input_cfg;
+}
+
+// Validates channel frequencies of the input and computes its
+// center frequency, if not given.
+static bool pipeline_check_frequencies(struct pipeline *p) {
+	struct input_cfg *cfg = p->input_cfg;
+	if(cfg->centerfreq < 0) {
+		if(compute_centerfreq(p->frequencies, p->channel_cnt, &cfg->centerfreq) == true) {
+			fprintf(stderr, "%s: computed center frequency: %.3f kHz\n", cfg->source, HZ_TO_KHZ(cfg->centerfreq));
+		} else {
+			fprintf(stderr, "%s: failed to compute center frequency\n", cfg->source);
+			return false;
+		}
+	}
+	return check_frequency_span(p->frequencies, p->channel_cnt, cfg->centerfreq, cfg->sample_rate);
+}
+
+// Each channel must be handled by exactly one input, otherwise every
+// message would be decoded and output more than once.
+static bool check_duplicate_frequencies(int32_t input_cnt, struct pipeline pipelines[input_cnt]) {
+	for(int32_t i = 0; i < input_cnt; i++) {
+		for(int32_t j = 0; j < pipelines[i].channel_cnt; j++) {
+			int32_t freq = pipelines[i].frequencies[j];
+			for(int32_t k = i; k < input_cnt; k++) {
+				for(int32_t l = (k == i ? j + 1 : 0); l < pipelines[k].channel_cnt; l++) {
+					if(pipelines[k].frequencies[l] == freq) {
+						fprintf(stderr, "Channel frequency %.3f kHz given more than once\n", HZ_TO_KHZ(freq));
+						return false;
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+
+// Creates a pre-decimation block, if requested and possible, and updates
+// sample rate and center frequency to the values seen after decimation.
+static int32_t pipeline_create_decimator(struct pipeline *p, int32_t *sample_rate, int32_t *centerfreq) {
+	struct input_cfg *input_cfg = p->input_cfg;
+	// Center the decimator passband on the channel span. Leave enough room
+	// around the outermost channels for the channelizer filters.
+	int32_t span_center = 0;
+	compute_centerfreq(p->frequencies, p->channel_cnt, &span_center);
+	int32_t passband = 0;
+	for(int32_t i = 0; i < p->channel_cnt; i++) {
+		passband = max(passband, abs(p->frequencies[i] - span_center));
+	}
+	passband += HFDL_SYMBOL_RATE * SPS;
+	int32_t max_rate = decimator_max_rate(input_cfg->sample_rate, passband, HFDL_SYMBOL_RATE * SPS);
+	int32_t decimation = p->pre_decimation == 0 ? max_rate : p->pre_decimation;
+	if(decimation > max_rate) {
+		fprintf(stderr, "%s: pre-decimation rate %d is too high for this sample rate and channel span "
+				"(maximum: %d)\n", input_cfg->source, decimation, max_rate);
+		return -1;
+	}
+	if(decimation < 2) {
+		fprintf(stderr, "%s: pre-decimation not possible for this sample rate and channel span, disabling\n",
+				input_cfg->source);
+		return 0;
+	}
+	p->decimator = decimator_create(input_cfg->sample_rate, decimation, passband,
+			input_cfg->centerfreq - span_center);
+	*sample_rate = input_cfg->sample_rate / decimation;
+	*centerfreq = span_center;
+	fprintf(stderr, "%s: pre-decimation rate: %d, sample rate after decimation: %d, "
+			"center frequency: %.3f kHz\n", input_cfg->source, decimation, *sample_rate,
+			HZ_TO_KHZ(span_center));
+	return 0;
+}
+
+static int32_t pipeline_create(struct pipeline *p, int32_t segment) {
+	ASSERT(p->input != NULL);
+	struct input_cfg *input_cfg = p->input_cfg;
+	int32_t sample_rate = input_cfg->sample_rate;
+	int32_t centerfreq = input_cfg->centerfreq;
+	if(p->pre_decimation >= 0 && pipeline_create_decimator(p, &sample_rate, &centerfreq) < 0) {
+		return -1;
+	}
+	int32_t fft_decimation_rate = compute_fft_decimation_rate(sample_rate, HFDL_SYMBOL_RATE * SPS);
+	ASSERT(fft_decimation_rate > 0);
+#ifdef DEBUG
+	int32_t sample_rate_post_fft = roundf((float)sample_rate / (float)fft_decimation_rate);
+#endif
+	float transition_bw = compute_filter_relative_transition_bw(sample_rate, HFDL_CHANNEL_TRANSITION_BW_HZ);
+	debug_print(D_DSP, "%s: fft_decimation_rate: %d sample_rate_post_fft: %d transition_bw: %.f\n",
+			input_cfg->source, fft_decimation_rate, sample_rate_post_fft, transition_bw);
+
+	p->fft = fft_create(fft_decimation_rate, transition_bw);
+	if(p->fft == NULL) {
+		return -1;
+	}
+	p->channels = XCALLOC(p->channel_cnt, sizeof(struct block *));
+	for(int32_t i = 0; i < p->channel_cnt; i++) {
+		p->channels[i] = hfdl_channel_create(sample_rate, fft_decimation_rate,
+				transition_bw, centerfreq, p->frequencies[i]);
+		if(p->channels[i] == NULL) {
+			fprintf(stderr, "Failed to initialize channel %.3f kHz\n",
+					HZ_TO_KHZ(p->frequencies[i]));
+			return -1;
+		}
+		hfdl_channel_set_segment(p->channels[i], segment);
+	}
+	if(p->decimator != NULL) {
+		if(block_connect_one2one(p->input, p->decimator) != 1 ||
+				block_connect_one2one(p->decimator, p->fft) != 1) {
+			return -1;
+		}
+	} else if(block_connect_one2one(p->input, p->fft) != 1) {
+		return -1;
+	}
+	// Files may be read at any pace, so nothing needs to be dropped.
+	// Live inputs can't wait, so drop the samples which can't be processed in time.
+	int32_t overflow_policy = input_cfg->overflow_policy;
+	if(overflow_policy < 0) {
+		overflow_policy = input_cfg->type == INPUT_TYPE_FILE ? BLOCK_OVERFLOW_BLOCK : BLOCK_OVERFLOW_DROP_NEWEST;
+	}
+	block_connection_set_overflow_policy(p->input->producer.out, overflow_policy);
+	if(block_connect_one2many(p->fft, p->channel_cnt, p->channels) != p->channel_cnt) {
+		return -1;
+	}
+	// Plan the FFT now, as it may take a while and inputs can't wait once started
+	fft_prepare(p->fft);
+	// Sample rates seen by the blocks, for the lag monitor
+	p->input->sample_rate = input_cfg->sample_rate;
+	if(p->decimator != NULL) {
+		p->decimator->sample_rate = input_cfg->sample_rate;
+	}
+	p->fft->sample_rate = sample_rate;
+	for(int32_t i = 0; i < p->channel_cnt; i++) {
+		p->channels[i]->sample_rate = sample_rate;
+	}
+	// At low sample rates a thread per stage costs more in wakeups and
+	// cache transfers than the stages themselves, so run them on the input
+	// thread. Files are read as fast as the consumers go, so separate
+	// threads help there.
+	bool fuse = p->stage_fusion == 1 || (p->stage_fusion < 0 &&
+			input_cfg->type != INPUT_TYPE_FILE && input_cfg->sample_rate <= STAGE_FUSION_AUTO_MAX_SAMPLE_RATE);
+	if(fuse) {
+		if(p->decimator != NULL) {
+			block_fuse_with_producer(p->decimator);
+		}
+		block_fuse_with_producer(p->fft);
+		debug_print(D_MISC, "%s: stage fusion enabled\n", input_cfg->source);
+	}
+	return 0;
+}
+
+static int32_t pipeline_start(struct pipeline *p) {
+	if(block_set_start(p->channel_cnt, p->channels) != p->channel_cnt ||
+		block_start(p->fft) != 1 ||
+		(p->decimator != NULL && block_start(p->decimator) != 1) ||
+		block_start(p->input) != 1) {
+		return -1;
+	}
+	return 0;
+}
+
+static bool pipeline_is_running(struct pipeline *p) {
+	return block_is_running(p->input) ||
+		(p->decimator != NULL && block_is_running(p->decimator)) ||
+		block_is_running(p->fft) ||
+		block_set_is_any_running(p->channel_cnt, p->channels);
+}
+
+static void pipeline_destroy(struct pipeline *p) {
+	block_disconnect_one2many(p->fft, p->channel_cnt, p->channels);
+	if(p->decimator != NULL) {
+		block_disconnect_one2one(p->decimator, p->fft);
+		block_disconnect_one2one(p->input, p->decimator);
+	} else {
+		block_disconnect_one2one(p->input, p->fft);
+	}
+	for(int32_t i = 0; i < p->channel_cnt; i++) {
+		hfdl_channel_destroy(p->channels[i]);
+	}
+	XFREE(p->channels);
+	input_destroy(p->input);
+	decimator_destroy(p->decimator);
+	fft_destroy(p->fft);
+}
+
+static bool pipelines_are_running(int32_t pipeline_cnt, struct pipeline pipelines[pipeline_cnt]) {
+	for(int32_t i = 0; i < pipeline_cnt; i++) {
+		if(pipeline_is_running(&pipelines[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns true when all pipelines have processed all of their input.
+// When segments are being merged, notifies the PDU decoder
+// about every finished segment.
+static bool pipelines_finished(int32_t pipeline_cnt, struct pipeline pipelines[pipeline_cnt],
+		bool segmented) {
+	bool all_finished = true;
+	for(int32_t i = 0; i < pipeline_cnt; i++) {
+		struct pipeline *p = &pipelines[i];
+		if(p->finished) {
+			continue;
+		}
+		if(pipeline_is_running(p)) {
+			all_finished = false;
+		} else {
+			p->finished = true;
+			if(segmented) {
+				hfdl_pdu_decoder_segment_done(i);
+			}
+		}
+	}
+	return all_finished;
+}
+
 static void usage() {
 	fprintf(stderr, "Usage:\n");
 #ifdef WITH_SOAPYSDR
@@ -248,6 +857,12 @@ static void usage() {
 	fprintf(stderr, "\nRead I/Q samples from file:\n\n"
 			"%*sdumphfdl [output_options] --iq-file <input_iq_file> [iq_file_options] <freq_1> [<freq_2> [...]]\n",
 			IND(1), "");
+	fprintf(stderr, "\nReceive I/Q samples over the network:\n\n"
+			"%*sdumphfdl [output_options] --rtltcp|--iq-tcp|--iq-udp <address> [network_options] <freq_1> [<freq_2> [...]]\n",
+			IND(1), "");
+	fprintf(stderr, "\nMultiple inputs (eg. several receivers covering different HF bands):\n\n"
+			"%*sdumphfdl [output_options] <input_1> [input_1_options] --channels <freq_list> <input_2> [input_2_options] --channels <freq_list> [...]\n",
+			IND(1), "");
 	fprintf(stderr, "\nGeneral options:\n");
 	describe_option("--help", "Displays this text", 1);
 	describe_option("--version", "Displays program version number", 1);
@@ -259,6 +874,9 @@ static void usage() {
 #endif
 	fprintf(stderr, "common options:\n");
 	describe_option("<freq_1> [<freq_2> [...]]", "HFDL channel frequencies, in kHz, as floating point numbers", 1);
+	describe_option("--channels <freq_1>,<freq_2>,...", "HFDL channel frequencies to decode from the preceding input (alternative to the above)", 1);
+	describe_option("", "Input options apply to the most recently given input (options given before", 1);
+	describe_option("", "the first input apply to the first input)", 1);
 #ifdef WITH_SOAPYSDR
 	fprintf(stderr, "\nsoapysdr_options:\n");
 	describe_option("--soapysdr <device_string>", "Use SoapySDR compatible device identified with the given string", 1);
@@ -277,9 +895,50 @@ static void usage() {
 	describe_option("--centerfreq <float>", "Center frequency of the input data, in kHz (default: auto)", 1);
 	describe_option("--sample-format <sample_format>", "Input sample format. Supported formats:", 1);
 	describe_option("CU8", "8-bit unsigned (eg. recorded with rtl_sdr)", 2);
+	describe_option("CS8", "8-bit signed (eg. HackRF)", 2);
 	describe_option("CS16", "16-bit signed, little-endian (eg. recorded with sdrplay)", 2);
+	describe_option("CS12", "12-bit signed, packed (3 bytes per I/Q sample)", 2);
+	describe_option("CF16", "16-bit float (IEEE half precision), little-endian", 2);
 	describe_option("CF32", "32-bit float, little-endian (eg. Airspy HF+)", 2);
 	describe_option("--read-buffer-size <integer>", "Number of bytes to read from file in one batch", 1);
+	describe_option("--parallel-segments <integer>", "Split the file into this many segments and decode them in parallel (0 - one per CPU core)", 1);
+
+	fprintf(stderr, "\nsignal processing options (all input types):\n");
+	describe_option("--pre-decimation <integer>|auto", "Reduce the sample rate by this factor (a power of 2) before channelizing (default: off)", 1);
+	describe_option("", "auto: use the highest factor that still fits the channel span", 1);
+	describe_option("--overflow-policy <policy>", "What to do with new samples when the decoder can't keep up with the input:", 1);
+	describe_option("block", "Wait until there is room for them (default for files)", 2);
+	describe_option("drop-newest", "Drop the new samples (default for receivers and network inputs)", 2);
+	describe_option("drop-oldest", "Drop the oldest samples waiting for processing", 2);
+	describe_option("--stage-fusion off|on|auto", "Run pre-decimation and FFT on the input thread instead of separate ones", 1);
+	describe_option("", "(default: auto - on for receivers and network inputs with sample rate up to 500 ksps)", 1);
+
+	fprintf(stderr, "\nrecording options (receivers and network inputs):\n");
+	describe_option("--record <key1=val1,key2=val2,...>", "Record I/Q samples of the input to SigMF files in the background. Parameters:", 1);
+	describe_option("path=<string>", "File name prefix (required)", 2);
+	describe_option("format=<sample_format>", "CU8, CS8, CS16, CF16 or CF32 (default: input format, if possible, otherwise CS16)", 2);
+	describe_option("rotate=hourly|daily", "How often to start a new file (default: never)", 2);
+	describe_option("max_size=<integer>", "Start a new file when this size (in megabytes) is reached (default: no limit)", 2);
+	describe_option("buffer=<integer>", "Memory for buffering data which can't be written yet, in megabytes (default: 64)", 2);
+
+	fprintf(stderr, "\nnetwork_options:\n");
+	describe_option("--rtltcp <host>:<port>", "Receive I/Q samples from rtl_tcp server", 1);
+	describe_option("--iq-tcp <host>:<port>", "Receive raw I/Q sample stream from TCP server", 1);
+	describe_option("--iq-udp [<address>:]<port>", "Receive raw I/Q samples sent as UDP datagrams to the given local address and port", 1);
+	describe_option("--device-settings <key1=val1,key2=val2,...>", "Set input-specific parameters (default: none). Supported settings:", 1);
+	describe_option("rcvbuf=<integer>", "Socket receive buffer size, in bytes (default: 4194304)", 2);
+	describe_option("header=none|seqnum", "UDP datagram header type (default: none)", 2);
+	describe_option("", "seqnum: 64-bit little-endian datagram sequence number, enables loss detection", 2);
+	describe_option("direct_sampling=<integer>", "rtl_tcp: set direct sampling mode (0 - off, 1 - I branch, 2 - Q branch)", 2);
+	describe_option("agc=0|1", "rtl_tcp: disable/enable RTL2832 digital AGC", 2);
+	describe_option("bias_tee=0|1", "rtl_tcp: disable/enable bias tee", 2);
+	describe_option("--sample-rate <integer>", "Set sampling rate (samples per second)", 1);
+	describe_option("--sample-format <sample_format>", "Input sample format (--iq-tcp and --iq-udp only, see above)", 1);
+	describe_option("--centerfreq <float>", "Center frequency of the receiver, in kHz (default: auto)", 1);
+	describe_option("--gain <float>", "rtl_tcp: set gain (decibels) (default: auto)", 1);
+	describe_option("--freq-correction <float>", "rtl_tcp: set freq correction (ppm)", 1);
+	describe_option("--freq-offset <float>", "rtl_tcp: frequency offset in kHz (to be used with upconverters)", 1);
+	describe_option("--read-buffer-size <integer>", "TCP only: number of bytes to read from the socket in one batch", 1);
 
 	fprintf(stderr, "\nOutput options:\n");
 	describe_option("--output <output_specifier>", "Output specification (default: " DEFAULT_OUTPUT ")", 1);
@@ -312,6 +971,22 @@ static void usage() {
 	fprintf(stderr, "\nEtsy StatsD options:\n");
 	describe_option("--statsd <host>:<port>", "Send statistics to Etsy StatsD server <host>:<port>", 1);
 #endif
+
+	fprintf(stderr, "\nPerformance options:\n");
+	describe_option("--worker-threads <integer>|auto", "Number of threads decoding HFDL channels (default: auto)", 1);
+	describe_option("", "auto: one per CPU core, 0: a separate thread for each channel", 1);
+	describe_option("--cpu-affinity <thread_class>=<cpu_list>", "Run threads of the given class only on the given CPUs (eg. channels=2-5,8)", 1);
+	describe_option("", "Thread classes: input, fft, channels, decoder, output. May be used multiple times.", 1);
+	describe_option("--rt-priority <integer>", "Run input threads with real-time (SCHED_FIFO) priority and lock memory", 1);
+	describe_option("--fft-wisdom <path>", "Load FFTW wisdom (results of FFT plan benchmarks) from this file and save it back on exit", 1);
+	describe_option("--fft-planner <effort>", "How hard to look for the fastest FFT plans on startup:", 1);
+	describe_option("estimate", "Use heuristics, start immediately (default without --fft-wisdom)", 2);
+	describe_option("measure", "Benchmark candidate plans (default with --fft-wisdom)", 2);
+	describe_option("patient", "Benchmark even more candidate plans (may take minutes if no wisdom is available)", 2);
+	describe_option("--fft-threads <integer>|auto", "Number of threads computing the channelizer FFT of each input (default: 4)", 1);
+	describe_option("--channel-fft-threads <integer>|auto", "Number of threads computing the FFT of each channel (default: 1)", 1);
+	describe_option("", "auto: benchmark thread counts on startup and use the fastest one", 1);
+	describe_option("--lag-warning <seconds>", "Warn when any processing stage falls behind a receiver or network input by more than this (default: 2, 0: disable)", 1);
 }
 
 int32_t main(int32_t argc, char **argv) {
@@ -329,6 +1004,9 @@ int32_t main(int32_t argc, char **argv) {
 #ifdef WITH_SOAPYSDR
 #define OPT_SOAPYSDR 11
 #endif
+#define OPT_RTLTCP 12
+#define OPT_IQ_TCP 13
+#define OPT_IQ_UDP 14
 
 #define OPT_SAMPLE_FORMAT 20
 #define OPT_SAMPLE_RATE 21
@@ -340,6 +1018,12 @@ int32_t main(int32_t argc, char **argv) {
 #define OPT_DEVICE_SETTINGS 27
 #define OPT_FREQ_OFFSET 28
 #define OPT_READ_BUFFER_SIZE 29
+#define OPT_PARALLEL_SEGMENTS 30
+#define OPT_CHANNELS 31
+#define OPT_PRE_DECIMATION 32
+#define OPT_RECORD 33
+#define OPT_OVERFLOW_POLICY 34
+#define OPT_STAGE_FUSION 35
 
 #define OPT_OUTPUT 40
 #define OPT_OUTPUT_QUEUE_HWM 41
@@ -364,6 +1048,15 @@ int32_t main(int32_t argc, char **argv) {
 #define OPT_AC_DETAILS 81
 #endif
 
+#define OPT_WORKER_THREADS 90
+#define OPT_CPU_AFFINITY 91
+#define OPT_RT_PRIORITY 92
+#define OPT_LAG_WARNING 93
+#define OPT_FFT_WISDOM 94
+#define OPT_FFT_PLANNER 95
+#define OPT_FFT_THREADS 96
+#define OPT_CHANNEL_FFT_THREADS 97
+
 #define DEFAULT_OUTPUT "decoded:text:file:path=-"
 
 	static struct option opts[] = {
@@ -379,6 +1072,9 @@ int32_t main(int32_t argc, char **argv) {
 #ifdef WITH_SOAPYSDR
 		{ "soapysdr",           required_argument,  NULL,   OPT_SOAPYSDR },
 #endif
+		{ "rtltcp",             required_argument,  NULL,   OPT_RTLTCP },
+		{ "iq-tcp",             required_argument,  NULL,   OPT_IQ_TCP },
+		{ "iq-udp",             required_argument,  NULL,   OPT_IQ_UDP },
 		{ "sample-format",      required_argument,  NULL,   OPT_SAMPLE_FORMAT },
 		{ "sample-rate",        required_argument,  NULL,   OPT_SAMPLE_RATE },
 		{ "centerfreq",         required_argument,  NULL,   OPT_CENTERFREQ },
@@ -389,6 +1085,12 @@ int32_t main(int32_t argc, char **argv) {
 		{ "device-settings",    required_argument,  NULL,   OPT_DEVICE_SETTINGS },
 		{ "freq-offset",        required_argument,  NULL,   OPT_FREQ_OFFSET },
 		{ "read-buffer-size",   required_argument,  NULL,   OPT_READ_BUFFER_SIZE },
+		{ "parallel-segments",  required_argument,  NULL,   OPT_PARALLEL_SEGMENTS },
+		{ "channels",           required_argument,  NULL,   OPT_CHANNELS },
+		{ "pre-decimation",     required_argument,  NULL,   OPT_PRE_DECIMATION },
+		{ "record",             required_argument,  NULL,   OPT_RECORD },
+		{ "overflow-policy",    required_argument,  NULL,   OPT_OVERFLOW_POLICY },
+		{ "stage-fusion",       required_argument,  NULL,   OPT_STAGE_FUSION },
 		{ "output",             required_argument,  NULL,   OPT_OUTPUT },
 		{ "output-queue-hwm",   required_argument,  NULL,   OPT_OUTPUT_QUEUE_HWM },
 		{ "utc",                no_argument,        NULL,   OPT_UTC },
@@ -408,6 +1110,14 @@ int32_t main(int32_t argc, char **argv) {
 #ifdef WITH_STATSD
 		{ "statsd",             required_argument,  NULL,   OPT_STATSD },
 #endif
+		{ "worker-threads",     required_argument,  NULL,   OPT_WORKER_THREADS },
+		{ "cpu-affinity",       required_argument,  NULL,   OPT_CPU_AFFINITY },
+		{ "rt-priority",        required_argument,  NULL,   OPT_RT_PRIORITY },
+		{ "lag-warning",        required_argument,  NULL,   OPT_LAG_WARNING },
+		{ "fft-wisdom",         required_argument,  NULL,   OPT_FFT_WISDOM },
+		{ "fft-planner",        required_argument,  NULL,   OPT_FFT_PLANNER },
+		{ "fft-threads",        required_argument,  NULL,   OPT_FFT_THREADS },
+		{ "channel-fft-threads", required_argument, NULL,   OPT_CHANNEL_FFT_THREADS },
 		{ 0,                    0,                  0,      0 }
 	};
 
@@ -415,12 +1125,18 @@ int32_t main(int32_t argc, char **argv) {
 	Config.ac_data_details = AC_DETAILS_NORMAL;
 	Config.output_queue_hwm = OUTPUT_QUEUE_HWM_DEFAULT;
 
-	struct input_cfg *input_cfg = input_cfg_create();
-	input_cfg->sfmt = SFMT_UNDEF;
-	input_cfg->type = INPUT_TYPE_UNDEF;
+	// One pipeline per input (or per segment of the input file)
+	struct pipeline *pipelines = NULL;
+	int32_t input_cnt = 0;
+	struct input_cfg *input_cfg = pipeline_add_input(&pipelines, &input_cnt, NULL);
 	la_list *outputs = NULL;
 	char const *systable_file = NULL;
 	char const *systable_save_file = NULL;
+	int32_t parallel_segments = -1;
+	int32_t worker_threads = -1;
+	double lag_warning = LAG_WARNING_DEFAULT;
+	char const *fft_wisdom_file = NULL;
+	int32_t fft_planner_effort = -1;
 #ifdef WITH_STATSD
 	char *statsd_addr = NULL;
 #endif
@@ -435,15 +1151,32 @@ int32_t main(int32_t argc, char **argv) {
 		switch(c) {
 			case OPT_IQ_FILE:
 				Config.output_queue_hwm = OUTPUT_QUEUE_HWM_NONE;
+				input_cfg = pipeline_add_input(&pipelines, &input_cnt, input_cfg);
 				input_cfg->source = optarg;
 				input_cfg->type = INPUT_TYPE_FILE;
 				break;
 #ifdef WITH_SOAPYSDR
 			case OPT_SOAPYSDR:
+				input_cfg = pipeline_add_input(&pipelines, &input_cnt, input_cfg);
 				input_cfg->source = optarg;
 				input_cfg->type = INPUT_TYPE_SOAPYSDR;
 				break;
 #endif
+			case OPT_RTLTCP:
+				input_cfg = pipeline_add_input(&pipelines, &input_cnt, input_cfg);
+				input_cfg->source = optarg;
+				input_cfg->type = INPUT_TYPE_RTLTCP;
+				break;
+			case OPT_IQ_TCP:
+				input_cfg = pipeline_add_input(&pipelines, &input_cnt, input_cfg);
+				input_cfg->source = optarg;
+				input_cfg->type = INPUT_TYPE_TCP;
+				break;
+			case OPT_IQ_UDP:
+				input_cfg = pipeline_add_input(&pipelines, &input_cnt, input_cfg);
+				input_cfg->source = optarg;
+				input_cfg->type = INPUT_TYPE_UDP;
+				break;
 			case OPT_SAMPLE_FORMAT:
 				input_cfg->sfmt = sample_format_from_string(optarg);
 				// Validate the result only when the sample format
@@ -484,6 +1217,14 @@ int32_t main(int32_t argc, char **argv) {
 			case OPT_DEVICE_SETTINGS:
 				input_cfg->device_settings = optarg;
 				break;
+			case OPT_RECORD:
+				input_cfg->record = optarg;
+				break;
+			case OPT_OVERFLOW_POLICY:
+				if(parse_overflow_policy(optarg, &input_cfg->overflow_policy) == false) {
+					return 1;
+				}
+				break;
 			case OPT_FREQ_OFFSET:
 				if(parse_frequency(optarg, &input_cfg->freq_offset) == false) {
 					return 1;
@@ -494,6 +1235,51 @@ int32_t main(int32_t argc, char **argv) {
 					return 1;
 				}
 				break;
+			case OPT_PARALLEL_SEGMENTS:
+				if(parse_int32(optarg, &parallel_segments) == false) {
+					return 1;
+				}
+				if(parallel_segments < 0) {
+					fprintf(stderr, "Invalid --parallel-segments value: must be a non-negative integer\n");
+					return 1;
+				}
+				break;
+			case OPT_CHANNELS: {
+				struct pipeline *p = &pipelines[input_cnt - 1];
+				XFREE(p->frequencies);
+				if((p->channel_cnt = parse_frequency_list(optarg, &p->frequencies)) < 0) {
+					return 1;
+				}
+				break;
+			}
+			case OPT_PRE_DECIMATION: {
+				struct pipeline *p = &pipelines[input_cnt - 1];
+				if(!strcmp(optarg, "auto")) {
+					p->pre_decimation = 0;
+				} else if(parse_int32(optarg, &p->pre_decimation) == false) {
+					return 1;
+				} else if(p->pre_decimation < 1 || (p->pre_decimation & (p->pre_decimation - 1)) != 0 ||
+						p->pre_decimation > (1 << DECIMATOR_MAX_STAGES)) {
+					fprintf(stderr, "Invalid --pre-decimation value: must be a power of 2 not greater than %d\n",
+							1 << DECIMATOR_MAX_STAGES);
+					return 1;
+				}
+				break;
+			}
+			case OPT_STAGE_FUSION: {
+				struct pipeline *p = &pipelines[input_cnt - 1];
+				if(!strcmp(optarg, "auto")) {
+					p->stage_fusion = -1;
+				} else if(!strcmp(optarg, "on")) {
+					p->stage_fusion = 1;
+				} else if(!strcmp(optarg, "off")) {
+					p->stage_fusion = 0;
+				} else {
+					fprintf(stderr, "Invalid --stage-fusion value '%s': must be off, on or auto\n", optarg);
+					return 1;
+				}
+				break;
+			}
 			case OPT_OUTPUT:
 				outputs = output_add(outputs, optarg);
 				break;
@@ -557,6 +1343,61 @@ int32_t main(int32_t argc, char **argv) {
 				statsd_addr = strdup(optarg);
 				break;
 #endif
+			case OPT_WORKER_THREADS:
+				if(!strcmp(optarg, "auto")) {
+					worker_threads = -1;
+				} else if(parse_int32(optarg, &worker_threads) == false) {
+					return 1;
+				} else if(worker_threads < 0) {
+					fprintf(stderr, "Invalid --worker-threads value: must be a non-negative integer or \"auto\"\n");
+					return 1;
+				}
+				break;
+			case OPT_CPU_AFFINITY:
+				if(thread_sched_set_affinity(optarg) == false) {
+					return 1;
+				}
+				break;
+			case OPT_RT_PRIORITY: {
+				int32_t priority = 0;
+				if(parse_int32(optarg, &priority) == false ||
+						thread_sched_set_rt_priority(priority) == false) {
+					return 1;
+				}
+				break;
+			}
+			case OPT_FFT_WISDOM:
+				fft_wisdom_file = optarg;
+				break;
+			case OPT_FFT_PLANNER:
+				if(parse_fft_planner_effort(optarg, &fft_planner_effort) == false) {
+					return 1;
+				}
+				break;
+			case OPT_FFT_THREADS:
+			case OPT_CHANNEL_FFT_THREADS: {
+				int32_t thread_cnt = FFT_THREADS_AUTO;
+				if(!strcmp(optarg, "auto")) {
+					thread_cnt = FFT_THREADS_AUTO;
+				} else if(parse_int32(optarg, &thread_cnt) == false) {
+					return 1;
+				} else if(thread_cnt < 1) {
+					fprintf(stderr, "Invalid --%s value: must be a positive integer or \"auto\"\n",
+							c == OPT_FFT_THREADS ? "fft-threads" : "channel-fft-threads");
+					return 1;
+				}
+				csdr_fft_set_thread_cnt(c == OPT_FFT_THREADS ? FFT_PLAN_CHANNELIZER : FFT_PLAN_CHANNEL, thread_cnt);
+				break;
+			}
+			case OPT_LAG_WARNING:
+				if(parse_double(optarg, &lag_warning) == false) {
+					return 1;
+				}
+				if(lag_warning < 0.0) {
+					fprintf(stderr, "Invalid --lag-warning value: must be a non-negative number\n");
+					return 1;
+				}
+				break;
 #ifdef DEBUG
 			case OPT_DEBUG:
 				Config.debug_filter = parse_msg_filterspec(debug_filters, debug_filter_usage, optarg);
@@ -579,38 +1420,67 @@ int32_t main(int32_t argc, char **argv) {
 				return 1;
 		}
 	}
-	if(input_cfg->source == NULL) {
+	if(pipelines[0].input_cfg->source == NULL) {
 		fprintf(stderr, "No input specified\n");
 		return 1;
 	}
-	int32_t channel_cnt = argc - optind;
-	if(channel_cnt < 1) {
-		fprintf(stderr, "No channel frequencies given\n");
+	if(parallel_segments >= 0 && (input_cnt > 1 || pipelines[0].input_cfg->type != INPUT_TYPE_FILE)) {
+		fprintf(stderr, "--parallel-segments may only be used with a single --iq-file input\n");
 		return 1;
 	}
-	int32_t frequencies[channel_cnt];
-	for(int32_t i = 0; i < channel_cnt; i++) {
-		if(parse_frequency(argv[optind + i], &frequencies[i]) == false) {
+	if(argc - optind > 0) {
+		// Positional channel frequencies are accepted for backwards
+		// compatibility, but only when there is a single input.
+		if(input_cnt > 1 || pipelines[0].frequencies != NULL) {
+			fprintf(stderr, "Channel frequencies must be given either with --channels options "
+					"(one per input) or as positional arguments (single input only), not both\n");
 			return 1;
 		}
+		struct pipeline *p = &pipelines[0];
+		p->channel_cnt = argc - optind;
+		p->frequencies = XCALLOC(p->channel_cnt, sizeof(int32_t));
+		for(int32_t i = 0; i < p->channel_cnt; i++) {
+			if(parse_frequency(argv[optind + i], &p->frequencies[i]) == false) {
+				return 1;
+			}
+		}
 	}
-
-	if(input_cfg->sample_rate < HFDL_SYMBOL_RATE * SPS) {
-		fprintf(stderr, "Sample rate must be greater or equal to %d\n", HFDL_SYMBOL_RATE * SPS);
-		return 1;
-	}
-
-	if(input_cfg->centerfreq < 0) {
-		if(compute_centerfreq(frequencies, channel_cnt, &input_cfg->centerfreq) == true) {
-			fprintf(stderr, "%s: computed center frequency: %.3f kHz\n", input_cfg->source, HZ_TO_KHZ(input_cfg->centerfreq));
-		} else {
-			fprintf(stderr, "%s: failed to compute center frequency\n", input_cfg->source);
-			return 2;
+	bool all_inputs_are_files = true;
+	for(int32_t i = 0; i < input_cnt; i++) {
+		if(pipelines[i].channel_cnt < 1) {
+			fprintf(stderr, "%s: no channel frequencies given\n", pipelines[i].input_cfg->source);
+			return 1;
+		}
+		if(pipelines[i].input_cfg->type != INPUT_TYPE_FILE) {
+			all_inputs_are_files = false;
+		} else if(pipelines[i].input_cfg->record != NULL) {
+			fprintf(stderr, "%s: --record can't be used with file inputs\n", pipelines[i].input_cfg->source);
+			return 1;
 		}
 	}
-	if(check_frequency_span(frequencies, channel_cnt, input_cfg->centerfreq, input_cfg->sample_rate) == false) {
+	if(check_duplicate_frequencies(input_cnt, pipelines) == false) {
 		return 1;
 	}
+	thread_sched_init();
+
+	for(int32_t i = 0; i < input_cnt; i++) {
+		struct pipeline *p = &pipelines[i];
+		// Create the input before validating sample rate and center frequency,
+		// as the input driver might provide their values (eg. from file metadata).
+		p->input = input_create(p->input_cfg);
+		if(p->input == NULL) {
+			fprintf(stderr, "%s: invalid input specified\n", p->input_cfg->source);
+			return 1;
+		}
+		if(p->input_cfg->sample_rate < HFDL_SYMBOL_RATE * SPS) {
+			fprintf(stderr, "%s: sample rate must be greater or equal to %d\n",
+					p->input_cfg->source, HFDL_SYMBOL_RATE * SPS);
+			return 1;
+		}
+		if(pipeline_check_frequencies(p) == false) {
+			return 1;
+		}
+	}
 	if(Config.output_queue_hwm < 0) {
 		fprintf(stderr, "Invalid --output-queue-hwm value: must be a non-negative integer\n");
 		return 1;
@@ -643,39 +1513,48 @@ int32_t main(int32_t argc, char **argv) {
 	}
 	ASSERT(outputs != NULL);
 
-	struct block *input = input_create(input_cfg);
-	if(input == NULL) {
-		fprintf(stderr, "Invalid input specified\n");
-		return 1;
-	}
-	if(input_init(input) < 0) {
-		fprintf(stderr, "Unable to initialize input\n");
-		return 1;
+	for(int32_t i = 0; i < input_cnt; i++) {
+		if(input_init(pipelines[i].input) < 0) {
+			fprintf(stderr, "%s: unable to initialize input\n", pipelines[i].input_cfg->source);
+			return 1;
+		}
 	}
 
-	csdr_fft_init();
-
-	int32_t fft_decimation_rate = compute_fft_decimation_rate(input_cfg->sample_rate, HFDL_SYMBOL_RATE * SPS);
-	ASSERT(fft_decimation_rate > 0);
-#ifdef DEBUG
-	int32_t sample_rate_post_fft = roundf((float)input_cfg->sample_rate / (float)fft_decimation_rate);
-#endif
-	float fftfilt_transition_bw = compute_filter_relative_transition_bw(input_cfg->sample_rate, HFDL_CHANNEL_TRANSITION_BW_HZ);
-	debug_print(D_DSP, "fft_decimation_rate: %d sample_rate_post_fft: %d transition_bw: %.f\n",
-			fft_decimation_rate, sample_rate_post_fft, fftfilt_transition_bw);
+	int32_t pipeline_cnt = input_cnt;
+	if(parallel_segments >= 0) {
+		struct block *input = pipelines[0].input;
+		int32_t sample_rate = pipelines[0].input_cfg->sample_rate;
+		pipeline_cnt = compute_segment_cnt(input, sample_rate, parallel_segments);
+		if(pipeline_cnt < 0) {
+			return 1;
+		}
+		if(pipeline_cnt > 1) {
+			pipelines = XREALLOC(pipelines, pipeline_cnt * sizeof(struct pipeline));
+			memset(&pipelines[1], 0, (pipeline_cnt - 1) * sizeof(struct pipeline));
+			if(setup_segment_inputs(input, sample_rate, pipeline_cnt, pipelines) < 0) {
+				return 1;
+			}
+		}
+	}
+	bool const segmented = pipeline_cnt > input_cnt;
 
-	struct block *fft = fft_create(fft_decimation_rate, fftfilt_transition_bw);
-	if(fft == NULL) {
-		return 1;
+	// Benchmarking plans is worth it only if the results are saved for later
+	if(fft_planner_effort < 0) {
+		fft_planner_effort = fft_wisdom_file != NULL ? FFT_PLANNER_MEASURE : FFT_PLANNER_ESTIMATE;
 	}
+	csdr_fft_set_planner_effort(fft_planner_effort);
+	csdr_fft_set_wisdom_file(fft_wisdom_file);
+	csdr_fft_init();
 
 #ifdef WITH_STATSD
 	if(statsd_addr != NULL) {
 		if(statsd_initialize(statsd_addr) < 0) {
 			fprintf(stderr, "Failed to initialize StatsD client - disabling\n");
 		} else {
-			for(int32_t i = 0; i < channel_cnt; i++) {
-				statsd_initialize_counters_per_channel(frequencies[i]);
+			for(int32_t i = 0; i < input_cnt; i++) {
+				for(int32_t j = 0; j < pipelines[i].channel_cnt; j++) {
+					statsd_initialize_counters_per_channel(pipelines[i].frequencies[j]);
+				}
 			}
 			statsd_initialize_counters_per_msgdir();
 		}
@@ -698,24 +1577,24 @@ int32_t main(int32_t argc, char **argv) {
 	la_config_set_int("acars_bearer", LA_ACARS_BEARER_HFDL);
 	hfdl_init_globals();
 
-	struct block *channels[channel_cnt];
-	for(int32_t i = 0; i < channel_cnt; i++) {
-		channels[i] = hfdl_channel_create(input_cfg->sample_rate, fft_decimation_rate,
-				fftfilt_transition_bw, input_cfg->centerfreq, frequencies[i]);
-		if(channels[i] == NULL) {
-			fprintf(stderr, "Failed to initialize channel %s\n",
-					argv[optind + i]);
+	for(int32_t i = 0; i < pipeline_cnt; i++) {
+		if(pipeline_create(&pipelines[i], segmented ? i : 0) < 0) {
 			return 1;
 		}
 	}
-
-	if(block_connect_one2one(input, fft) != 1 ||
-			block_connect_one2many(fft, channel_cnt, channels) != channel_cnt) {
+	struct worker_pool *worker_pool = setup_worker_pool(pipeline_cnt, pipelines, worker_threads);
+	if(worker_threads != 0 && worker_pool == NULL) {
+		fprintf(stderr, "Failed to start worker threads, aborting\n");
 		return 1;
 	}
 
 	start_all_output_threads(outputs);
 	hfdl_pdu_decoder_init();
+	if(segmented) {
+		int32_t sample_rate = pipelines[0].input_cfg->sample_rate;
+		hfdl_pdu_decoder_merge_segments(pipeline_cnt,
+				(double)hfdl_segment_overlap(sample_rate) / sample_rate);
+	}
 	if(hfdl_pdu_decoder_start(outputs) != 0) {
 	    fprintf(stderr, "Failed to start decoder thread, aborting\n");
 	    return 1;
@@ -727,41 +1606,67 @@ int32_t main(int32_t argc, char **argv) {
 	ProfilerStart("dumphfdl.prof");
 #endif
 
-	if(block_set_start(channel_cnt, channels) != channel_cnt ||
-		block_start(fft) != 1 ||
-		block_start(input) != 1) {
-		return 1;
+	struct timespec start_time, end_time;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	for(int32_t i = 0; i < pipeline_cnt; i++) {
+		if(pipeline_start(&pipelines[i]) < 0) {
+			return 1;
+		}
 	}
+#ifdef WITH_STATSD
+	int32_t seconds = 0;
+#endif
 	while(!do_exit) {
 		sleep(1);
+		for(int32_t i = 0; i < pipeline_cnt; i++) {
+			pipeline_check_lag(&pipelines[i], lag_warning);
+		}
+#ifdef WITH_STATSD
+		if(++seconds % BLOCK_METRICS_INTERVAL == 0) {
+			report_pipeline_metrics(pipeline_cnt, pipelines);
+		}
+#endif
+		// File inputs terminate when all the data has been processed
+		if(all_inputs_are_files &&
+				pipelines_finished(pipeline_cnt, pipelines, segmented)) {
+			break;
+		}
 	}
 	hfdl_pdu_decoder_stop();
 	fprintf(stderr, "Waiting for all threads to finish\n");
 	while(do_exit < 2 && (
-			block_is_running(input) ||
-			block_is_running(fft) ||
-			block_set_is_any_running(channel_cnt, channels) ||
+			pipelines_are_running(pipeline_cnt, pipelines) ||
 			hfdl_pdu_decoder_is_running() ||
 			output_thread_is_any_running(outputs)
 			)) {
 		usleep(500000);
 	}
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	// Do not wait for the workers if some channels are still busy
+	// (ie. the user has requested immediate exit)
+	if(!pipelines_are_running(pipeline_cnt, pipelines)) {
+		worker_pool_destroy(worker_pool);
+	}
 
 #ifdef PROFILING
 	ProfilerStop();
 #endif
 
+	if(all_inputs_are_files) {
+		print_processing_stats(&start_time, &end_time, pipeline_cnt, pipelines);
+	}
+	print_pipeline_stats(pipeline_cnt, pipelines, segmented);
 	hfdl_print_summary();
 
-	block_disconnect_one2many(fft, channel_cnt, channels);
-	block_disconnect_one2one(input, fft);
-	for(int32_t i = 0; i < channel_cnt; i++) {
-		hfdl_channel_destroy(channels[i]);
+	for(int32_t i = 0; i < pipeline_cnt; i++) {
+		pipeline_destroy(&pipelines[i]);
 	}
-	input_destroy(input);
-	input_cfg_destroy(input_cfg);
-
-	fft_destroy(fft);
+	// Segments share the configuration of the first pipeline
+	for(int32_t i = 0; i < input_cnt; i++) {
+		input_cfg_destroy(pipelines[i].input_cfg);
+		XFREE(pipelines[i].frequencies);
+	}
+	XFREE(pipelines);
 	csdr_fft_destroy();
 
 	outputs_destroy(outputs);
@@ -934,5 +1839,5 @@ static void start_output_thread(void *p, void *ctx) {
 	ASSERT(p != NULL);
 	output_instance_t *output = p;
 	debug_print(D_OUTPUT, "starting thread for output %s\n", output->td->name);
-	start_thread(output->output_thread, output_thread, output);
+	start_thread(output->output_thread, THREAD_CLASS_OUTPUT, output_thread, output);
 }
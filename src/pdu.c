@@ -1,8 +1,10 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>                 // llabs, free
 #include <string.h>                 // memcpy
-#include <glib.h>                   // GAsyncQueue, g_async_queue_*
+#include <sys/time.h>               // struct timeval, timercmp
+#include <glib.h>                   // GAsyncQueue, g_async_queue_*, GQueue, g_queue_*
 #include <libacars/libacars.h>      // la_proto_tree_destroy()
 #include <libacars/list.h>          // la_list_*
 #include <libacars/reassembly.h>    // la_reasm_ctx, la_reasm_ctx_new()
@@ -14,20 +16,61 @@
 #include "statsd.h"                 // statsd_*
 #include "pdu.h"                    // struct hfdl_pdu_metadata
 
+// Internal queue entry flag: all PDUs from the given segment have been queued
+#define PDU_FLAG_SEGMENT_DONE (1 << 16)
+
+// PDUs from adjacent segments are considered duplicates if their contents
+// are identical and their timestamps differ by less than this value
+#define PDU_DEDUP_TOLERANCE_USEC 500000
+
 struct hfdl_pdu_qentry {
 	struct metadata *metadata;
 	struct octet_string *pdu;
 	uint32_t flags;
+	int32_t segment;
+};
+
+struct pdu_decoder_ctx {
+	la_list *fmtr_list;
+	la_reasm_ctx *reasm_ctx;
+};
+
+// A summary of a released PDU, for duplicate detection
+struct pdu_fingerprint {
+	struct timeval timestamp;
+	uint64_t hash;
+	size_t len;
+	int32_t freq;
 };
 
 static GAsyncQueue *pdu_decoder_queue;
 static bool pdu_decoder_thread_active = false;
 
+// When a recording is decoded in parallel segments, PDUs from all segments
+// are merged here. PDUs from the earliest unfinished segment are passed
+// through immediately, PDUs from later segments are held back until all
+// preceding segments are done and then released in timestamp order.
+// Frames located in the overlapping part of adjacent segments are decoded
+// twice, so the second copy is dropped.
+static struct {
+	GQueue **pending;               // held back PDUs, one queue per segment
+	bool *done;                     // per-segment completion flags
+	GQueue *recent;                 // fingerprints of recently released PDUs
+	struct timeval newest;          // newest timestamp in recent
+	double window;                  // how long to remember released PDUs (seconds)
+	int32_t segment_cnt;            // 0 = merging disabled
+	int32_t current;                // earliest unfinished segment
+} merge;
+
 /******************************
  * Forward declarations
  ******************************/
 
 static void *pdu_decoder_thread(void *ctx);
+static void pdu_decode(struct pdu_decoder_ctx *ctx, struct hfdl_pdu_qentry *q);
+static void merge_push(struct pdu_decoder_ctx *ctx, struct hfdl_pdu_qentry *q);
+static void merge_segment_done(struct pdu_decoder_ctx *ctx, int32_t segment);
+static void merge_flush(struct pdu_decoder_ctx *ctx);
 static struct metadata_vtable hfdl_pdu_metadata_vtable;
 
 /******************************
@@ -39,6 +82,9 @@ void pdu_decoder_queue_push(struct metadata *metadata, struct octet_string *pdu,
 	qentry->metadata = metadata;
 	qentry->pdu = pdu;
 	qentry->flags = flags;
+	if(metadata != NULL) {
+		qentry->segment = container_of(metadata, struct hfdl_pdu_metadata, metadata)->segment;
+	}
 	g_async_queue_push(pdu_decoder_queue, qentry);
 }
 
@@ -48,7 +94,7 @@ void hfdl_pdu_decoder_init(void) {
 
 int32_t hfdl_pdu_decoder_start(void *ctx) {
 	pthread_t pdu_th;
-	int32_t ret = start_thread(&pdu_th, pdu_decoder_thread, ctx);
+	int32_t ret = start_thread(&pdu_th, THREAD_CLASS_DECODER, pdu_decoder_thread, ctx);
 	if(ret == 0) {
 		pdu_decoder_thread_active = true;
 	}
@@ -59,6 +105,33 @@ void hfdl_pdu_decoder_stop(void) {
 	pdu_decoder_queue_push(NULL, NULL, OUT_FLAG_ORDERED_SHUTDOWN);
 }
 
+// Enables merging of PDUs decoded from segment_cnt parallel segments
+// of a recording. overlap is the length of the overlapping part of
+// adjacent segments in seconds. Must be called before starting
+// the decoder thread.
+void hfdl_pdu_decoder_merge_segments(int32_t segment_cnt, double overlap) {
+	ASSERT(segment_cnt > 0);
+	ASSERT(pdu_decoder_thread_active == false);
+	merge.segment_cnt = segment_cnt;
+	merge.current = 0;
+	merge.window = 2.0 * overlap;
+	merge.pending = XCALLOC(segment_cnt, sizeof(GQueue *));
+	for(int32_t i = 0; i < segment_cnt; i++) {
+		merge.pending[i] = g_queue_new();
+	}
+	merge.done = XCALLOC(segment_cnt, sizeof(bool));
+	merge.recent = g_queue_new();
+}
+
+// Notifies the decoder that all PDUs decoded from the given segment
+// have already been queued
+void hfdl_pdu_decoder_segment_done(int32_t segment) {
+	NEW(struct hfdl_pdu_qentry, qentry);
+	qentry->flags = PDU_FLAG_SEGMENT_DONE;
+	qentry->segment = segment;
+	g_async_queue_push(pdu_decoder_queue, qentry);
+}
+
 bool hfdl_pdu_decoder_is_running(void) {
 	return pdu_decoder_thread_active;
 }
@@ -90,91 +163,232 @@ struct metadata *hfdl_pdu_metadata_create() {
 
 static void *pdu_decoder_thread(void *ctx) {
 	ASSERT(ctx != NULL);
-	la_list *fmtr_list = ctx;
+	struct pdu_decoder_ctx decoder_ctx = {
+		.fmtr_list = ctx,
+		.reasm_ctx = la_reasm_ctx_new()
+	};
 	struct hfdl_pdu_qentry *q = NULL;
-	la_list *lpdu_list = NULL;
-	la_reasm_ctx *reasm_ctx = la_reasm_ctx_new();
-	enum {
-		DECODING_NOT_DONE,
-		DECODING_SUCCESS,
-		DECODING_FAILURE
-	} decoding_status;
-	#define IS_MPDU(buf) ((buf)[0] & 1)
 
 	while(true) {
 		q = g_async_queue_pop(pdu_decoder_queue);
 		if(q->flags & OUT_FLAG_ORDERED_SHUTDOWN) {
+			merge_flush(&decoder_ctx);
 			fprintf(stderr, "Shutting down decoder thread\n");
-			shutdown_outputs(fmtr_list);
+			shutdown_outputs(decoder_ctx.fmtr_list);
 			XFREE(q);
 			break;
+		} else if(q->flags & PDU_FLAG_SEGMENT_DONE) {
+			merge_segment_done(&decoder_ctx, q->segment);
+			XFREE(q);
+			continue;
 		}
 		ASSERT(q->metadata != NULL);
+		if(merge.segment_cnt > 0) {
+			merge_push(&decoder_ctx, q);
+		} else {
+			pdu_decode(&decoder_ctx, q);
+		}
+	}
+	la_reasm_ctx_destroy(decoder_ctx.reasm_ctx);
+	pdu_decoder_thread_active = false;
+	return NULL;
+}
 
-		fmtr_instance_t *fmtr = NULL;
-		decoding_status = DECODING_NOT_DONE;
-		for(la_list *p = fmtr_list; p != NULL; p = la_list_next(p)) {
-			fmtr = p->data;
-			if(fmtr->intype == FMTR_INTYPE_DECODED_FRAME) {
-				// Decode the pdu unless we've done it before
-				if(decoding_status == DECODING_NOT_DONE) {
-					struct hfdl_pdu_metadata *hm = container_of(q->metadata,
-							struct hfdl_pdu_metadata, metadata);
-					statsd_increment_per_channel(hm->freq, "frames.processed");
-					if(IS_MPDU(q->pdu->buf)) {
-						lpdu_list = mpdu_parse(q->pdu, reasm_ctx, q->metadata->rx_timestamp, hm->freq);
-					} else {
-						lpdu_list = spdu_parse(q->pdu, hm->freq);
-					}
-					if(lpdu_list != NULL) {
-						decoding_status = DECODING_SUCCESS;
-					} else {
-						decoding_status = DECODING_FAILURE;
-					}
+// Decodes the PDU, passes it to all formatters and frees the queue entry
+static void pdu_decode(struct pdu_decoder_ctx *ctx, struct hfdl_pdu_qentry *q) {
+	la_list *fmtr_list = ctx->fmtr_list;
+	la_reasm_ctx *reasm_ctx = ctx->reasm_ctx;
+	la_list *lpdu_list = NULL;
+	enum {
+		DECODING_NOT_DONE,
+		DECODING_SUCCESS,
+		DECODING_FAILURE
+	} decoding_status;
+	#define IS_MPDU(buf) ((buf)[0] & 1)
+
+	ASSERT(q->metadata != NULL);
+
+	fmtr_instance_t *fmtr = NULL;
+	decoding_status = DECODING_NOT_DONE;
+	for(la_list *p = fmtr_list; p != NULL; p = la_list_next(p)) {
+		fmtr = p->data;
+		if(fmtr->intype == FMTR_INTYPE_DECODED_FRAME) {
+			// Decode the pdu unless we've done it before
+			if(decoding_status == DECODING_NOT_DONE) {
+				struct hfdl_pdu_metadata *hm = container_of(q->metadata,
+						struct hfdl_pdu_metadata, metadata);
+				statsd_increment_per_channel(hm->freq, "frames.processed");
+				if(IS_MPDU(q->pdu->buf)) {
+					lpdu_list = mpdu_parse(q->pdu, reasm_ctx, q->metadata->rx_timestamp, hm->freq);
+				} else {
+					lpdu_list = spdu_parse(q->pdu, hm->freq);
 				}
-				if(decoding_status == DECODING_SUCCESS) {
-					for(la_list *lpdu = lpdu_list; lpdu != NULL; lpdu = la_list_next(lpdu)) {
-						ASSERT(lpdu->data != NULL);
-						struct octet_string *serialized_msg = fmtr->td->format_decoded_msg(q->metadata, lpdu->data);
-						// First check if the formatter actually returned something.
-						// A formatter might be suitable only for a particular message type. If this is the case.
-						// it will return NULL for all messages it cannot handle.
-						// An example is pp_acars which only deals with ACARS messages.
-						if(serialized_msg != NULL) {
-							output_qentry_t qentry = {
-								.msg = serialized_msg,
-								.metadata = q->metadata,
-								.format = fmtr->td->output_format
-							};
-							la_list_foreach(fmtr->outputs, output_queue_push, &qentry);
-							// output_queue_push makes a copy of serialized_msg, so it's safe to free it now
-							octet_string_destroy(serialized_msg);
-						}
-					}
+				if(lpdu_list != NULL) {
+					decoding_status = DECODING_SUCCESS;
+				} else {
+					decoding_status = DECODING_FAILURE;
 				}
-			} else if(fmtr->intype == FMTR_INTYPE_RAW_FRAME) {
-				struct octet_string *serialized_msg = fmtr->td->format_raw_msg(q->metadata, q->pdu);
-				if(serialized_msg != NULL) {
-					output_qentry_t qentry = {
-						.msg = serialized_msg,
-						.metadata = q->metadata,
-						.format = fmtr->td->output_format
-					};
-					la_list_foreach(fmtr->outputs, output_queue_push, &qentry);
-					// output_queue_push makes a copy of serialized_msg, so it's safe to free it now
-					octet_string_destroy(serialized_msg);
+			}
+			if(decoding_status == DECODING_SUCCESS) {
+				for(la_list *lpdu = lpdu_list; lpdu != NULL; lpdu = la_list_next(lpdu)) {
+					ASSERT(lpdu->data != NULL);
+					struct octet_string *serialized_msg = fmtr->td->format_decoded_msg(q->metadata, lpdu->data);
+					// First check if the formatter actually returned something.
+					// A formatter might be suitable only for a particular message type. If this is the case.
+					// it will return NULL for all messages it cannot handle.
+					// An example is pp_acars which only deals with ACARS messages.
+					if(serialized_msg != NULL) {
+						output_qentry_t qentry = {
+							.msg = serialized_msg,
+							.metadata = q->metadata,
+							.format = fmtr->td->output_format
+						};
+						la_list_foreach(fmtr->outputs, output_queue_push, &qentry);
+						// output_queue_push makes a copy of serialized_msg, so it's safe to free it now
+						octet_string_destroy(serialized_msg);
+					}
 				}
 			}
+		} else if(fmtr->intype == FMTR_INTYPE_RAW_FRAME) {
+			struct octet_string *serialized_msg = fmtr->td->format_raw_msg(q->metadata, q->pdu);
+			if(serialized_msg != NULL) {
+				output_qentry_t qentry = {
+					.msg = serialized_msg,
+					.metadata = q->metadata,
+					.format = fmtr->td->output_format
+				};
+				la_list_foreach(fmtr->outputs, output_queue_push, &qentry);
+				// output_queue_push makes a copy of serialized_msg, so it's safe to free it now
+				octet_string_destroy(serialized_msg);
+			}
+		}
+	}
+	la_list_free_full(lpdu_list, la_proto_tree_destroy);
+	octet_string_destroy(q->pdu);
+	XFREE(q->metadata);
+	XFREE(q);
+}
+
+static uint64_t pdu_hash(struct octet_string const *pdu) {
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint8_t const *buf = pdu->buf;
+	for(size_t i = 0; i < pdu->len; i++) {
+		hash ^= buf[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static int64_t timeval_diff_usec(struct timeval const *a, struct timeval const *b) {
+	return (int64_t)(a->tv_sec - b->tv_sec) * 1000000 + (a->tv_usec - b->tv_usec);
+}
+
+static bool merge_is_duplicate(struct pdu_fingerprint const *fp) {
+	for(GList *l = merge.recent->head; l != NULL; l = l->next) {
+		struct pdu_fingerprint const *r = l->data;
+		if(r->hash == fp->hash && r->len == fp->len && r->freq == fp->freq &&
+				llabs(timeval_diff_usec(&r->timestamp, &fp->timestamp)) < PDU_DEDUP_TOLERANCE_USEC) {
+			return true;
 		}
-		la_list_free_full(lpdu_list, la_proto_tree_destroy);
-		lpdu_list = NULL;
+	}
+	return false;
+}
+
+// Passes the PDU to the decoder, unless it's a duplicate of a recently released one
+static void merge_release(struct pdu_decoder_ctx *ctx, struct hfdl_pdu_qentry *q) {
+	struct hfdl_pdu_metadata *hm = container_of(q->metadata, struct hfdl_pdu_metadata, metadata);
+	NEW(struct pdu_fingerprint, fp);
+	fp->timestamp = q->metadata->rx_timestamp;
+	fp->hash = pdu_hash(q->pdu);
+	fp->len = q->pdu->len;
+	fp->freq = hm->freq;
+	if(merge_is_duplicate(fp)) {
+		debug_print(D_PROTO, "segment %d: dropping duplicate PDU (freq: %d len: %zu)\n",
+				q->segment, fp->freq, fp->len);
+		XFREE(fp);
 		octet_string_destroy(q->pdu);
 		XFREE(q->metadata);
 		XFREE(q);
+		return;
 	}
-	la_reasm_ctx_destroy(reasm_ctx);
-	pdu_decoder_thread_active = false;
-	return NULL;
+	g_queue_push_tail(merge.recent, fp);
+	if(timercmp(&fp->timestamp, &merge.newest, >)) {
+		merge.newest = fp->timestamp;
+	}
+	// Forget PDUs which are too old to have duplicates in the next segment
+	struct pdu_fingerprint *oldest = NULL;
+	while((oldest = g_queue_peek_head(merge.recent)) != NULL &&
+			timeval_diff_usec(&merge.newest, &oldest->timestamp) > merge.window * 1e6) {
+		XFREE(oldest);
+		g_queue_pop_head(merge.recent);
+	}
+	pdu_decode(ctx, q);
+}
+
+static gint qentry_timestamp_compare(gconstpointer a, gconstpointer b, gpointer data) {
+	UNUSED(data);
+	struct hfdl_pdu_qentry const *qa = a;
+	struct hfdl_pdu_qentry const *qb = b;
+	if(timercmp(&qa->metadata->rx_timestamp, &qb->metadata->rx_timestamp, <)) {
+		return -1;
+	} else if(timercmp(&qa->metadata->rx_timestamp, &qb->metadata->rx_timestamp, >)) {
+		return 1;
+	}
+	return 0;
+}
+
+// Releases all held back PDUs from the given segment in timestamp order
+static void merge_release_pending(struct pdu_decoder_ctx *ctx, int32_t segment) {
+	GQueue *pending = merge.pending[segment];
+	g_queue_sort(pending, qentry_timestamp_compare, NULL);
+	struct hfdl_pdu_qentry *q = NULL;
+	while((q = g_queue_pop_head(pending)) != NULL) {
+		merge_release(ctx, q);
+	}
+}
+
+static void merge_push(struct pdu_decoder_ctx *ctx, struct hfdl_pdu_qentry *q) {
+	ASSERT(q->segment >= 0 && q->segment < merge.segment_cnt);
+	if(q->segment <= merge.current) {
+		merge_release(ctx, q);
+	} else {
+		// Sorted insertion is costly for long queues, so just append
+		// the entry here and sort the whole queue on release.
+		g_queue_push_tail(merge.pending[q->segment], q);
+	}
+}
+
+static void merge_segment_done(struct pdu_decoder_ctx *ctx, int32_t segment) {
+	if(merge.segment_cnt == 0) {
+		return;
+	}
+	ASSERT(segment >= 0 && segment < merge.segment_cnt);
+	merge.done[segment] = true;
+	while(merge.current < merge.segment_cnt && merge.done[merge.current]) {
+		merge.current++;
+		if(merge.current < merge.segment_cnt) {
+			merge_release_pending(ctx, merge.current);
+		}
+	}
+}
+
+// Releases everything that's still held back (eg. when terminated before
+// all segments are done) and frees merge stage resources
+static void merge_flush(struct pdu_decoder_ctx *ctx) {
+	if(merge.segment_cnt == 0) {
+		return;
+	}
+	for(int32_t i = merge.current; i < merge.segment_cnt; i++) {
+		merge_release_pending(ctx, i);
+	}
+	for(int32_t i = 0; i < merge.segment_cnt; i++) {
+		g_queue_free(merge.pending[i]);
+	}
+	g_queue_free_full(merge.recent, free);
+	XFREE(merge.pending);
+	XFREE(merge.done);
+	merge.segment_cnt = 0;
 }
 
 static struct metadata *hfdl_pdu_metadata_copy(struct metadata const *m) {
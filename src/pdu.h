@@ -13,6 +13,7 @@ struct hfdl_pdu_metadata {
 	float freq_err_hz;
 	float rssi;
 	float noise_floor;
+	int32_t segment;                // input segment number (parallel file decoding only)
 	char slot;                      // 'S' - single slot frame, 'D' - double slot frame
 };
 
@@ -34,6 +35,8 @@ struct hfdl_pdu_hdr_data {
 void hfdl_pdu_decoder_init(void);
 int32_t hfdl_pdu_decoder_start(void *ctx);
 void hfdl_pdu_decoder_stop(void);
+void hfdl_pdu_decoder_merge_segments(int32_t segment_cnt, double overlap);
+void hfdl_pdu_decoder_segment_done(int32_t segment);
 bool hfdl_pdu_decoder_is_running(void);
 bool hfdl_pdu_fcs_check(uint8_t *buf, uint32_t hdr_len);
 void pdu_decoder_queue_push(struct metadata *metadata, struct octet_string *pdu, uint32_t flags);
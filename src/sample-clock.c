@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>               // floor
+#include <pthread.h>            // pthread_mutex_*
+#include <sys/time.h>           // struct timeval, gettimeofday
+#include "sample-clock.h"
+#include "util.h"               // ASSERT, NEW, XFREE
+
+// Number of most recent anchors kept. Anchors are only added when the
+// sample stream departs from the time base, so this covers a long time
+// span, much longer than any processing delay.
+#define SAMPLE_CLOCK_ANCHOR_CNT 256
+
+struct sample_clock_anchor {
+	double stream_time;         // sample position divided by the sample rate
+	struct timeval time;
+};
+
+struct sample_clock_anchors {
+	pthread_mutex_t mutex;
+	struct sample_clock_anchor anchors[SAMPLE_CLOCK_ANCHOR_CNT];
+	uint64_t cnt;               // number of anchors added so far
+};
+
+void sample_clock_set_start(struct sample_clock *clk, struct timeval const *start) {
+	ASSERT(clk != NULL);
+	ASSERT(start != NULL);
+	clk->start = *start;
+	clk->valid = true;
+}
+
+static bool sample_clock_anchors_present(struct sample_clock_anchors *a) {
+	pthread_mutex_lock(&a->mutex);
+	bool const ret = a->cnt > 0;
+	pthread_mutex_unlock(&a->mutex);
+	return ret;
+}
+
+bool sample_clock_is_valid(struct sample_clock const *clk) {
+	return clk != NULL && (clk->valid ||
+			(clk->anchors != NULL && sample_clock_anchors_present(clk->anchors)));
+}
+
+static void timeval_add_seconds(struct timeval const *tv, double seconds, struct timeval *result) {
+	double const sec = floor(seconds);
+	struct timeval const offset = {
+		.tv_sec = (time_t)sec,
+		.tv_usec = (suseconds_t)((seconds - sec) * 1e6)
+	};
+	timeradd(tv, &offset, result);
+}
+
+// Computes the timestamp of the sample at the given position in a sample stream
+// with the given rate. Returns current wall clock time if the clock is not valid.
+void sample_clock_get_time(struct sample_clock const *clk, uint64_t sample_pos,
+		double sample_rate, struct timeval *result) {
+	ASSERT(result != NULL);
+	if(!sample_clock_is_valid(clk)) {
+		gettimeofday(result, NULL);
+		return;
+	}
+	ASSERT(sample_rate > 0.0);
+	double const t = (double)sample_pos / sample_rate;
+	if(clk->anchors == NULL) {
+		timeval_add_seconds(&clk->start, t, result);
+		return;
+	}
+	// Find the most recent anchor preceding the sample. If it's too old
+	// to be found, fall back to the oldest anchor available.
+	struct sample_clock_anchors *a = clk->anchors;
+	pthread_mutex_lock(&a->mutex);
+	uint64_t const oldest = a->cnt > SAMPLE_CLOCK_ANCHOR_CNT ? a->cnt - SAMPLE_CLOCK_ANCHOR_CNT : 0;
+	struct sample_clock_anchor const *anchor = NULL;
+	for(uint64_t i = a->cnt; i > oldest; i--) {
+		anchor = &a->anchors[(i - 1) % SAMPLE_CLOCK_ANCHOR_CNT];
+		if(anchor->stream_time <= t) {
+			break;
+		}
+	}
+	ASSERT(anchor != NULL);
+	struct sample_clock_anchor const found = *anchor;
+	pthread_mutex_unlock(&a->mutex);
+	timeval_add_seconds(&found.time, t - found.stream_time, result);
+}
+
+void sample_clock_anchors_create(struct sample_clock *clk) {
+	ASSERT(clk != NULL);
+	NEW(struct sample_clock_anchors, a);
+	pthread_mutex_init(&a->mutex, NULL);
+	clk->anchors = a;
+}
+
+void sample_clock_anchors_destroy(struct sample_clock *clk) {
+	if(clk != NULL && clk->anchors != NULL) {
+		pthread_mutex_destroy(&clk->anchors->mutex);
+		XFREE(clk->anchors);
+	}
+}
+
+// Records the timestamp of the sample at the given position.
+// Positions must be added in increasing order.
+void sample_clock_add_anchor(struct sample_clock *clk, uint64_t sample_pos,
+		double sample_rate, struct timeval const *time) {
+	ASSERT(clk != NULL);
+	ASSERT(clk->anchors != NULL);
+	ASSERT(sample_rate > 0.0);
+	struct sample_clock_anchors *a = clk->anchors;
+	pthread_mutex_lock(&a->mutex);
+	a->anchors[a->cnt % SAMPLE_CLOCK_ANCHOR_CNT] = (struct sample_clock_anchor){
+		.stream_time = (double)sample_pos / sample_rate,
+		.time = *time
+	};
+	a->cnt++;
+	pthread_mutex_unlock(&a->mutex);
+}
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>           // struct timeval
+
+struct sample_clock_anchors;
+
+// Time base derived from sample count.
+// When the timestamp of the first sample is known (eg. it has been read from
+// the metadata of a recording), the time of any subsequent sample may be
+// computed from its position in the sample stream. This gives correct
+// timestamps regardless of the processing speed.
+// Live inputs may instead record anchors (sample position -> timestamp) as
+// samples arrive. Anchors are shared by all blocks connected to the input,
+// so that gaps in the sample stream and clock drift are accounted for.
+struct sample_clock {
+	struct timeval start;       // timestamp of the first sample
+	bool valid;                 // false = time base unknown, use wall clock
+	struct sample_clock_anchors *anchors;   // NULL = no anchors
+};
+
+void sample_clock_set_start(struct sample_clock *clk, struct timeval const *start);
+bool sample_clock_is_valid(struct sample_clock const *clk);
+void sample_clock_get_time(struct sample_clock const *clk, uint64_t sample_pos,
+		double sample_rate, struct timeval *result);
+void sample_clock_anchors_create(struct sample_clock *clk);
+void sample_clock_anchors_destroy(struct sample_clock *clk);
+void sample_clock_add_anchor(struct sample_clock *clk, uint64_t sample_pos,
+		double sample_rate, struct timeval const *time);
@@ -15,6 +15,7 @@
 static statsd_link *statsd = NULL;
 
 static char const *counters_per_channel[] = {
+	"demod.gaps",
 	"demod.preamble.A2_found",
 	"demod.preamble.M1_found",
 	"demod.preamble.errors.M1_not_found",
@@ -28,6 +29,7 @@ static char const *counters_per_channel[] = {
 	"lpdu.errors.too_short",
 	"lpdus.good",
 	"lpdus.processed",
+	"channelizer.waits",
 	NULL
 };
 
@@ -118,6 +120,15 @@ void statsd_counter_per_channel_increment(int32_t freq, char *counter) {
 	statsd_inc(statsd, metric, 1.0);
 }
 
+void statsd_counter_per_channel_add(int32_t freq, char *counter, size_t value) {
+	if(statsd == NULL) {
+		return;
+	}
+	char metric[256];
+	snprintf(metric, sizeof(metric), "channels.%d.%s", freq, counter);
+	statsd_count(statsd, metric, value, 1.0);
+}
+
 void statsd_counter_per_msgdir_increment(la_msg_dir msg_dir, char *counter) {
 	if(statsd == NULL) {
 		return;
@@ -134,6 +145,13 @@ void statsd_counter_increment(char *counter) {
 	statsd_inc(statsd, counter, 1.0);
 }
 
+void statsd_counter_add(char *counter, size_t value) {
+	if(statsd == NULL) {
+		return;
+	}
+	statsd_count(statsd, counter, value, 1.0);
+}
+
 void statsd_gauge_set(char *gauge, size_t value) {
 	if(statsd == NULL) {
 		return;
@@ -14,20 +14,26 @@ void statsd_initialize_counter_set(char **counter_set);
 // Can't have char const * pointers here, because statsd-c-client
 // may potentially modify their contents
 void statsd_counter_per_channel_increment(int32_t freq, char *counter);
+void statsd_counter_per_channel_add(int32_t freq, char *counter, size_t value);
 void statsd_timing_delta_per_channel_send(int32_t freq, char *timer, struct timeval ts);
 void statsd_counter_per_msgdir_increment(la_msg_dir msg_dir, char *counter);
 void statsd_counter_increment(char *counter);
+void statsd_counter_add(char *counter, size_t value);
 void statsd_gauge_set(char *gauge, size_t value);
 
 #define statsd_increment_per_channel(freq, counter) statsd_counter_per_channel_increment(freq, counter)
+#define statsd_increment_per_channel_by(freq, counter, value) statsd_counter_per_channel_add(freq, counter, value)
 #define statsd_timing_delta_per_channel(freq, timer, start) statsd_timing_delta_per_channel_send(freq, timer, start)
 #define statsd_increment_per_msgdir(counter, msgdir) statsd_counter_per_msgdir_increment(counter, msgdir)
 #define statsd_increment(counter) statsd_counter_increment(counter)
+#define statsd_increment_by(counter, value) statsd_counter_add(counter, value)
 #define statsd_set(gauge, value) statsd_gauge_set(gauge, value)
 #else
 #define statsd_increment_per_channel(freq, counter) nop()
+#define statsd_increment_per_channel_by(freq, counter, value) nop()
 #define statsd_timing_delta_per_channel(freq, timer, start) nop()
 #define statsd_increment_per_msgdir(counter, msgdir) nop()
 #define statsd_increment(counter) nop()
+#define statsd_increment_by(counter, value) nop()
 #define statsd_set(gauge, value) nop()
 #endif
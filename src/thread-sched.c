@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#define _GNU_SOURCE             // cpu_set_t, pthread_attr_setaffinity_np
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>              // fprintf
+#include <stdlib.h>             // strtol
+#include <string.h>             // strchr, strlen, strncmp, strerror
+#include <errno.h>              // errno, EPERM
+#include <pthread.h>            // pthread_*
+#include <sched.h>              // SCHED_FIFO, sched_get_priority_*, CPU_*
+#include <stdatomic.h>          // atomic_flag
+#include <sys/mman.h>           // mlockall
+#include "config.h"             // HAVE_PTHREAD_SETAFFINITY
+#include "thread-sched.h"
+#include "util.h"               // ASSERT, debug_print
+
+static char const *thread_class_names[THREAD_CLASS_CNT] = {
+	[THREAD_CLASS_OTHER] = NULL,
+	[THREAD_CLASS_INPUT] = "input",
+	[THREAD_CLASS_FFT] = "fft",
+	[THREAD_CLASS_CHANNEL] = "channels",
+	[THREAD_CLASS_DECODER] = "decoder",
+	[THREAD_CLASS_OUTPUT] = "output"
+};
+
+#ifdef HAVE_PTHREAD_SETAFFINITY
+static struct {
+	cpu_set_t cpus;
+	bool cpus_set;
+} thread_classes[THREAD_CLASS_CNT];
+#endif
+
+// SCHED_FIFO priority of input threads (0 = use default scheduling policy)
+static int32_t rt_priority = 0;
+static atomic_flag rt_warning_printed = ATOMIC_FLAG_INIT;
+
+#ifdef HAVE_PTHREAD_SETAFFINITY
+// Parses a list of CPUs in the same format as taskset -c (eg. "0-3,8,10-11")
+static bool parse_cpu_list(char const *str, cpu_set_t *cpus) {
+	CPU_ZERO(cpus);
+	char const *p = str;
+	char *end = NULL;
+	do {
+		long first = strtol(p, &end, 10);
+		if(end == p || first < 0) {
+			goto fail;
+		}
+		long last = first;
+		if(*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if(end == p || last < first) {
+				goto fail;
+			}
+		}
+		if(last >= CPU_SETSIZE) {
+			goto fail;
+		}
+		for(long cpu = first; cpu <= last; cpu++) {
+			CPU_SET(cpu, cpus);
+		}
+		p = end;
+	} while(*p++ == ',');
+	if(p[-1] == '\0') {
+		return true;
+	}
+fail:
+	fprintf(stderr, "Invalid CPU list '%s'\n", str);
+	return false;
+}
+#endif
+
+// Parses <thread_class>=<cpu_list> and sets the CPU affinity
+// of all threads of that class started afterwards.
+bool thread_sched_set_affinity(char const *spec) {
+	ASSERT(spec != NULL);
+	char const *eq = strchr(spec, '=');
+	if(eq == NULL) {
+		fprintf(stderr, "Invalid --cpu-affinity value '%s': expected <thread_class>=<cpu_list>\n", spec);
+		return false;
+	}
+	size_t name_len = eq - spec;
+	enum thread_class cls = THREAD_CLASS_OTHER;
+	for(int32_t i = THREAD_CLASS_OTHER + 1; i < THREAD_CLASS_CNT; i++) {
+		if(strlen(thread_class_names[i]) == name_len && !strncmp(spec, thread_class_names[i], name_len)) {
+			cls = i;
+			break;
+		}
+	}
+	if(cls == THREAD_CLASS_OTHER) {
+		fprintf(stderr, "Unknown thread class '%.*s' (valid classes: input, fft, channels, decoder, output)\n",
+				(int)name_len, spec);
+		return false;
+	}
+#ifdef HAVE_PTHREAD_SETAFFINITY
+	cpu_set_t cpus;
+	if(parse_cpu_list(eq + 1, &cpus) == false) {
+		return false;
+	}
+	thread_classes[cls].cpus = cpus;
+	thread_classes[cls].cpus_set = true;
+	return true;
+#else
+	fprintf(stderr, "Setting CPU affinity is not supported on this platform\n");
+	return false;
+#endif
+}
+
+// Makes input threads use SCHED_FIFO policy with the given priority
+bool thread_sched_set_rt_priority(int32_t priority) {
+	int32_t min = sched_get_priority_min(SCHED_FIFO);
+	int32_t max = sched_get_priority_max(SCHED_FIFO);
+	if(priority < min || priority > max) {
+		fprintf(stderr, "Invalid real-time priority %d: must be between %d and %d\n",
+				priority, min, max);
+		return false;
+	}
+	rt_priority = priority;
+	return true;
+}
+
+// Applies process-wide settings. Must be called after all
+// thread_sched_set_* calls and before starting any threads.
+void thread_sched_init(void) {
+	if(rt_priority > 0) {
+		// Page faults in the sample path would defeat the purpose
+		// of real-time scheduling
+		if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+			fprintf(stderr, "Warning: could not lock memory: %s\n", strerror(errno));
+		} else {
+			debug_print(D_MISC, "memory locked\n");
+		}
+	}
+}
+
+// Starts a thread of the given class with the configured CPU affinity
+// and scheduling policy. If real-time scheduling is not permitted,
+// the thread is started with the default policy.
+int32_t thread_sched_create(pthread_t *pth, enum thread_class cls,
+		void *(*start_routine)(void *), void *thread_ctx) {
+	ASSERT(pth != NULL);
+	ASSERT(cls < THREAD_CLASS_CNT);
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+#ifdef HAVE_PTHREAD_SETAFFINITY
+	if(thread_classes[cls].cpus_set) {
+		pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &thread_classes[cls].cpus);
+	}
+#endif
+	bool const rt = cls == THREAD_CLASS_INPUT && rt_priority > 0;
+	if(rt) {
+		struct sched_param param = { .sched_priority = rt_priority };
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+	int32_t ret = pthread_create(pth, &attr, start_routine, thread_ctx);
+	if(ret == EPERM && rt) {
+		if(!atomic_flag_test_and_set(&rt_warning_printed)) {
+			fprintf(stderr, "Warning: no permission to use real-time scheduling, "
+					"input threads will run with normal priority\n");
+		}
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+		ret = pthread_create(pth, &attr, start_routine, thread_ctx);
+	}
+	pthread_attr_destroy(&attr);
+	return ret;
+}
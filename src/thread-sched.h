@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>            // pthread_t
+
+// Threads are grouped into classes which may be pinned to different
+// sets of CPUs, so that the sample path may be isolated from output
+// and logging jitter.
+enum thread_class {
+	THREAD_CLASS_OTHER = 0,     // not configurable
+	THREAD_CLASS_INPUT,         // sample source (device, network, file)
+	THREAD_CLASS_FFT,           // pre-decimator and channelizer FFT
+	THREAD_CLASS_CHANNEL,       // HFDL channel demodulators
+	THREAD_CLASS_DECODER,       // PDU decoder
+	THREAD_CLASS_OUTPUT,        // outputs and I/Q recorders
+	THREAD_CLASS_CNT
+};
+
+bool thread_sched_set_affinity(char const *spec);
+bool thread_sched_set_rt_priority(int32_t priority);
+void thread_sched_init(void);
+int32_t thread_sched_create(pthread_t *pth, enum thread_class cls,
+		void *(*start_routine)(void *), void *thread_ctx);
@@ -5,6 +5,7 @@
 #include <errno.h>                  // errno
 #include <string.h>                 // strerror
 #include <unistd.h>                 // _exit
+#include <sys/mman.h>               // madvise
 #include <libacars/libacars.h>      // la_proto_node, la_type_descriptor
 #include <libacars/vstring.h>       // la_vstring
 #include <libacars/json.h>          // la_json_append_*
@@ -13,6 +14,7 @@
 #include "pthread_barrier.h"
 #endif
 #include "util.h"                   // struct octet_string, struct location
+#include "thread-sched.h"           // thread_sched_create
 #include "globals.h"                // Systable, Systable_lock, Systable_unlock,
                                     // AC_cache, AC_cache_lock, AC_cache_unlock
 #include "systable.h"               // systable_get_station_name
@@ -42,6 +44,43 @@ void *xrealloc(void *ptr, size_t size, char const *file, int32_t line, char cons
 	return ptr;
 }
 
+// Alignment of sample buffers. It's enough for the widest vector
+// instructions used by FFTW (AVX-512) and equal to the cache line size.
+#define SAMPLE_BUF_ALIGNMENT 64
+// Buffers of at least this size are aligned to huge page boundary,
+// so that they may be backed by transparent huge pages
+#define HUGE_PAGE_SIZE (2UL * 1024UL * 1024UL)
+
+// Allocates a buffer for nmemb elements of the given size, aligned for SIMD
+// access. Zeroing may be skipped for buffers which are always written before
+// being read, so that their pages are mapped (and placed on a NUMA node) only
+// when first used by the thread which fills them.
+void *xalloc_aligned(size_t nmemb, size_t size, bool zero, char const *file, int32_t line, char const *func) {
+	size_t const len = nmemb * size;
+	size_t const alignment = len >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : SAMPLE_BUF_ALIGNMENT;
+	void *ptr = NULL;
+	int32_t ret = posix_memalign(&ptr, alignment, len > 0 ? len : 1);
+	if(ret != 0) {
+		fprintf(stderr, "%s:%d: %s(): posix_memalign(%zu, %zu) failed: %s\n",
+				file, line, func, alignment, len, strerror(ret));
+		_exit(1);
+	}
+#ifdef MADV_HUGEPAGE
+	if(alignment == HUGE_PAGE_SIZE) {
+		// Large sample rings are streamed through all the time, so huge
+		// pages save a lot of TLB misses. This is only a hint - it fails
+		// harmlessly if transparent huge pages are disabled.
+		if(madvise(ptr, len / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE, MADV_HUGEPAGE) == 0) {
+			debug_print(D_MISC, "%s: %zu bytes, using huge pages\n", func, len);
+		}
+	}
+#endif
+	if(zero) {
+		memset(ptr, 0, len);
+	}
+	return ptr;
+}
+
 static int32_t detach_thread(pthread_t *pth) {
 	ASSERT(pth);
 	int32_t ret = 0;
@@ -52,9 +91,9 @@ static int32_t detach_thread(pthread_t *pth) {
 	return ret;
 }
 
-int32_t start_thread(pthread_t *pth, void *(*start_routine)(void *), void *thread_ctx) {
+int32_t start_thread(pthread_t *pth, enum thread_class cls, void *(*start_routine)(void *), void *thread_ctx) {
 	int32_t ret = 0;
-	if((ret = pthread_create(pth, NULL, start_routine, thread_ctx) != 0)) {
+	if((ret = thread_sched_create(pth, cls, start_routine, thread_ctx) != 0)) {
 		errno = ret;
 		perror("pthread_create() failed");
 		return ret;
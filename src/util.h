@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>                 // offsetof
 #include <stdio.h>                  // fprintf, stderr
 #include <pthread.h>                // pthread_t, pthread_barrier_t
@@ -8,6 +9,7 @@
 #include <libacars/libacars.h>      // la_proto_node, la_type_descriptor
 #include <libacars/vstring.h>       // la_vstring
 #include "globals.h"                // Config
+#include "thread-sched.h"           // enum thread_class
 #include "config.h"
 #ifndef HAVE_PTHREAD_BARRIERS
 #include "pthread_barrier.h"
@@ -95,6 +97,9 @@
 #define XREALLOC(ptr, size) xrealloc((ptr), (size), __FILE__, __LINE__, __func__)
 #define XFREE(ptr) do { free(ptr); ptr = NULL; } while(0)
 #define NEW(type, x) type *(x) = XCALLOC(1, sizeof(type))
+// Sample buffers. Memory allocated with these may be freed with XFREE.
+#define XCALLOC_ALIGNED(nmemb, size) xalloc_aligned((nmemb), (size), true, __FILE__, __LINE__, __func__)
+#define XMALLOC_ALIGNED(nmemb, size) xalloc_aligned((nmemb), (size), false, __FILE__, __LINE__, __func__)
 #define UNUSED(x) (void)(x)
 #define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
 #define max(a, b) ((a) > (b) ? (a) : (b))
@@ -106,7 +111,8 @@
 
 void *xcalloc(size_t nmemb, size_t size, char const *file, int32_t line, char const *func);
 void *xrealloc(void *ptr, size_t size, char const *file, int32_t line, char const *func);
-int32_t start_thread(pthread_t *pth, void *(*start_routine)(void *), void *thread_ctx);
+void *xalloc_aligned(size_t nmemb, size_t size, bool zero, char const *file, int32_t line, char const *func);
+int32_t start_thread(pthread_t *pth, enum thread_class cls, void *(*start_routine)(void *), void *thread_ctx);
 void stop_thread(pthread_t pth);
 int32_t pthread_barrier_create(pthread_barrier_t *barrier, unsigned count);
 int32_t pthread_cond_initialize(pthread_cond_t *cond);
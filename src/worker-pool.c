@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>              // fprintf
+#include <string.h>             // strerror
+#include <pthread.h>            // pthread_*
+#include <stdatomic.h>          // atomic_*
+#include "worker-pool.h"
+#include "util.h"               // NEW, XCALLOC, XREALLOC, XFREE, ASSERT, debug_print
+#include "thread-sched.h"       // thread_sched_create
+
+// Work-stealing thread pool.
+// Every worker has its own task queue. A task submitted with a given queue
+// hint always lands in the same queue, so that it is usually run by the same
+// worker (which keeps its data in that core's cache). A worker which runs
+// out of tasks steals them from the other queues, starting from the
+// opposite end, before it goes to sleep.
+
+#define WORKER_QUEUE_INITIAL_SIZE 16
+
+struct worker_queue {
+	pthread_mutex_t mutex;
+	struct worker_task **tasks;     // ring of task pointers
+	size_t head;
+	size_t len;
+	size_t size;
+	char padding[64];               // keep queues in separate cache lines
+};
+
+struct worker {
+	struct worker_pool *pool;
+	pthread_t thread;
+	int32_t id;
+};
+
+struct worker_pool {
+	struct worker_queue *queues;
+	struct worker *workers;
+	int32_t queue_cnt;
+	int32_t thread_cnt;             // number of running workers
+	pthread_mutex_t idle_mutex;
+	pthread_cond_t idle_cond;
+	atomic_long pending;            // number of queued tasks
+	atomic_int idle_cnt;            // number of sleeping workers
+	atomic_bool stop;
+};
+
+static void worker_queue_push(struct worker_queue *q, struct worker_task *task) {
+	pthread_mutex_lock(&q->mutex);
+	if(q->len == q->size) {
+		size_t const new_size = 2 * q->size;
+		q->tasks = XREALLOC(q->tasks, new_size * sizeof(struct worker_task *));
+		// Unwrap the ring, so that the new space follows its tail
+		for(size_t i = 0; i < q->head; i++) {
+			q->tasks[q->size + i] = q->tasks[i];
+		}
+		q->size = new_size;
+	}
+	q->tasks[(q->head + q->len) % q->size] = task;
+	q->len++;
+	pthread_mutex_unlock(&q->mutex);
+}
+
+// The owner takes tasks from the head (in submission order),
+// thieves take them from the tail.
+static struct worker_task *worker_queue_pop(struct worker_queue *q, bool steal) {
+	struct worker_task *task = NULL;
+	pthread_mutex_lock(&q->mutex);
+	if(q->len > 0) {
+		if(steal) {
+			task = q->tasks[(q->head + q->len - 1) % q->size];
+		} else {
+			task = q->tasks[q->head];
+			q->head = (q->head + 1) % q->size;
+		}
+		q->len--;
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return task;
+}
+
+static struct worker_task *worker_get_task(struct worker *w) {
+	struct worker_pool *pool = w->pool;
+	struct worker_task *task = worker_queue_pop(&pool->queues[w->id], false);
+	for(int32_t i = 1; task == NULL && i < pool->thread_cnt; i++) {
+		task = worker_queue_pop(&pool->queues[(w->id + i) % pool->thread_cnt], true);
+	}
+	if(task != NULL) {
+		atomic_fetch_sub(&pool->pending, 1);
+	}
+	return task;
+}
+
+static void *worker_thread(void *ctx) {
+	struct worker *w = ctx;
+	struct worker_pool *pool = w->pool;
+	while(true) {
+		struct worker_task *task = worker_get_task(w);
+		if(task != NULL) {
+			task->run(task);
+			continue;
+		}
+		pthread_mutex_lock(&pool->idle_mutex);
+		// Announce going to sleep before checking for new tasks once again.
+		// Submitters increment the pending count before checking idle_cnt,
+		// so no wakeup gets lost.
+		atomic_fetch_add(&pool->idle_cnt, 1);
+		while(atomic_load(&pool->pending) <= 0 && !atomic_load(&pool->stop)) {
+			pthread_cond_wait(&pool->idle_cond, &pool->idle_mutex);
+		}
+		atomic_fetch_sub(&pool->idle_cnt, 1);
+		pthread_mutex_unlock(&pool->idle_mutex);
+		if(atomic_load(&pool->stop) && atomic_load(&pool->pending) <= 0) {
+			break;
+		}
+	}
+	debug_print(D_MISC, "worker %d: exiting\n", w->id);
+	return NULL;
+}
+
+struct worker_pool *worker_pool_create(int32_t thread_cnt, enum thread_class cls) {
+	ASSERT(thread_cnt > 0);
+	NEW(struct worker_pool, pool);
+	pool->queue_cnt = pool->thread_cnt = thread_cnt;
+	pool->queues = XCALLOC(thread_cnt, sizeof(struct worker_queue));
+	pool->workers = XCALLOC(thread_cnt, sizeof(struct worker));
+	atomic_init(&pool->pending, 0);
+	atomic_init(&pool->idle_cnt, 0);
+	atomic_init(&pool->stop, false);
+	pthread_mutex_init(&pool->idle_mutex, NULL);
+	pthread_cond_init(&pool->idle_cond, NULL);
+	for(int32_t i = 0; i < thread_cnt; i++) {
+		struct worker_queue *q = &pool->queues[i];
+		pthread_mutex_init(&q->mutex, NULL);
+		q->size = WORKER_QUEUE_INITIAL_SIZE;
+		q->tasks = XCALLOC(q->size, sizeof(struct worker_task *));
+	}
+	for(int32_t i = 0; i < thread_cnt; i++) {
+		struct worker *w = &pool->workers[i];
+		w->pool = pool;
+		w->id = i;
+		int32_t ret = thread_sched_create(&w->thread, cls, worker_thread, w);
+		if(ret != 0) {
+			fprintf(stderr, "Failed to start worker thread: %s\n", strerror(ret));
+			pool->thread_cnt = i;
+			worker_pool_destroy(pool);
+			return NULL;
+		}
+	}
+	debug_print(D_MISC, "started %d worker threads\n", thread_cnt);
+	return pool;
+}
+
+// Queues the task for execution. The same task must not be submitted again
+// before it starts running.
+void worker_pool_submit(struct worker_pool *pool, struct worker_task *task, size_t queue_hint) {
+	ASSERT(pool != NULL);
+	ASSERT(task != NULL);
+	ASSERT(task->run != NULL);
+	worker_queue_push(&pool->queues[queue_hint % pool->thread_cnt], task);
+	atomic_fetch_add(&pool->pending, 1);
+	if(atomic_load(&pool->idle_cnt) > 0) {
+		pthread_mutex_lock(&pool->idle_mutex);
+		pthread_mutex_unlock(&pool->idle_mutex);
+		pthread_cond_signal(&pool->idle_cond);
+	}
+}
+
+int32_t worker_pool_thread_cnt(struct worker_pool const *pool) {
+	ASSERT(pool != NULL);
+	return pool->thread_cnt;
+}
+
+// Waits until all queued tasks are done and stops the workers
+void worker_pool_destroy(struct worker_pool *pool) {
+	if(pool == NULL) {
+		return;
+	}
+	atomic_store(&pool->stop, true);
+	pthread_mutex_lock(&pool->idle_mutex);
+	pthread_cond_broadcast(&pool->idle_cond);
+	pthread_mutex_unlock(&pool->idle_mutex);
+	for(int32_t i = 0; i < pool->thread_cnt; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+	for(int32_t i = 0; i < pool->queue_cnt; i++) {
+		pthread_mutex_destroy(&pool->queues[i].mutex);
+		XFREE(pool->queues[i].tasks);
+	}
+	pthread_mutex_destroy(&pool->idle_mutex);
+	pthread_cond_destroy(&pool->idle_cond);
+	XFREE(pool->queues);
+	XFREE(pool->workers);
+	XFREE(pool);
+}
@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>             // size_t
+#include "thread-sched.h"       // enum thread_class
+
+// A unit of work to be run by the pool. Meant to be embedded in a larger
+// structure and retrieved with container_of() in the run routine.
+struct worker_task {
+	void (*run)(struct worker_task *task);
+};
+
+struct worker_pool;
+
+struct worker_pool *worker_pool_create(int32_t thread_cnt, enum thread_class cls);
+void worker_pool_submit(struct worker_pool *pool, struct worker_task *task, size_t queue_hint);
+int32_t worker_pool_thread_cnt(struct worker_pool const *pool);
+void worker_pool_destroy(struct worker_pool *pool);